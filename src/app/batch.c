@@ -0,0 +1,312 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file batch.c
+ * @brief sippak batch mode
+ *
+ * Command lines are read from file or stdin and sent through session
+ * attached to the main endpoint, up to --concurrency at a time. Next
+ * line is read only when a request completes, so input of any size is
+ * never held in memory. Results are written to stdout as JSON lines,
+ * as they complete or, with --ordered, in input order. Ordered output
+ * keeps at most --concurrency lines between the oldest unfinished one
+ * and the newest sent, so one slow destination stalls the window.
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include "sippak.h"
+
+#define NAME "batch"
+
+#define REQ_POOL_SIZE 4000
+
+struct result {
+  unsigned long id;
+  const char *cmd;
+  pj_bool_t done;
+  int len;
+  char json[SIPPAK_CMDLINE_JSON_LEN];
+};
+
+struct batch {
+  struct sippak_app *app;
+  sippak_session *sess;
+  int fd;
+  pj_bool_t eof;
+  pj_bool_t skip;               // rest of too long line
+  char line[SIPPAK_CMDLINE_LEN];
+  pj_size_t len;
+  pj_size_t scan;               // line buffer is searched for newline from here
+
+  unsigned conc;
+  pj_bool_t ordered;
+  struct result *res;           // conc results
+  unsigned *free_res;           // free results stack, unordered output
+  unsigned free_cnt;
+
+  unsigned long next_id;        // id of next line
+  unsigned long next_out;       // ordered output: id written next
+  unsigned inflight;
+  unsigned long ok, failed;
+};
+
+static struct batch *batch;
+
+static void write_results (struct batch *b)
+{
+  struct result *r;
+
+  while (b->next_out < b->next_id) {
+    r = &b->res[b->next_out % b->conc];
+    if (!r->done) {
+      break;
+    }
+    fwrite(r->json, 1, r->len, stdout);
+    r->done = PJ_FALSE;
+    b->next_out++;
+  }
+  fflush(stdout);
+}
+
+static void result_set (struct batch *b, struct result *r, pj_status_t status,
+                        int code, const pj_str_t *reason, pj_uint32_t latency_us)
+{
+  if (status == PJ_SUCCESS) {
+    b->ok++;
+  } else {
+    b->failed++;
+  }
+  r->len = sippak_cmdline_json(r->json, sizeof(r->json), r->id, r->cmd,
+      status, code, reason, latency_us);
+
+  if (b->ordered) {
+    r->done = PJ_TRUE;
+    write_results(b);
+    return;
+  }
+  fwrite(r->json, 1, r->len, stdout);
+  fflush(stdout);
+  b->free_res[b->free_cnt++] = r - b->res;
+}
+
+static void on_result (const struct sippak_result *res)
+{
+  batch->inflight--;
+  result_set(batch, res->user_data, res->status, res->code, &res->reason, res->latency_us);
+}
+
+static struct result *result_alloc (struct batch *b)
+{
+  struct result *r;
+
+  if (b->ordered) {
+    r = &b->res[b->next_id % b->conc];
+  } else {
+    r = &b->res[b->free_res[--b->free_cnt]];
+  }
+  r->id = ++b->next_id;
+  r->cmd = "unknown";
+  r->done = PJ_FALSE;
+
+  return r;
+}
+
+/* Request is sent or its error result is set. */
+static void run_line (struct batch *b, char *line)
+{
+  struct sippak_probe probe;
+  struct result *r = result_alloc(b);
+  pj_pool_t *pool;
+  pj_status_t status;
+
+  pool = pjsip_endpt_create_pool(b->app->endpt, "bline%p", REQ_POOL_SIZE, REQ_POOL_SIZE);
+  if (pool == NULL) {
+    result_set(b, r, PJ_ENOMEM, 0, NULL, 0);
+    return;
+  }
+
+  status = sippak_cmdline_probe(b->app, pool, line, &probe, &r->cmd);
+  if (status == PJ_SUCCESS) {
+    probe.cb = &on_result;
+    probe.user_data = r;
+    b->inflight++;
+    status = sippak_session_request(b->sess, &probe);
+    if (status != PJ_SUCCESS) {
+      b->inflight--;
+    }
+  }
+  // request copies what it needs, command line pool is not kept
+  pj_pool_release(pool);
+
+  if (status != PJ_SUCCESS) {
+    result_set(b, r, status, 0, NULL, 0);
+  }
+}
+
+/* Next complete line from buffer, NULL if more input is needed. */
+static char *next_line (struct batch *b)
+{
+  char *line, *nl;
+
+  while ((nl = memchr(b->line + b->scan, '\n', b->len - b->scan)) != NULL) {
+    line = b->line;
+    *nl = '\0';
+    if (nl > line && nl[-1] == '\r') {
+      nl[-1] = '\0';
+    }
+    // consumed part is moved out on next read
+    b->scan = nl + 1 - b->line;
+    if (b->skip) {
+      b->skip = PJ_FALSE;
+      memmove(b->line, nl + 1, b->len - b->scan);
+      b->len -= b->scan;
+      b->scan = 0;
+      continue;
+    }
+    return line;
+  }
+
+  return NULL;
+}
+
+static void line_done (struct batch *b)
+{
+  b->len -= b->scan;
+  memmove(b->line, b->line + b->scan, b->len);
+  b->scan = 0;
+}
+
+/* Read input when there is room for more requests, never block. */
+static void read_input (struct batch *b)
+{
+  struct pollfd pfd;
+  ssize_t len;
+  char *line;
+
+  while (b->inflight < b->conc && (!b->ordered || b->next_id - b->next_out < b->conc)) {
+    line = next_line(b);
+    if (line != NULL) {
+      while (*line == ' ' || *line == '\t') {
+        line++;
+      }
+      if (*line && *line != '#') {
+        run_line(b, line);
+      }
+      line_done(b);
+      continue;
+    }
+    if (b->eof) {
+      if (b->len > 0) {
+        b->line[b->len] = '\n'; // last line without newline
+        b->len++;
+        continue;
+      }
+      return;
+    }
+
+    if (b->len == sizeof(b->line) - 1) {
+      PJ_LOG(1, (NAME, "Command line %lu is longer than %d bytes.",
+            b->next_id + 1, SIPPAK_CMDLINE_LEN - 1));
+      result_set(b, result_alloc(b), PJ_ETOOBIG, 0, NULL, 0);
+      b->len = 0;
+      b->skip = PJ_TRUE;
+      continue;
+    }
+
+    pfd.fd = b->fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 0) <= 0) {
+      return;
+    }
+    b->scan = b->len;
+    len = read(b->fd, b->line + b->len, sizeof(b->line) - 1 - b->len);
+    if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+      return;
+    }
+    if (len <= 0) {
+      b->eof = PJ_TRUE;
+      continue;
+    }
+    b->len += len;
+  }
+}
+
+PJ_DEF(pj_status_t) sippak_batch_run (struct sippak_app *app)
+{
+  struct batch *b;
+  pj_str_t *local_addr;
+  int local_port;
+  pj_status_t status;
+  unsigned i;
+
+  b = PJ_POOL_ZALLOC_T(app->pool, struct batch);
+  b->app = app;
+  b->conc = app->cfg.batch.concurrency;
+  b->ordered = app->cfg.batch.ordered;
+  b->res = pj_pool_calloc(app->pool, b->conc, sizeof(*b->res));
+  b->free_res = pj_pool_calloc(app->pool, b->conc, sizeof(*b->free_res));
+  for (i = 0; i < b->conc; i++) {
+    b->free_res[b->free_cnt++] = b->conc - 1 - i;
+  }
+
+  if (app->cfg.batch.file == NULL || pj_ansi_strcmp(app->cfg.batch.file, "-") == 0) {
+    b->fd = STDIN_FILENO;
+  } else {
+    b->fd = open(app->cfg.batch.file, O_RDONLY);
+    if (b->fd < 0) {
+      PJ_LOG(1, (NAME, "Failed to open batch file %s", app->cfg.batch.file));
+      return PJ_RETURN_OS_ERROR(errno);
+    }
+  }
+
+  status = sippak_transport_init(app, &local_addr, &local_port);
+  if (status == PJ_SUCCESS) {
+    status = sippak_session_attach(app->endpt, &b->sess);
+  }
+  if (status != PJ_SUCCESS) {
+    PJ_LOG(1, (NAME, "Failed to start batch session."));
+    goto done;
+  }
+  batch = b;
+
+  read_input(b);
+  while (b->inflight > 0 || !b->eof || b->len > 0) {
+    pj_time_val timeout = {0, 10};
+    pjsip_endpt_handle_events(app->endpt, &timeout);
+    read_input(b);
+    sippak_stats_poll(app);
+  }
+
+  sippak_session_destroy(b->sess);
+  batch = NULL;
+  PJ_LOG(3, (NAME, "Lines: %lu, completed: %lu, failed: %lu", b->next_id, b->ok, b->failed));
+
+done:
+  if (b->fd != STDIN_FILENO) {
+    close(b->fd);
+  }
+  return status;
+}
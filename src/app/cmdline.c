@@ -0,0 +1,229 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file cmdline.c
+ * @brief command lines of daemon and batch modes
+ *
+ * Line is parsed with the same options as sippak itself into its own
+ * application structure and turned into session probe. Result of line
+ * is one line of JSON. Scenario steps are split the same way.
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+#include "sippak.h"
+
+#define NAME "cmdline"
+#define MAX_ARGS 64
+
+/* Options probe does not honour. Probe is sent from shared transports
+ * with headers of session, line with them would not do what it says. */
+static const char *probe_unsupported (const struct sippak_app *app)
+{
+  const struct {
+    pj_bool_t set;
+    const char *name;
+  } opt[] = {
+    { app->cfg.proxy.cnt > 0,                   "--proxy" },
+    { app->cfg.hdrs.cnt > 0,                    "--header" },
+    { app->cfg.proto != PJSIP_TRANSPORT_UDP,    "--proto" },
+    { app->cfg.from_name.slen > 0,              "--from-name" },
+    { app->cfg.local_host.slen > 0,             "--local-host" },
+    { app->cfg.local_port > 0,                  "--local-port" },
+    { app->cfg.user_agent.slen > 0,             "--user-agent" },
+    { app->cfg.contact.slen > 0,                "--contact" },
+  };
+  unsigned i;
+
+  for (i = 0; i < PJ_ARRAY_SIZE(opt); i++) {
+    if (opt[i].set) {
+      return opt[i].name;
+    }
+  }
+  return NULL;
+}
+
+PJ_DEF(int) sippak_cmdline_split (char *line, char *argv[], int max)
+{
+  int argc = 0;
+  pj_bool_t quoted;
+  char *p = line, *out;
+
+  while (*p && argc < max) {
+    while (*p == ' ' || *p == '\t') {
+      p++;
+    }
+    if (*p == '\0') {
+      break;
+    }
+    argv[argc++] = out = p;
+    quoted = PJ_FALSE;
+    while (*p && (quoted || (*p != ' ' && *p != '\t'))) {
+      if (*p == '"') {
+        quoted = !quoted;
+        p++;
+        continue;
+      }
+      *out++ = *p++;
+    }
+    if (*p) {
+      p++;
+    }
+    *out = '\0';
+  }
+
+  return argc;
+}
+
+static const char *cstr (pj_pool_t *pool, const pj_str_t *str)
+{
+  pj_str_t dup;
+
+  if (str->slen == 0) {
+    return NULL;
+  }
+  pj_strdup_with_null(pool, &dup, str);
+  return dup.ptr;
+}
+
+static int json_escape (char *buf, int size, const char *str, int len)
+{
+  int n = 0, i;
+
+  for (i = 0; i < len && n < size - 7; i++) {
+    unsigned char c = (unsigned char)str[i];
+    if (c == '"' || c == '\\') {
+      buf[n++] = '\\';
+      buf[n++] = c;
+    } else if (c < 0x20) {
+      n += pj_ansi_snprintf(buf + n, size - n, "\\u%04x", c);
+    } else {
+      buf[n++] = c;
+    }
+  }
+  buf[n] = '\0';
+
+  return n;
+}
+
+PJ_DEF(pj_status_t) sippak_cmdline_probe (struct sippak_app *app,
+                                          pj_pool_t *pool,
+                                          char *line,
+                                          struct sippak_probe *probe,
+                                          const char **cmd)
+{
+  struct sippak_app *req_app;
+  const char *opt;
+  char *argv[MAX_ARGS];
+  pj_str_t contact;
+  int argc, log_level, log_decor;
+  pj_status_t status;
+
+  *cmd = "unknown";
+  pj_bzero(probe, sizeof(*probe));
+
+  req_app = PJ_POOL_ZALLOC_T(pool, struct sippak_app);
+  sippak_init(req_app);
+  req_app->cp = app->cp;
+  req_app->endpt = app->endpt;
+  req_app->pool = pool;
+
+  argv[0] = (char *)PROJECT_NAME;
+  argc = 1 + sippak_cmdline_split(line, argv + 1, MAX_ARGS - 1);
+
+  // command line options must not change logging of the process
+  log_level = pj_log_get_level();
+  log_decor = pj_log_get_decor();
+  status = sippak_getopts(argc, argv, req_app);
+  pj_log_set_level(log_level);
+  pj_log_set_decor(log_decor);
+  if (status != PJ_SUCCESS) {
+    return status;
+  }
+
+  opt = probe_unsupported(req_app);
+  if (opt) {
+    PJ_LOG(2, (NAME, "Option %s is not supported in command line.", opt));
+    return PJ_ENOTSUP;
+  }
+
+  probe->uri = cstr(pool, &req_app->cfg.dest);
+  if (probe->uri == NULL) {
+    return PJ_CLI_EINVARG;
+  }
+  probe->username = cstr(pool, &req_app->cfg.username);
+  probe->password = cstr(pool, &req_app->cfg.password);
+  // line without password answers challenges with loaded HA1 of its user
+  if (probe->password == NULL) {
+    probe->cred = sippak_cred_store_find(app, &req_app->cfg.username);
+  }
+
+  switch (req_app->cfg.cmd) {
+    case CMD_PING:
+      *cmd = "ping";
+      probe->method = "OPTIONS";
+      return PJ_SUCCESS;
+    case CMD_MESSAGE:
+      *cmd = "message";
+      probe->method = "MESSAGE";
+      probe->body = cstr(pool, &req_app->cfg.body);
+      return PJ_SUCCESS;
+    case CMD_REGISTER:
+      *cmd = "register";
+      probe->method = "REGISTER";
+      if (!req_app->cfg.is_clist && app->tp_pool.cnt > 0) {
+        contact = sippak_create_contact_hdr(req_app,
+            app->tp_pool.ent[0].host, app->tp_pool.ent[0].port);
+        probe->contact = cstr(pool, &contact);
+        probe->expires = req_app->cfg.cancel ? 0 : req_app->cfg.expires;
+      }
+      return PJ_SUCCESS;
+    default:
+      return PJ_ENOTSUP; // dialog and subscription commands need own loop
+  }
+}
+
+PJ_DEF(int) sippak_cmdline_json (char *buf, int size, unsigned long id,
+                                 const char *cmd, pj_status_t status,
+                                 int code, const pj_str_t *reason,
+                                 pj_uint32_t latency_us)
+{
+  char esc[PJ_ERR_MSG_SIZE * 2];
+  char errmsg[PJ_ERR_MSG_SIZE];
+  pj_str_t err;
+  int len;
+
+  len = pj_ansi_snprintf(buf, size, "{\"id\":%lu,\"cmd\":\"%s\",\"status\":\"%s\"",
+      id, cmd, status == PJ_SUCCESS ? "ok" : "error");
+
+  if (code > 0) {
+    json_escape(esc, sizeof(esc), reason->ptr, (int)reason->slen);
+    len += pj_ansi_snprintf(buf + len, size - len,
+        ",\"code\":%d,\"reason\":\"%s\",\"latency_us\":%u", code, esc, latency_us);
+  }
+  if (status != PJ_SUCCESS) {
+    err = pj_strerror(status, errmsg, sizeof(errmsg));
+    json_escape(esc, sizeof(esc), err.ptr, (int)err.slen);
+    len += pj_ansi_snprintf(buf + len, size - len, ",\"error\":\"%s\"", esc);
+  }
+  len += pj_ansi_snprintf(buf + len, size - len, "}\n");
+
+  return len < size ? len : size - 1;
+}
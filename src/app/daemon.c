@@ -0,0 +1,353 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file daemon.c
+ * @brief sippak daemon mode
+ *
+ * Endpoint, resolver, transports and modules are set up once by main.
+ * Every line received on UNIX socket is command line, sent through
+ * session attached to the main endpoint. Result is written back as one
+ * JSON line when transaction completes, so client can pipeline lines
+ * and match results by "id".
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "sippak.h"
+
+#define NAME "daemon"
+
+#define REQ_POOL_SIZE 4000
+
+struct client {
+  int fd;
+  unsigned gen;                 // slot generation, stale results are dropped
+  unsigned long seq;            // id of last command line
+  pj_bool_t skip;               // rest of too long line
+  char line[SIPPAK_CMDLINE_LEN];
+  pj_size_t len;
+};
+
+struct request {
+  struct daemon *d;
+  unsigned slot;
+  unsigned gen;
+  unsigned long id;
+  const char *cmd;
+};
+
+struct daemon {
+  struct sippak_app *app;
+  sippak_session *sess;
+  int lfd;
+  struct client client[SIPPAK_DAEMON_MAX_CLIENTS];
+};
+
+static volatile sig_atomic_t daemon_stop;
+
+static void on_signal (int signum)
+{
+  PJ_UNUSED_ARG(signum);
+  daemon_stop = 1;
+}
+
+static void client_close (struct daemon *d, unsigned slot)
+{
+  struct client *cl = &d->client[slot];
+
+  close(cl->fd);
+  cl->fd = -1;
+  cl->gen++;
+  cl->len = 0;
+  cl->skip = PJ_FALSE;
+}
+
+/* Result line is small, slow client that can not take it is dropped. */
+static void client_write (struct daemon *d, unsigned slot, const char *buf, int len)
+{
+  struct client *cl = &d->client[slot];
+  ssize_t sent = send(cl->fd, buf, len, MSG_NOSIGNAL);
+
+  if (sent != len) {
+    PJ_LOG(3, (NAME, "Client %u does not read results. Disconnected.", slot));
+    client_close(d, slot);
+  }
+}
+
+static void reply (struct daemon *d, unsigned slot, unsigned long id,
+                   const char *cmd, pj_status_t status,
+                   int code, const pj_str_t *reason, pj_uint32_t latency_us)
+{
+  char buf[SIPPAK_CMDLINE_JSON_LEN];
+  int len;
+
+  len = sippak_cmdline_json(buf, sizeof(buf), id, cmd, status, code, reason, latency_us);
+  client_write(d, slot, buf, len);
+}
+
+static void on_result (const struct sippak_result *res)
+{
+  struct request *req = res->user_data;
+  struct daemon *d = req->d;
+
+  // client has gone or its slot belongs to another one now
+  if (d->client[req->slot].fd != -1 && d->client[req->slot].gen == req->gen) {
+    reply(d, req->slot, req->id, req->cmd, res->status,
+        res->code, &res->reason, res->latency_us);
+  }
+  free(req);
+}
+
+static void run_line (struct daemon *d, unsigned slot, char *line)
+{
+  struct client *cl = &d->client[slot];
+  struct sippak_probe probe;
+  struct request *req;
+  pj_pool_t *pool;
+  const char *cmd = "unknown";
+  unsigned long id = ++cl->seq;
+  pj_status_t status;
+
+  pool = pjsip_endpt_create_pool(d->app->endpt, "dline%p", REQ_POOL_SIZE, REQ_POOL_SIZE);
+  if (pool == NULL) {
+    reply(d, slot, id, cmd, PJ_ENOMEM, 0, NULL, 0);
+    return;
+  }
+
+  status = sippak_cmdline_probe(d->app, pool, line, &probe, &cmd);
+  if (status != PJ_SUCCESS) {
+    reply(d, slot, id, cmd, status, 0, NULL, 0);
+    pj_pool_release(pool);
+    return;
+  }
+
+  req = malloc(sizeof(*req));
+  if (req == NULL) {
+    reply(d, slot, id, cmd, PJ_ENOMEM, 0, NULL, 0);
+    pj_pool_release(pool);
+    return;
+  }
+  req->d = d;
+  req->slot = slot;
+  req->gen = cl->gen;
+  req->id = id;
+  req->cmd = cmd;
+
+  probe.cb = &on_result;
+  probe.user_data = req;
+
+  // request copies what it needs, command line pool is not kept
+  status = sippak_session_request(d->sess, &probe);
+  pj_pool_release(pool);
+  if (status != PJ_SUCCESS) {
+    reply(d, slot, id, cmd, status, 0, NULL, 0);
+    free(req);
+  }
+}
+
+static void client_read (struct daemon *d, unsigned slot)
+{
+  struct client *cl = &d->client[slot];
+  char *start, *nl;
+  ssize_t len;
+
+  len = recv(cl->fd, cl->line + cl->len, sizeof(cl->line) - cl->len - 1, 0);
+  if (len <= 0) {
+    if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+      return;
+    }
+    client_close(d, slot);
+    return;
+  }
+  cl->len += len;
+  cl->line[cl->len] = '\0';
+
+  start = cl->line;
+  while ((nl = strchr(start, '\n')) != NULL) {
+    *nl = '\0';
+    if (nl > start && nl[-1] == '\r') {
+      nl[-1] = '\0';
+    }
+    if (cl->skip) {
+      cl->skip = PJ_FALSE;
+    } else if (*start) {
+      run_line(d, slot, start);
+      if (cl->fd == -1) {
+        return; // dropped while replying
+      }
+    }
+    start = nl + 1;
+  }
+
+  cl->len -= start - cl->line;
+  memmove(cl->line, start, cl->len);
+
+  if (cl->len == sizeof(cl->line) - 1) {
+    PJ_LOG(3, (NAME, "Command line of client %u is longer than %d bytes.",
+          slot, SIPPAK_CMDLINE_LEN - 1));
+    reply(d, slot, ++cl->seq, "unknown", PJ_ETOOBIG, 0, NULL, 0);
+    cl->len = 0;
+    cl->skip = PJ_TRUE;
+  }
+}
+
+static void client_accept (struct daemon *d)
+{
+  unsigned i;
+  int fd = accept(d->lfd, NULL, NULL);
+
+  if (fd < 0) {
+    return;
+  }
+  for (i = 0; i < SIPPAK_DAEMON_MAX_CLIENTS; i++) {
+    if (d->client[i].fd == -1) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      d->client[i].fd = fd;
+      d->client[i].seq = 0;
+      return;
+    }
+  }
+  PJ_LOG(3, (NAME, "Too many clients, max is %d.", SIPPAK_DAEMON_MAX_CLIENTS));
+  close(fd);
+}
+
+static pj_status_t listen_socket (struct daemon *d, const char *path)
+{
+  struct sockaddr_un addr;
+
+  if (pj_ansi_strlen(path) >= sizeof(addr.sun_path)) {
+    PJ_LOG(1, (NAME, "Socket path is too long: %s", path));
+    return PJ_ENAMETOOLONG;
+  }
+  pj_bzero(&addr, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  pj_ansi_strcpy(addr.sun_path, path);
+
+  d->lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (d->lfd < 0) {
+    return PJ_RETURN_OS_ERROR(errno);
+  }
+  unlink(path); // left by daemon that was killed
+  if (bind(d->lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(d->lfd, SIPPAK_DAEMON_MAX_CLIENTS) != 0) {
+    pj_status_t status = PJ_RETURN_OS_ERROR(errno);
+    PJ_LOG(1, (NAME, "Failed to listen on socket %s", path));
+    close(d->lfd);
+    return status;
+  }
+  fcntl(d->lfd, F_SETFL, fcntl(d->lfd, F_GETFL) | O_NONBLOCK);
+
+  return PJ_SUCCESS;
+}
+
+static void poll_clients (struct daemon *d)
+{
+  struct pollfd pfd[SIPPAK_DAEMON_MAX_CLIENTS + 1];
+  unsigned slot[SIPPAK_DAEMON_MAX_CLIENTS + 1];
+  unsigned i, n = 0;
+
+  pfd[n].fd = d->lfd;
+  pfd[n++].events = POLLIN;
+  for (i = 0; i < SIPPAK_DAEMON_MAX_CLIENTS; i++) {
+    if (d->client[i].fd != -1) {
+      slot[n] = i;
+      pfd[n].fd = d->client[i].fd;
+      pfd[n++].events = POLLIN;
+    }
+  }
+
+  if (poll(pfd, n, 0) <= 0) {
+    return;
+  }
+  for (i = 1; i < n; i++) {
+    if (pfd[i].revents) {
+      client_read(d, slot[i]);
+    }
+  }
+  if (pfd[0].revents & POLLIN) {
+    client_accept(d);
+  }
+}
+
+PJ_DEF(pj_status_t) sippak_daemon_run (struct sippak_app *app)
+{
+  struct daemon *d;
+  pj_str_t *local_addr;
+  int local_port;
+  pj_status_t status;
+  unsigned i;
+
+  d = PJ_POOL_ZALLOC_T(app->pool, struct daemon);
+  d->app = app;
+  for (i = 0; i < SIPPAK_DAEMON_MAX_CLIENTS; i++) {
+    d->client[i].fd = -1;
+  }
+
+  status = sippak_transport_init(app, &local_addr, &local_port);
+  if (status != PJ_SUCCESS) {
+    PJ_LOG(1, (NAME, "Failed to start transport."));
+    return status;
+  }
+
+  status = sippak_session_attach(app->endpt, &d->sess);
+  if (status != PJ_SUCCESS) {
+    return status;
+  }
+
+  status = listen_socket(d, app->cfg.socket);
+  if (status != PJ_SUCCESS) {
+    sippak_session_destroy(d->sess);
+    return status;
+  }
+
+  daemon_stop = 0;
+  signal(SIGINT, &on_signal);
+  signal(SIGTERM, &on_signal);
+  PJ_LOG(3, (NAME, "Listening on %s", app->cfg.socket));
+
+  while (!daemon_stop) {
+    pj_time_val timeout = {0, 10};
+    pjsip_endpt_handle_events(app->endpt, &timeout);
+    poll_clients(d);
+    sippak_stats_poll(app);
+  }
+
+  PJ_LOG(3, (NAME, "Stopped."));
+  for (i = 0; i < SIPPAK_DAEMON_MAX_CLIENTS; i++) {
+    if (d->client[i].fd != -1) {
+      client_close(d, i);
+    }
+  }
+  // outstanding results find their clients closed
+  sippak_session_destroy(d->sess);
+  close(d->lfd);
+  unlink(app->cfg.socket);
+
+  return PJ_SUCCESS;
+}
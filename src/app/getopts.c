@@ -37,11 +37,14 @@ static pj_str_t pres_note (const char *note);
 static pj_bool_t pres_status_open (const char *status);
 static int transport_proto (const char *proto);
 static int set_port_value (const char *port);
+static pj_status_t set_port_range (struct sippak_app *app, const char *range_str);
 static pj_status_t add_custom_header (char *header, struct sippak_app *app);
 static void add_proxy (char *proxy, struct sippak_app *app);
 static int parse_command_str (const char *cmd);
 static void set_mwi_list (struct sippak_app *app, char *mwi_list_str);
-static void post_parse_setup (struct sippak_app *app);
+static pj_status_t post_parse_setup (struct sippak_app *app);
+static pj_status_t set_log_methods (struct sippak_app *app, char *list_str);
+static pj_status_t set_log_status (struct sippak_app *app, char *list_str);
 
 static enum opts_enum_t {
   OPT_NS = 1,
@@ -50,6 +53,34 @@ static enum opts_enum_t {
   OPT_LOG_TIME, // print time and ms
   OPT_LOG_LEVEL,
   OPT_LOG_SND,
+  OPT_LOG_METHOD,
+  OPT_LOG_STATUS,
+  OPT_LOG_SAMPLE,
+  OPT_LOG_COMPACT,
+  OPT_TIMING,
+  OPT_TIMESERIES,
+  OPT_STATS_INTERVAL,
+  OPT_STATS_FILE,
+  OPT_STATELESS,
+  OPT_RETRANS,
+  OPT_COUNT,
+  OPT_RATE,
+  OPT_MMSG,
+  OPT_URING,
+  OPT_THREADS,
+  OPT_SPIN,
+  OPT_FILE,
+  OPT_AUTH_CACHE,
+  OPT_CRED_FILE,
+  OPT_DAEMON,
+  OPT_SOCKET,
+  OPT_BATCH,
+  OPT_CONCURRENCY,
+  OPT_ORDERED,
+  OPT_SCENARIO,
+  OPT_DELAY,
+  OPT_FAIL_RATIO,
+  OPT_FAIL_CODE,
   OPT_PRES_STATUS,
   OPT_PRES_NOTE,
   OPT_MWI_ACC,
@@ -73,10 +104,38 @@ struct pj_getopt_option sippak_long_opts[] = {
   {"log-time",    0,  0,  OPT_LOG_TIME },
   {"log-level",   0,  0,  OPT_LOG_LEVEL },
   {"log-snd",     0,  0,  OPT_LOG_SND },
+  {"log-method",  1,  0,  OPT_LOG_METHOD },
+  {"log-status",  1,  0,  OPT_LOG_STATUS },
+  {"log-sample",  1,  0,  OPT_LOG_SAMPLE },
+  {"log-compact", 0,  0,  OPT_LOG_COMPACT },
+  {"timing",      0,  0,  OPT_TIMING },
+  {"timeseries",  1,  0,  OPT_TIMESERIES },
+  {"stats-interval", 1, 0, OPT_STATS_INTERVAL },
+  {"stats-file",  1,  0,  OPT_STATS_FILE },
+  {"stateless",   0,  0,  OPT_STATELESS },
+  {"retrans",     0,  0,  OPT_RETRANS },
+  {"count",       1,  0,  OPT_COUNT },
+  {"rate",        1,  0,  OPT_RATE },
+  {"mmsg",        0,  0,  OPT_MMSG },
+  {"uring",       0,  0,  OPT_URING },
+  {"threads",     1,  0,  OPT_THREADS },
+  {"spin",        1,  0,  OPT_SPIN },
+  {"file",        1,  0,  OPT_FILE },
   {"local-port",  1,  0,  'P' },
   {"local-host",  1,  0,  'l' },
   {"username",    1,  0,  'u' },
   {"password",    1,  0,  'p' },
+  {"auth-cache",  1,  0,  OPT_AUTH_CACHE },
+  {"cred-file",   1,  0,  OPT_CRED_FILE },
+  {"daemon",      0,  0,  OPT_DAEMON },
+  {"socket",      1,  0,  OPT_SOCKET },
+  {"batch",       2,  0,  OPT_BATCH },
+  {"concurrency", 1,  0,  OPT_CONCURRENCY },
+  {"ordered",     0,  0,  OPT_ORDERED },
+  {"scenario",    1,  0,  OPT_SCENARIO },
+  {"delay",       1,  0,  OPT_DELAY },
+  {"fail-ratio",  1,  0,  OPT_FAIL_RATIO },
+  {"fail-code",   1,  0,  OPT_FAIL_CODE },
   {"from-name",   1,  0,  'F' },
   {"proto",       1,  0,  't' },
   {"expires",     1,  0,  'X' },
@@ -120,6 +179,12 @@ static int parse_command_str (const char *cmd)
     return CMD_MESSAGE;
   } else if (pj_ansi_strnicmp(cmd, "invite", 6) == 0) {
     return CMD_INVITE;
+  } else if (pj_ansi_strnicmp(cmd, "raw", 3) == 0) {
+    return CMD_RAW;
+  } else if (pj_ansi_strnicmp(cmd, "serve", 5) == 0) {
+    return CMD_SERVE;
+  } else if (pj_ansi_strnicmp(cmd, "bench", 5) == 0) {
+    return CMD_BENCH;
   }
 
   return CMD_UNKNOWN;
@@ -133,22 +198,65 @@ static int transport_proto (const char *proto)
   return PJSIP_TRANSPORT_UDP;
 }
 
+/* Port number or -1 if invalid. */
 static int set_port_value (const char *port_str) {
   int port = 0;
   if(! is_string_numeric(port_str)) {
     PJ_LOG(1, (PROJECT_NAME, "Invalid port: %s.", port_str));
-    exit(PJ_CLI_EINVARG);
+    return -1;
   }
   port = atoi(port_str);
   if (port < 1 || port > ((2 << 15) - 1)) {
     PJ_LOG(1, (PROJECT_NAME, "Invalid port: %s. Expected value must be between 1 and %d.",
           port_str, (2 << 15) - 1));
-    exit(PJ_CLI_EINVARG);
+    return -1;
   }
 
   return port;
 }
 
+/* Local port or range of ports FIRST-LAST. */
+static pj_status_t set_port_range (struct sippak_app *app, const char *range_str)
+{
+  pj_str_t first, last, rest;
+  unsigned long lo, hi;
+  pj_bool_t valid;
+  char *dash;
+
+  first = pj_str((char*)range_str);
+  pj_strtrim(&first);
+  dash = pj_strchr(&first, '-');
+  if (dash == NULL) {
+    int port = set_port_value (range_str);
+    if (port < 0) {
+      return PJ_CLI_EINVARG;
+    }
+    app->cfg.local_port = port;
+    app->cfg.local_port_max = 0;
+    return PJ_SUCCESS;
+  }
+
+  last.ptr = dash + 1;
+  last.slen = first.ptr + first.slen - last.ptr;
+  first.slen = dash - first.ptr;
+
+  lo = pj_strtoul2(&first, &rest, 10);
+  valid = first.slen > 0 && rest.slen == 0;
+  hi = pj_strtoul2(&last, &rest, 10);
+  valid = valid && last.slen > 0 && rest.slen == 0;
+
+  if (!valid || lo < 1 || hi > ((2 << 15) - 1) || hi < lo) {
+    PJ_LOG(1, (PROJECT_NAME, "Invalid port range: %s. Expected FIRST-LAST, ports between 1 and %d.",
+          range_str, (2 << 15) - 1));
+    return PJ_CLI_EINVARG;
+  }
+
+  app->cfg.local_port = (pj_uint16_t)lo;
+  app->cfg.local_port_max = hi == lo ? 0 : (pj_uint16_t)hi;
+
+  return PJ_SUCCESS;
+}
+
 static pj_status_t add_custom_header (char *in_header, struct sippak_app *app)
 {
   char *delim = NULL;
@@ -157,12 +265,6 @@ static pj_status_t add_custom_header (char *in_header, struct sippak_app *app)
   pj_str_t hdr_name, hdr_value;
   unsigned int len = 0;
 
-  if (app->cfg.hdrs.cnt > MAX_CUSTOM_HEADERS) {
-    PJ_LOG(2, (PROJECT_NAME, "Only %d max custom headers allowed. Skip header: %s",
-          MAX_CUSTOM_HEADERS, in_header));
-    return PJ_SUCCESS;
-  }
-
   // trim leading spaces
   while(pj_isspace((unsigned char)*in_header)) in_header++;
   delim = pj_ansi_strchr(in_header, (int)':');
@@ -192,6 +294,16 @@ static pj_status_t add_custom_header (char *in_header, struct sippak_app *app)
   hdr_name = pj_str(hname);
   hdr_value = pj_str(value);
 
+  if (app->cfg.hdrs.cnt == app->cfg.hdrs.max) {
+    unsigned max = app->cfg.hdrs.max ? app->cfg.hdrs.max * 2 : CUSTOM_HEADERS_INIT;
+    pjsip_generic_string_hdr **h = pj_pool_calloc(app->pool, max, sizeof(*h));
+    if (app->cfg.hdrs.cnt > 0) {
+      pj_memcpy(h, app->cfg.hdrs.h, app->cfg.hdrs.cnt * sizeof(*h));
+    }
+    app->cfg.hdrs.h = h;
+    app->cfg.hdrs.max = max;
+  }
+
   app->cfg.hdrs.h[app->cfg.hdrs.cnt] = pjsip_generic_string_hdr_create(app->pool,
       &hdr_name, &hdr_value);
 
@@ -320,6 +432,90 @@ static void set_mwi_list (struct sippak_app *app, char *mwi_list_str)
   app->cfg.is_mwi = PJ_TRUE;
 }
 
+static pj_status_t set_log_methods (struct sippak_app *app, char *list_str)
+{
+  pj_ssize_t found_idx = 0;
+  pj_str_t token;
+  pj_str_t delim = pj_str(",");
+  pj_str_t list = pj_str(list_str);
+
+  for (
+      found_idx = pj_strtok (&list, &delim, &token, 0);
+      found_idx != list.slen;
+      found_idx = pj_strtok (&list, &delim, &token, found_idx + token.slen)
+      )
+  {
+    pj_str_t name;
+    pj_str_t value = token; // keep token intact for next pj_strtok offset
+    pj_strtrim(&value);
+    if (value.slen == 0) {
+      continue;
+    }
+    if (app->cfg.log_filter.method_cnt >= MAX_LOG_METHODS) {
+      PJ_LOG(2, (PROJECT_NAME, "Only %d methods allowed in log filter. Skip method: %.*s",
+            MAX_LOG_METHODS, (int)value.slen, value.ptr));
+      continue;
+    }
+    // SIP methods are case-sensitive, make cli value upper case
+    pj_strdup(app->pool, &name, &value);
+    for (int i = 0; i < name.slen; i++) {
+      name.ptr[i] = (char)pj_toupper((unsigned char)name.ptr[i]);
+    }
+    pjsip_method_init_np(&app->cfg.log_filter.method[app->cfg.log_filter.method_cnt], &name);
+    app->cfg.log_filter.method_cnt++;
+  }
+
+  return PJ_SUCCESS;
+}
+
+/*
+ * Status classes list, like "4xx,5xx,6xx". Class prefixed with "!"
+ * is excluded, so "!2xx" logs all responses except 2xx.
+ */
+static pj_status_t set_log_status (struct sippak_app *app, char *list_str)
+{
+  pj_ssize_t found_idx = 0;
+  pj_str_t token;
+  pj_str_t delim = pj_str(",");
+  pj_str_t list = pj_str(list_str);
+  unsigned include = 0, exclude = 0;
+
+  for (
+      found_idx = pj_strtok (&list, &delim, &token, 0);
+      found_idx != list.slen;
+      found_idx = pj_strtok (&list, &delim, &token, found_idx + token.slen)
+      )
+  {
+    pj_bool_t negate = PJ_FALSE;
+    pj_str_t value = token; // keep token intact for next pj_strtok offset
+    pj_strtrim(&value);
+    if (value.slen > 0 && *value.ptr == '!') {
+      negate = PJ_TRUE;
+      value.ptr++;
+      value.slen--;
+    }
+    if (value.slen != 3 || value.ptr[0] < '1' || value.ptr[0] > '6'
+        || pj_tolower((unsigned char)value.ptr[1]) != 'x'
+        || pj_tolower((unsigned char)value.ptr[2]) != 'x') {
+      PJ_LOG(1, (PROJECT_NAME, "Invalid status class \"%.*s\". Expected values are 1xx to 6xx.",
+            (int)value.slen, value.ptr));
+      return PJ_CLI_EINVARG;
+    }
+    if (negate) {
+      exclude |= 1 << (value.ptr[0] - '0');
+    } else {
+      include |= 1 << (value.ptr[0] - '0');
+    }
+  }
+
+  if (include == 0) {
+    include = SIPPAK_LOG_STATUS_ALL;
+  }
+  app->cfg.log_filter.status_mask = include & ~exclude;
+
+  return PJ_SUCCESS;
+}
+
 static void set_event (struct sippak_app *app, const char *event)
 {
   pj_str_t value = pjstr_trimmed(event);
@@ -340,13 +536,19 @@ static void sippak_parse_argv_left (struct sippak_app *app,
                                     int pj_optind)
 {
   int idx = pj_optind;
+  int cmd;
 
   if (idx == argc) {
     return; // no command or destination is given
   }
 
   if (1 == (argc - idx)) {
-    // only one arg left. Consider it is a destination.
+    // only one arg left. Command without destination or destination.
+    cmd = parse_command_str (argv[idx]);
+    if (cmd == CMD_SERVE || cmd == CMD_BENCH) {
+      app->cfg.cmd = cmd;
+      return;
+    }
     app->cfg.dest = pj_str(argv[idx]);
     return; // assign destination and exit
   }
@@ -385,7 +587,7 @@ static int is_string_numeric(const char *optarg)
   return 1;
 }
 
-static void post_parse_setup (struct sippak_app *app)
+static pj_status_t post_parse_setup (struct sippak_app *app)
 {
   // set log decoration and level
   pj_log_set_decor(app->cfg.log_decor);
@@ -395,14 +597,14 @@ static void post_parse_setup (struct sippak_app *app)
   if (app->cfg.cmd == CMD_REFER && app->cfg.refer_to.ptr == NULL) {
     PJ_LOG(1, (PROJECT_NAME,
           "Failed. Requires parameter \"--to\" to initiate REFER request."));
-    exit(PJ_CLI_EINVARG);
+    return PJ_CLI_EINVARG;
   }
 
   // command MESSAGE requires body parameter
   if (app->cfg.cmd == CMD_MESSAGE && app->cfg.body.ptr == NULL) {
     PJ_LOG(1, (PROJECT_NAME,
           "Failed. Requires parameter \"--body\" to initiate MESSAGE."));
-    exit(PJ_CLI_EINVARG);
+    return PJ_CLI_EINVARG;
   }
 
   // reset event and presence to follow MWI routin
@@ -416,17 +618,14 @@ static void post_parse_setup (struct sippak_app *app)
     }
   }
 
-  // default username is user part of destination URI
-  if (app->cfg.username.ptr == NULL && app->cfg.dest.ptr != NULL) {
-    pjsip_sip_uri *dest_uri = (pjsip_sip_uri*)pjsip_parse_uri(app->pool, app->cfg.dest.ptr,
-                          app->cfg.dest.slen, 0);
-    if (dest_uri == NULL) {
-      PJ_LOG(1, (PROJECT_NAME, "Failed to parse destination URI: %.*s",
-            app->cfg.dest.slen, app->cfg.dest.ptr));
-      exit(PJ_CLI_EINVARG);
-    }
-    app->cfg.username = dest_uri->user;
+  // parse destination once, also sets default username
+  if (app->cfg.dest.ptr != NULL && sippak_dest_init(app) != PJ_SUCCESS) {
+    return PJ_CLI_EINVARG;
   }
+
+  sippak_hdr_tpl_init(app);
+
+  return PJ_SUCCESS;
 }
 
 PJ_DEF(pj_status_t) sippak_init (struct sippak_app *app)
@@ -434,18 +633,48 @@ PJ_DEF(pj_status_t) sippak_init (struct sippak_app *app)
   // init main application structure
   app->cfg.dest.slen        = 0;
   app->cfg.dest.ptr         = NULL;
+  app->dest.ready           = PJ_FALSE;
   app->cfg.log_level        = MIN_LOG_LEVEL;
   app->cfg.cmd              = CMD_PING;
   app->cfg.nameservers      = NULL;
   app->cfg.log_decor        = PJ_LOG_HAS_NEWLINE | PJ_LOG_HAS_INDENT;
   app->cfg.trail_dot        = PJ_FALSE;
+  app->cfg.log_filter.method_cnt  = 0;
+  app->cfg.log_filter.status_mask = SIPPAK_LOG_STATUS_ALL;
+  app->cfg.log_filter.sample      = 1;
+  app->cfg.log_filter.compact     = PJ_FALSE;
+  app->cfg.timing           = PJ_FALSE;
+  app->cfg.timeseries       = NULL;
+  app->cfg.stats.interval   = 0;
+  app->cfg.stats.file       = SIPPAK_STATS_FILE;
+  app->cfg.stateless        = PJ_FALSE;
+  app->cfg.retrans          = PJ_FALSE;
+  app->cfg.count            = 1;
+  app->cfg.rate             = 0;
+  app->cfg.udp_io           = SIPPAK_UDP_IO_SOCK;
+  app->cfg.threads          = 1;
+  app->cfg.spin             = 0;
+  app->cfg.raw.cnt          = 0;
   app->cfg.local_port       = 0;
+  app->cfg.local_port_max   = 0;
   app->cfg.local_host.ptr   = NULL;
   app->cfg.local_host.slen  = 0;
   app->cfg.username.ptr     = NULL;
   app->cfg.username.slen    = 0;
   app->cfg.password.ptr     = NULL;
   app->cfg.password.slen    = 0;
+  app->cfg.auth_cache       = NULL;
+  app->cfg.cred_file        = NULL;
+  app->cfg.daemon           = PJ_FALSE;
+  app->cfg.socket           = SIPPAK_DAEMON_SOCKET;
+  app->cfg.batch.enabled    = PJ_FALSE;
+  app->cfg.batch.file       = NULL;
+  app->cfg.batch.concurrency = SIPPAK_BATCH_CONCURRENCY;
+  app->cfg.batch.ordered    = PJ_FALSE;
+  app->cfg.scenario         = NULL;
+  app->cfg.serve.delay      = 0;
+  app->cfg.serve.fail_ratio = 0;
+  app->cfg.serve.fail_code  = SIPPAK_SERVE_FAIL_CODE;
   app->cfg.from_name.ptr    = NULL;
   app->cfg.from_name.slen   = 0;
   app->cfg.proto            = PJSIP_TRANSPORT_UDP;
@@ -480,10 +709,21 @@ PJ_DEF(pj_status_t) sippak_init (struct sippak_app *app)
 
   // custom headers
   app->cfg.hdrs.cnt         = 0;
+  app->cfg.hdrs.max         = 0;
+  app->cfg.hdrs.h           = NULL;
+  app->hdr_tpl.ready        = PJ_FALSE;
 
   // proxy
   app->cfg.proxy.cnt        = 0;
 
+  // source tuples, bound by sippak_transport_init
+  app->tp_pool.cnt          = 0;
+  app->tp_pool.ent          = NULL;
+  app->creds.ht             = NULL;
+  app->creds.cnt            = 0;
+  app->auth_sess            = NULL;
+  app->cmd_mod              = NULL;
+
   return PJ_SUCCESS;
 }
 
@@ -532,8 +772,96 @@ PJ_DEF(pj_status_t) sippak_getopts (int argc, char *argv[], struct sippak_app *a
       case OPT_LOG_SND:
         app->cfg.log_decor |= PJ_LOG_HAS_SENDER;
         break;
+      case OPT_LOG_METHOD:
+        if (set_log_methods (app, pj_optarg) != PJ_SUCCESS) {
+          return PJ_CLI_EINVARG;
+        }
+        break;
+      case OPT_LOG_STATUS:
+        if (set_log_status (app, pj_optarg) != PJ_SUCCESS) {
+          return PJ_CLI_EINVARG;
+        }
+        break;
+      case OPT_LOG_SAMPLE:
+        if(!is_string_numeric(pj_optarg) || atoi(pj_optarg) < 1) {
+          PJ_LOG(1, (PROJECT_NAME, "Invalid log sample value: %s. Must be number more then 0.", pj_optarg));
+          return PJ_CLI_EINVARG;
+        }
+        app->cfg.log_filter.sample = atoi(pj_optarg);
+        break;
+      case OPT_LOG_COMPACT:
+        app->cfg.log_filter.compact = PJ_TRUE;
+        break;
+      case OPT_TIMING:
+        app->cfg.timing = PJ_TRUE;
+        break;
+      case OPT_TIMESERIES:
+        app->cfg.timeseries = pj_optarg;
+        break;
+      case OPT_STATS_INTERVAL:
+        if(!is_string_numeric(pj_optarg) || atoi(pj_optarg) < 1) {
+          PJ_LOG(1, (PROJECT_NAME, "Invalid stats interval: %s. Must be number of seconds more then 0.", pj_optarg));
+          return PJ_CLI_EINVARG;
+        }
+        app->cfg.stats.interval = atoi(pj_optarg);
+        break;
+      case OPT_STATS_FILE:
+        app->cfg.stats.file = pj_optarg;
+        break;
+      case OPT_STATELESS:
+        app->cfg.stateless = PJ_TRUE;
+        break;
+      case OPT_RETRANS:
+        app->cfg.retrans = PJ_TRUE;
+        break;
+      case OPT_COUNT:
+        if(!is_string_numeric(pj_optarg) || atoi(pj_optarg) < 1) {
+          PJ_LOG(1, (PROJECT_NAME, "Invalid count value: %s. Must be number more then 0.", pj_optarg));
+          return PJ_CLI_EINVARG;
+        }
+        app->cfg.count = atoi(pj_optarg);
+        break;
+      case OPT_RATE:
+        if(!is_string_numeric(pj_optarg)) {
+          PJ_LOG(1, (PROJECT_NAME, "Invalid rate value: %s. Must be number of requests per second.", pj_optarg));
+          return PJ_CLI_EINVARG;
+        }
+        app->cfg.rate = atoi(pj_optarg);
+        break;
+      case OPT_MMSG:
+        app->cfg.udp_io = SIPPAK_UDP_IO_MMSG;
+        break;
+      case OPT_URING:
+        app->cfg.udp_io = SIPPAK_UDP_IO_URING;
+        break;
+      case OPT_THREADS:
+        if(!is_string_numeric(pj_optarg) || atoi(pj_optarg) < 1 ||
+            atoi(pj_optarg) > SIPPAK_MAX_THREADS) {
+          PJ_LOG(1, (PROJECT_NAME, "Invalid threads value: %s. Must be number from 1 to %d.",
+                pj_optarg, SIPPAK_MAX_THREADS));
+          return PJ_CLI_EINVARG;
+        }
+        app->cfg.threads = atoi(pj_optarg);
+        break;
+      case OPT_SPIN:
+        if(!is_string_numeric(pj_optarg) || atoi(pj_optarg) > 1000) {
+          PJ_LOG(1, (PROJECT_NAME, "Invalid spin value: %s. Must be number of microseconds up to 1000.",
+                pj_optarg));
+          return PJ_CLI_EINVARG;
+        }
+        app->cfg.spin = atoi(pj_optarg);
+        break;
+      case OPT_FILE:
+        if (app->cfg.raw.cnt == MAX_RAW_FILES) {
+          PJ_LOG(1, (PROJECT_NAME, "Max raw message files allowed is %d.", MAX_RAW_FILES));
+          return PJ_CLI_EINVARG;
+        }
+        app->cfg.raw.file[app->cfg.raw.cnt++] = pj_optarg;
+        break;
       case 'P':
-        app->cfg.local_port = set_port_value (pj_optarg);
+        if (set_port_range (app, pj_optarg) != PJ_SUCCESS) {
+          return PJ_CLI_EINVARG;
+        }
         break;
       case 'l':
         app->cfg.local_host = pjstr_trimmed(pj_optarg);
@@ -544,6 +872,58 @@ PJ_DEF(pj_status_t) sippak_getopts (int argc, char *argv[], struct sippak_app *a
       case 'p':
         app->cfg.password = pjstr_trimmed(pj_optarg);
         break;
+      case OPT_AUTH_CACHE:
+        app->cfg.auth_cache = pj_optarg;
+        break;
+      case OPT_CRED_FILE:
+        app->cfg.cred_file = pj_optarg;
+        break;
+      case OPT_DAEMON:
+        app->cfg.daemon = PJ_TRUE;
+        break;
+      case OPT_SOCKET:
+        app->cfg.socket = pj_optarg;
+        break;
+      case OPT_BATCH:
+        app->cfg.batch.enabled = PJ_TRUE;
+        app->cfg.batch.file = pj_optarg;
+        break;
+      case OPT_CONCURRENCY:
+        if(!is_string_numeric(pj_optarg) || atoi(pj_optarg) < 1 ||
+            atoi(pj_optarg) > SIPPAK_BATCH_MAX_CONCURRENCY) {
+          PJ_LOG(1, (PROJECT_NAME, "Invalid concurrency value: %s. Must be number from 1 to %d.",
+                pj_optarg, SIPPAK_BATCH_MAX_CONCURRENCY));
+          return PJ_CLI_EINVARG;
+        }
+        app->cfg.batch.concurrency = atoi(pj_optarg);
+        break;
+      case OPT_ORDERED:
+        app->cfg.batch.ordered = PJ_TRUE;
+        break;
+      case OPT_SCENARIO:
+        app->cfg.scenario = pj_optarg;
+        break;
+      case OPT_DELAY:
+        if(!is_string_numeric(pj_optarg)) {
+          PJ_LOG(1, (PROJECT_NAME, "Invalid delay value: %s. Must be number of milliseconds.", pj_optarg));
+          return PJ_CLI_EINVARG;
+        }
+        app->cfg.serve.delay = atoi(pj_optarg);
+        break;
+      case OPT_FAIL_RATIO:
+        if(!is_string_numeric(pj_optarg) || atoi(pj_optarg) > 100) {
+          PJ_LOG(1, (PROJECT_NAME, "Invalid fail ratio value: %s. Must be percent from 0 to 100.", pj_optarg));
+          return PJ_CLI_EINVARG;
+        }
+        app->cfg.serve.fail_ratio = atoi(pj_optarg);
+        break;
+      case OPT_FAIL_CODE:
+        if(!is_string_numeric(pj_optarg) || atoi(pj_optarg) < 300 || atoi(pj_optarg) > 699) {
+          PJ_LOG(1, (PROJECT_NAME, "Invalid fail code value: %s. Must be number from 300 to 699.", pj_optarg));
+          return PJ_CLI_EINVARG;
+        }
+        app->cfg.serve.fail_code = atoi(pj_optarg);
+        break;
       case 'F':
         app->cfg.from_name = pjstr_trimmed(pj_optarg);
         break;
@@ -563,7 +943,7 @@ PJ_DEF(pj_status_t) sippak_getopts (int argc, char *argv[], struct sippak_app *a
       case 'X':
           if(!is_string_numeric(pj_optarg)) {
             PJ_LOG(1, (PROJECT_NAME, "Invalid expires value: %s. Must be numeric.", pj_optarg));
-            exit(PJ_CLI_EINVARG);
+            return PJ_CLI_EINVARG;
           }
           app->cfg.expires = atoi(pj_optarg);
         break;
@@ -605,11 +985,14 @@ PJ_DEF(pj_status_t) sippak_getopts (int argc, char *argv[], struct sippak_app *a
         break;
       case OPT_CODEC:
         if (sippak_set_media_codecs_cfg(pj_optarg, app) != PJ_SUCCESS) {
-          exit(PJ_CLI_EINVARG);
+          return PJ_CLI_EINVARG;
         }
         break;
       case OPT_RTP_PORT:
         app->cfg.media.rtp_port = set_port_value(pj_optarg);
+        if (app->cfg.media.rtp_port < 0) {
+          return PJ_CLI_EINVARG;
+        }
         break;
       case 'A': // User-Agent header
         app->cfg.user_agent = pjstr_trimmed(pj_optarg);
@@ -632,8 +1015,6 @@ PJ_DEF(pj_status_t) sippak_getopts (int argc, char *argv[], struct sippak_app *a
   sippak_parse_argv_left (app, argc, argv, pj_optind);
 
   // finilize the setup
-  post_parse_setup(app);
-
-  return PJ_SUCCESS;
+  return post_parse_setup(app);
 }
 
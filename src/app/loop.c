@@ -0,0 +1,50 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file loop.c
+ * @brief sippak command event loop
+ *
+ * Runs until command cancels it. Kept out of main.c, so modules
+ * linked to libsippak resolve sippak_loop_cancel without main.
+ * Cancel is cleared when loop returns, so command that completes
+ * inside its send call, like over loop transport, does not block.
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+#include "sippak.h"
+
+static pj_bool_t sippak_loop_stop = PJ_FALSE;
+
+PJ_DEF(void) sippak_loop_run (struct sippak_app *app)
+{
+  while (sippak_loop_stop == PJ_FALSE) {
+    pj_time_val timeout = {0, 500};
+    sippak_stateless_poll(app, &timeout);
+    pjsip_endpt_handle_events(app->endpt, &timeout);
+    sippak_stats_poll(app);
+  }
+  sippak_loop_stop = PJ_FALSE;
+}
+
+PJ_DEF(void) sippak_loop_cancel()
+{
+  sippak_loop_stop = PJ_TRUE;
+}
@@ -0,0 +1,564 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file msg_tpl.c
+ * @brief sippak request serialized once and patched per send
+ *
+ * Request is printed once with fixed width placeholders in Via branch,
+ * Call-ID, From tag, CSeq and Content-Length. Offsets of placeholders
+ * are kept, so every send is memcpy of template and overwrite of
+ * these fields. No message objects, no pool allocation, no printing.
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+
+#include "sippak.h"
+
+#define NAME "msg_tpl"
+
+#define BRANCH_MAGIC "z9hG4bK"
+#define BRANCH_MAGIC_LEN (sizeof(BRANCH_MAGIC) - 1)
+
+#define ID_LEN 16         // hex digits of per send id in branch, tag and Call-ID
+#define CALLID_PREFIX_LEN 8 // hex digits of Call-ID part constant per run
+#define CSEQ_LEN 10       // CSeq number, zero padded
+#define CLEN_LEN 5        // Content-Length, zero padded, max UDP datagram
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static pj_uint64_t run_salt = 0;
+static const pj_str_t crlf2 = { "\r\n\r\n", 4 };
+
+/* splitmix64 finalizer, bijective, so different seq never collide */
+static pj_uint64_t mix64 (pj_uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+/* Salt is shared by all templates, so any of them decodes any branch. */
+static pj_uint64_t tpl_salt (void)
+{
+  pj_timestamp now;
+
+  if (run_salt == 0) {
+    pj_get_timestamp(&now);
+    run_salt = mix64(((pj_uint64_t)pj_rand() << 32) ^ pj_rand() ^ now.u64) | 1;
+  }
+  return run_salt;
+}
+
+static pj_status_t tpl_add_field (struct sippak_msg_tpl *tpl, pj_size_t off,
+                                  unsigned type)
+{
+  if (tpl->field_cnt == SIPPAK_TPL_MAX_FIELDS) {
+    PJ_LOG(1, (NAME, "Too many variable fields in template, max is %d.", SIPPAK_TPL_MAX_FIELDS));
+    return PJ_ETOOMANY;
+  }
+  tpl->field[tpl->field_cnt].off = (pj_uint32_t)off;
+  tpl->field[tpl->field_cnt].type = type;
+  tpl->field_cnt++;
+
+  if (type == SIPPAK_TPL_BRANCH) {
+    tpl->has_branch = PJ_TRUE;
+  }
+
+  return PJ_SUCCESS;
+}
+
+static void put_hex (char *p, pj_uint64_t val, unsigned width)
+{
+  while (width--) {
+    p[width] = hex_digits[val & 0xf];
+    val >>= 4;
+  }
+}
+
+static void put_dec (char *p, pj_uint32_t val, unsigned width)
+{
+  while (width--) {
+    p[width] = '0' + val % 10;
+    val /= 10;
+  }
+}
+
+/* Placeholder is token characters only, so it is printed unescaped. */
+static pj_str_t tpl_marker (pj_pool_t *pool, char id, unsigned len)
+{
+  pj_str_t m;
+
+  m.ptr = pj_pool_alloc(pool, len);
+  m.slen = len;
+  pj_memset(m.ptr, '~', len);
+  m.ptr[1] = id;
+
+  return m;
+}
+
+static char *find_str (char *buf, pj_size_t len, const pj_str_t *s)
+{
+  char *p, *end;
+
+  if (len < (pj_size_t)s->slen) {
+    return NULL;
+  }
+  end = buf + len - s->slen;
+  for (p = buf; p <= end; p++) {
+    if (*p == *s->ptr && pj_memcmp(p, s->ptr, s->slen) == 0) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+/* Offset of header value, long or compact name. */
+static char *find_hdr_value (char *buf, char *end, const char *name, const char *sname)
+{
+  char *p = buf;
+  pj_size_t nlen = pj_ansi_strlen(name);
+  pj_size_t slen = sname ? pj_ansi_strlen(sname) : 0;
+
+  while (p < end) {
+    char *line = p;
+    char *colon = NULL;
+
+    if ((pj_size_t)(end - line) > nlen && line[nlen] == ':' &&
+        pj_ansi_strnicmp(line, name, nlen) == 0) {
+      colon = line + nlen;
+    } else if (slen && (pj_size_t)(end - line) > slen && line[slen] == ':' &&
+        pj_ansi_strnicmp(line, sname, slen) == 0) {
+      colon = line + slen;
+    }
+
+    if (colon) {
+      for (p = colon + 1; p < end && (*p == ' ' || *p == '\t'); p++);
+      return p;
+    }
+
+    while (p < end && *p != '\n') {
+      p++;
+    }
+    p++;
+  }
+  return NULL;
+}
+
+/* Grow decimal number at "p" to fixed width with leading zeros. */
+static pj_status_t widen_number (char *buf, pj_size_t *len, pj_size_t cap,
+                                 char *p, unsigned width)
+{
+  unsigned digits = 0;
+  unsigned pad;
+
+  while (p + digits < buf + *len && pj_isdigit(p[digits])) {
+    digits++;
+  }
+  if (digits == 0 || digits > width) {
+    return PJ_EINVAL;
+  }
+  pad = width - digits;
+  if (*len + pad > cap) {
+    return PJ_ETOOBIG;
+  }
+  pj_memmove(p + pad, p, buf + *len - p);
+  pj_memset(p, '0', pad);
+  *len += pad;
+
+  return PJ_SUCCESS;
+}
+
+PJ_DEF(pj_status_t) sippak_msg_tpl_create (struct sippak_app *app,
+                                           pjsip_tx_data *tdata,
+                                           const pj_str_t *local_addr,
+                                           int local_port,
+                                           struct sippak_msg_tpl **p_tpl)
+{
+  pj_status_t status;
+  char buf[PJSIP_MAX_PKT_LEN];
+  pj_ssize_t printed;
+  pj_size_t len, clen_off;
+  char *p, *hdr_end;
+  pj_str_t branch, callid, tag;
+  pjsip_msg *msg = tdata->msg;
+  pjsip_via_hdr *via;
+  pjsip_cid_hdr *cid;
+  pjsip_from_hdr *from;
+  pjsip_cseq_hdr *cseq;
+  struct sippak_msg_tpl *tpl;
+
+  PJ_ASSERT_RETURN(msg->type == PJSIP_REQUEST_MSG, PJ_EINVAL);
+
+  cid = PJSIP_MSG_CID_HDR(msg);
+  from = PJSIP_MSG_FROM_HDR(msg);
+  cseq = PJSIP_MSG_CSEQ_HDR(msg);
+  if (!cid || !from || !cseq) {
+    PJ_LOG(1, (NAME, "Request template requires Call-ID, From and CSeq headers."));
+    return PJ_EINVAL;
+  }
+
+  // Via is filled by transport when sent with pjsip, here it is our job
+  via = pjsip_msg_find_hdr(msg, PJSIP_H_VIA, NULL);
+  if (via == NULL) {
+    via = pjsip_via_hdr_create(tdata->pool);
+    pjsip_msg_insert_first_hdr(msg, (pjsip_hdr*)via);
+  }
+  via->transport = pj_str((char*)pjsip_transport_get_type_name(app->cfg.proto));
+  via->sent_by.host = *local_addr;
+  via->sent_by.port = local_port;
+  via->rport_param = 0;
+
+  sippak_add_sip_headers (tdata, app);
+
+  branch = tpl_marker(tdata->pool, 'B', BRANCH_MAGIC_LEN + ID_LEN);
+  pj_memcpy(branch.ptr, BRANCH_MAGIC, BRANCH_MAGIC_LEN);
+  via->branch_param = branch;
+
+  callid = tpl_marker(tdata->pool, 'C', CALLID_PREFIX_LEN + ID_LEN);
+  cid->id = callid;
+
+  tag = tpl_marker(tdata->pool, 'T', ID_LEN);
+  from->tag = tag;
+
+  printed = pjsip_msg_print(msg, buf, sizeof(buf));
+  if (printed <= 0) {
+    PJ_LOG(1, (NAME, "Failed to print request template."));
+    return PJSIP_EMSGTOOLONG;
+  }
+  len = printed;
+
+  hdr_end = find_str(buf, len, &crlf2);
+  if (hdr_end == NULL) {
+    return PJSIP_EMISSINGHDR;
+  }
+
+  // fixed width numbers first, they shift the rest of message
+  p = find_hdr_value(buf, hdr_end, "CSeq", NULL);
+  status = p ? widen_number(buf, &len, sizeof(buf), p, CSEQ_LEN) : PJSIP_EMISSINGHDR;
+  SIPPAK_ASSERT_SUCC(status, "Failed to set template CSeq.");
+
+  hdr_end = find_str(buf, len, &crlf2);
+  p = find_hdr_value(buf, hdr_end, "Content-Length", "l");
+  status = p ? widen_number(buf, &len, sizeof(buf), p, CLEN_LEN) : PJSIP_EMISSINGHDR;
+  SIPPAK_ASSERT_SUCC(status, "Failed to set template Content-Length.");
+
+  tpl = PJ_POOL_ZALLOC_T(app->pool, struct sippak_msg_tpl);
+  tpl->buf = pj_pool_alloc(app->pool, len);
+  tpl->len = len;
+  tpl->salt = tpl_salt();
+  pj_memcpy(tpl->buf, buf, len);
+
+  hdr_end = find_str(tpl->buf, len, &crlf2);
+  tpl->body_len = len - (hdr_end - tpl->buf) - crlf2.slen;
+  clen_off = find_hdr_value(tpl->buf, hdr_end, "Content-Length", "l") - tpl->buf;
+  put_dec (tpl->buf + clen_off, (pj_uint32_t)tpl->body_len, CLEN_LEN);
+
+  p = find_hdr_value(tpl->buf, hdr_end, "CSeq", NULL);
+  tpl_add_field (tpl, p - tpl->buf, SIPPAK_TPL_CSEQ);
+
+  // placeholders are searched in headers only, body is user data
+  p = find_str(tpl->buf, hdr_end - tpl->buf, &branch);
+  if (p == NULL) {
+    return PJSIP_EMISSINGHDR;
+  }
+  tpl_add_field (tpl, p - tpl->buf + BRANCH_MAGIC_LEN, SIPPAK_TPL_BRANCH);
+
+  p = find_str(tpl->buf, hdr_end - tpl->buf, &callid);
+  if (p == NULL) {
+    return PJSIP_EMISSINGHDR;
+  }
+  // constant part of Call-ID is unique per run
+  put_hex (p, mix64(tpl->salt), CALLID_PREFIX_LEN);
+  tpl_add_field (tpl, p - tpl->buf + CALLID_PREFIX_LEN, SIPPAK_TPL_CALLID);
+
+  p = find_str(tpl->buf, hdr_end - tpl->buf, &tag);
+  if (p == NULL) {
+    return PJSIP_EMISSINGHDR;
+  }
+  tpl_add_field (tpl, p - tpl->buf, SIPPAK_TPL_TAG);
+
+  *p_tpl = tpl;
+
+  return PJ_SUCCESS;
+}
+
+/* Tokens of raw message files. */
+enum raw_token_e {
+  TOK_BRANCH,
+  TOK_CALL_ID,
+  TOK_FROM_TAG,
+  TOK_CSEQ,
+  TOK_LOCAL_IP,
+  TOK_LOCAL_PORT,
+  TOK_REMOTE_IP,
+  TOK_REMOTE_PORT,
+  TOK_TRANSPORT,
+  TOK_LEN
+};
+
+static const struct {
+  pj_str_t name;
+  enum raw_token_e id;
+} raw_tokens[] = {
+  { { "[branch]", 8 },      TOK_BRANCH },
+  { { "[call_id]", 9 },     TOK_CALL_ID },
+  { { "[from_tag]", 10 },   TOK_FROM_TAG },
+  { { "[cseq]", 6 },        TOK_CSEQ },
+  { { "[local_ip]", 10 },   TOK_LOCAL_IP },
+  { { "[local_port]", 12 }, TOK_LOCAL_PORT },
+  { { "[remote_ip]", 11 },  TOK_REMOTE_IP },
+  { { "[remote_port]", 13 },TOK_REMOTE_PORT },
+  { { "[transport]", 11 },  TOK_TRANSPORT },
+  { { "[len]", 5 },         TOK_LEN },
+};
+
+struct raw_ctx {
+  const pj_str_t *local_addr;
+  int local_port;
+  pj_str_t remote_addr;
+  int remote_port;
+  pj_str_t transport;
+};
+
+#define RAW_PUT(src, n) do { \
+  if (len + (n) > cap) return PJ_ETOOBIG; \
+  pj_memcpy(out + len, (src), (n)); len += (n); \
+} while (0)
+
+#define RAW_FIELD(type, width) do { \
+  if (len + (width) > cap) return PJ_ETOOBIG; \
+  if (tpl && tpl_add_field(tpl, len, (type)) != PJ_SUCCESS) return PJ_ETOOMANY; \
+  pj_memset(out + len, '0', (width)); len += (width); \
+} while (0)
+
+/*
+ * Expand tokens and terminate lines with CRLF. Variable fields are
+ * recorded to "tpl" if it is not NULL. Token [len] is empty when
+ * "body_len" is negative, it is known only after first expand.
+ */
+static pj_status_t raw_expand (const struct raw_ctx *ctx, const pj_str_t *text,
+                               pj_ssize_t body_len, char *out, pj_size_t cap,
+                               pj_size_t *out_len, struct sippak_msg_tpl *tpl)
+{
+  pj_size_t len = 0;
+  pj_ssize_t i;
+  unsigned t;
+  char num[16];
+  int n;
+
+  for (i = 0; i < text->slen; i++) {
+    char c = text->ptr[i];
+
+    if (c == '\n' && (i == 0 || text->ptr[i - 1] != '\r')) {
+      RAW_PUT("\r\n", 2);
+      continue;
+    }
+    if (c != '[') {
+      RAW_PUT(&c, 1);
+      continue;
+    }
+
+    for (t = 0; t < PJ_ARRAY_SIZE(raw_tokens); t++) {
+      const pj_str_t *name = &raw_tokens[t].name;
+      if (text->slen - i >= name->slen &&
+          pj_memcmp(text->ptr + i, name->ptr, name->slen) == 0) {
+        break;
+      }
+    }
+    if (t == PJ_ARRAY_SIZE(raw_tokens)) {
+      RAW_PUT(&c, 1); // not a token, literal bracket
+      continue;
+    }
+    i += raw_tokens[t].name.slen - 1;
+
+    switch (raw_tokens[t].id) {
+      case TOK_BRANCH:
+        RAW_PUT(BRANCH_MAGIC, BRANCH_MAGIC_LEN);
+        RAW_FIELD(SIPPAK_TPL_BRANCH, ID_LEN);
+        break;
+      case TOK_CALL_ID:
+        if (len + CALLID_PREFIX_LEN > cap) {
+          return PJ_ETOOBIG;
+        }
+        put_hex (out + len, mix64(tpl_salt()), CALLID_PREFIX_LEN);
+        len += CALLID_PREFIX_LEN;
+        RAW_FIELD(SIPPAK_TPL_CALLID, ID_LEN);
+        break;
+      case TOK_FROM_TAG:
+        RAW_FIELD(SIPPAK_TPL_TAG, ID_LEN);
+        break;
+      case TOK_CSEQ:
+        RAW_FIELD(SIPPAK_TPL_CSEQ, CSEQ_LEN);
+        break;
+      case TOK_LOCAL_IP:
+        RAW_PUT(ctx->local_addr->ptr, ctx->local_addr->slen);
+        break;
+      case TOK_REMOTE_IP:
+        RAW_PUT(ctx->remote_addr.ptr, ctx->remote_addr.slen);
+        break;
+      case TOK_TRANSPORT:
+        RAW_PUT(ctx->transport.ptr, ctx->transport.slen);
+        break;
+      case TOK_LOCAL_PORT:
+        n = pj_ansi_snprintf(num, sizeof(num), "%d", ctx->local_port);
+        RAW_PUT(num, n);
+        break;
+      case TOK_REMOTE_PORT:
+        n = pj_ansi_snprintf(num, sizeof(num), "%d", ctx->remote_port);
+        RAW_PUT(num, n);
+        break;
+      case TOK_LEN:
+        if (body_len >= 0) {
+          n = pj_ansi_snprintf(num, sizeof(num), "%ld", (long)body_len);
+          RAW_PUT(num, n);
+        }
+        break;
+    }
+  }
+
+  // message without body must end with empty line
+  if (find_str(out, len, &crlf2) == NULL) {
+    while (len >= 2 && out[len - 2] == '\r' && out[len - 1] == '\n') {
+      len -= 2;
+    }
+    RAW_PUT(crlf2.ptr, crlf2.slen);
+  }
+
+  *out_len = len;
+
+  return PJ_SUCCESS;
+}
+
+PJ_DEF(pj_status_t) sippak_msg_tpl_load (struct sippak_app *app,
+                                         const pj_str_t *text,
+                                         const pj_str_t *local_addr,
+                                         int local_port,
+                                         struct sippak_msg_tpl **p_tpl)
+{
+  pj_status_t status;
+  pj_pool_t *tmp;
+  char *out, *hdr_end;
+  pj_size_t len;
+  pj_ssize_t body_len;
+  pj_str_t src = *text;
+  struct raw_ctx ctx;
+  struct sippak_msg_tpl *tpl;
+
+  pj_strltrim(&src);
+  if (src.slen == 0) {
+    PJ_LOG(1, (NAME, "Raw message is empty."));
+    return PJ_EINVAL;
+  }
+
+  ctx.local_addr = local_addr;
+  ctx.local_port = local_port;
+  ctx.remote_addr = app->dest.uri->host;
+  ctx.remote_port = app->dest.uri->port
+    ? app->dest.uri->port
+    : pjsip_transport_get_default_port_for_type(app->cfg.proto);
+  ctx.transport = pj_str((char*)pjsip_transport_get_type_name(app->cfg.proto));
+
+  tmp = pjsip_endpt_create_pool(app->endpt, "rawtpl", SIPPAK_TPL_MAX_LEN, POOL_INCR);
+  out = pj_pool_alloc(tmp, SIPPAK_TPL_MAX_LEN);
+
+  // first pass finds body length for [len] token
+  status = raw_expand(&ctx, &src, -1, out, SIPPAK_TPL_MAX_LEN, &len, NULL);
+  if (status == PJ_SUCCESS) {
+    hdr_end = find_str(out, len, &crlf2);
+    body_len = len - (hdr_end - out) - crlf2.slen;
+
+    tpl = PJ_POOL_ZALLOC_T(app->pool, struct sippak_msg_tpl);
+    tpl->salt = tpl_salt();
+    tpl->body_len = body_len;
+    status = raw_expand(&ctx, &src, body_len, out, SIPPAK_TPL_MAX_LEN, &len, tpl);
+  }
+
+  if (status == PJ_SUCCESS) {
+    tpl->buf = pj_pool_alloc(app->pool, len);
+    tpl->len = len;
+    pj_memcpy(tpl->buf, out, len);
+    *p_tpl = tpl;
+  } else {
+    PJ_LOG(1, (NAME, "Raw message is longer than %d bytes or has too many tokens.",
+          SIPPAK_TPL_MAX_LEN));
+  }
+
+  pjsip_endpt_release_pool(app->endpt, tmp);
+
+  return status;
+}
+
+PJ_DEF(pj_size_t) sippak_msg_tpl_render (const struct sippak_msg_tpl *tpl,
+                                         pj_uint64_t seq,
+                                         pj_uint32_t cseq,
+                                         char *buf)
+{
+  pj_uint64_t id = seq ^ tpl->salt;
+
+  unsigned i;
+
+  pj_memcpy(buf, tpl->buf, tpl->len);
+
+  for (i = 0; i < tpl->field_cnt; i++) {
+    char *p = buf + tpl->field[i].off;
+    switch (tpl->field[i].type) {
+      case SIPPAK_TPL_BRANCH:
+        put_hex (p, id, ID_LEN);
+        break;
+      case SIPPAK_TPL_CALLID:
+        put_hex (p, mix64(id), ID_LEN);
+        break;
+      case SIPPAK_TPL_TAG:
+        put_hex (p, mix64(~id), ID_LEN);
+        break;
+      case SIPPAK_TPL_CSEQ:
+        put_dec (p, cseq, CSEQ_LEN);
+        break;
+    }
+  }
+
+  return tpl->len;
+}
+
+PJ_DEF(pj_bool_t) sippak_msg_tpl_match (const struct sippak_msg_tpl *tpl,
+                                        const pj_str_t *branch,
+                                        pj_uint64_t *seq)
+{
+  pj_uint64_t id = 0;
+  pj_ssize_t i;
+
+  if (branch->slen != BRANCH_MAGIC_LEN + ID_LEN ||
+      pj_memcmp(branch->ptr, BRANCH_MAGIC, BRANCH_MAGIC_LEN) != 0) {
+    return PJ_FALSE;
+  }
+  for (i = BRANCH_MAGIC_LEN; i < branch->slen; i++) {
+    if (!pj_isxdigit(branch->ptr[i])) {
+      return PJ_FALSE;
+    }
+    id = (id << 4) | pj_hex_digit_to_val(branch->ptr[i]);
+  }
+  *seq = id ^ tpl->salt;
+
+  return PJ_TRUE;
+}
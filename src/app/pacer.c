@@ -0,0 +1,210 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file pacer.c
+ * @brief sippak fixed rate send schedule
+ *
+ * Send N is due at start + N / rate, computed from start every time
+ * so rounding does not accumulate. Waits for a slot sleep on timerfd
+ * armed with absolute monotonic time and, optionally, busy wait the
+ * last microseconds before it. Sleep is interrupted when watched
+ * socket becomes readable, so responses are not held back.
+ *
+ * Every send records its error against the schedule. Jitter is the
+ * difference between actual and nominal time since previous send.
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include "sippak.h"
+
+#ifdef HAVE_TIMERFD
+#include <sys/timerfd.h>
+#endif
+
+#define NAME "pacer"
+
+#define NSEC 1000000000ULL
+
+PJ_DEF(pj_uint64_t) sippak_pacer_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (pj_uint64_t)ts.tv_sec * NSEC + ts.tv_nsec;
+}
+
+PJ_DEF(pj_status_t) sippak_pacer_init (struct sippak_pacer *p,
+                                       pj_uint64_t start,
+                                       unsigned rate,
+                                       unsigned spin_us)
+{
+  PJ_ASSERT_RETURN(rate > 0, PJ_EINVAL);
+
+  pj_bzero(p, sizeof(*p));
+  p->start = start;
+  p->rate = rate;
+  p->spin = (pj_uint64_t)spin_us * 1000;
+  p->tfd = -1;
+
+#ifdef HAVE_TIMERFD
+  p->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (p->tfd < 0) {
+    return PJ_RETURN_OS_ERROR(pj_get_native_os_error());
+  }
+#endif
+
+  return PJ_SUCCESS;
+}
+
+PJ_DEF(pj_uint64_t) sippak_pacer_slot (const struct sippak_pacer *p, pj_uint64_t n)
+{
+  // split to keep n * NSEC from overflow on long runs
+  return p->start + n / p->rate * NSEC + n % p->rate * NSEC / p->rate;
+}
+
+PJ_DEF(pj_status_t) sippak_pacer_wait (struct sippak_pacer *p,
+                                     pj_uint64_t slot,
+                                     pj_sock_t sock)
+{
+  struct pollfd fds[2];
+#ifdef HAVE_TIMERFD
+  struct itimerspec its;
+#endif
+  pj_uint64_t now = sippak_pacer_now();
+  pj_uint64_t wake = slot > p->spin ? slot - p->spin : 0;
+  nfds_t cnt = 0;
+  int ms = -1;
+
+  if (now < wake) {
+    if (sock != PJ_INVALID_SOCKET) {
+      fds[cnt].fd = (int)sock;
+      fds[cnt].events = POLLIN;
+      cnt++;
+    }
+
+#ifdef HAVE_TIMERFD
+    // rearming resets expiration count, timer is never read
+    pj_bzero(&its, sizeof(its));
+    its.it_value.tv_sec = wake / NSEC;
+    its.it_value.tv_nsec = wake % NSEC;
+    timerfd_settime(p->tfd, TFD_TIMER_ABSTIME, &its, NULL);
+    fds[cnt].fd = p->tfd;
+    fds[cnt].events = POLLIN;
+    cnt++;
+#else
+    ms = (int)((wake - now + 999999) / 1000000); // rounded up, spin catches the rest
+#endif
+
+    fds[0].revents = 0;
+    while (poll(fds, cnt, ms) < 0) {
+      if (errno != EINTR) {
+        return PJ_RETURN_OS_ERROR(errno);
+      }
+    }
+
+    if (sock != PJ_INVALID_SOCKET && (fds[0].revents & POLLIN)) {
+      p->wakeups++;
+      return PJ_EPENDING;
+    }
+  }
+
+  while (sippak_pacer_now() < slot);
+
+  return PJ_SUCCESS;
+}
+
+PJ_DEF(void) sippak_pacer_sent (struct sippak_pacer *p,
+                                pj_uint64_t slot,
+                                pj_uint64_t now)
+{
+  pj_uint64_t late = now > slot ? now - slot : 0;
+
+  if (p->sent == 0) {
+    p->first = now;
+  } else {
+    // actual interval against nominal one, both measured from previous send
+    pj_int64_t err = (pj_int64_t)(now - p->last) - (pj_int64_t)(slot - p->last_slot);
+    pj_uint64_t jitter = err < 0 ? -err : err;
+
+    p->intervals++;
+    p->jitter_sum += jitter;
+    p->jitter_max = PJ_MAX(p->jitter_max, jitter);
+  }
+
+  p->late_sum += late;
+  p->late_max = PJ_MAX(p->late_max, late);
+  p->last = now;
+  p->last_slot = slot;
+  p->sent++;
+}
+
+PJ_DEF(void) sippak_pacer_merge (struct sippak_pacer *sum, const struct sippak_pacer *p)
+{
+  if (p->sent == 0) {
+    return;
+  }
+  if (sum->sent == 0 || p->first < sum->first) {
+    sum->first = p->first;
+  }
+  sum->last = PJ_MAX(sum->last, p->last);
+  sum->rate = p->rate;
+  sum->sent += p->sent;
+  sum->intervals += p->intervals;
+  sum->jitter_sum += p->jitter_sum;
+  sum->jitter_max = PJ_MAX(sum->jitter_max, p->jitter_max);
+  sum->late_sum += p->late_sum;
+  sum->late_max = PJ_MAX(sum->late_max, p->late_max);
+  sum->wakeups += p->wakeups;
+}
+
+PJ_DEF(pj_uint64_t) sippak_pacer_rate (const struct sippak_pacer *p)
+{
+  if (p->sent < 2 || p->last == p->first) {
+    return 0;
+  }
+  return (p->sent - 1) * NSEC / (p->last - p->first);
+}
+
+PJ_DEF(void) sippak_pacer_report (const struct sippak_pacer *p)
+{
+  if (p->intervals == 0) {
+    return;
+  }
+
+  PJ_LOG(3, (NAME, "Pacing: target %u req/s, achieved %llu req/s. "
+        "Inter-send jitter avg %llu ns, max %llu ns. "
+        "Behind schedule avg %llu ns, max %llu ns. Sleeps cut by responses: %llu.",
+        p->rate, sippak_pacer_rate(p),
+        p->jitter_sum / p->intervals, p->jitter_max,
+        p->late_sum / p->sent, p->late_max, p->wakeups));
+}
+
+PJ_DEF(void) sippak_pacer_destroy (struct sippak_pacer *p)
+{
+  if (p->tfd >= 0) {
+    close(p->tfd);
+    p->tfd = -1;
+  }
+}
@@ -0,0 +1,199 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file scenario.c
+ * @brief sippak multi-step scenario
+ *
+ * Every line of scenario file is one step: command with its options and
+ * destination, appended to options of sippak command line, or "pause MS".
+ * Commands run one after another in the main application structure, so
+ * transport, contact, transaction and UA layers, dialogs and auth
+ * sessions are shared. Module of command is unregistered when its step
+ * is done, transactions it has left complete on the next steps.
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+#include <stdio.h>
+#include <string.h>
+#include "sippak.h"
+
+#define NAME "scenario"
+
+static pj_status_t run_cmd (struct sippak_app *app)
+{
+  switch (app->cfg.cmd)
+  {
+    case CMD_PING:
+      return sippak_cmd_ping(app);
+    case CMD_PUBLISH:
+      return sippak_cmd_publish(app);
+    case CMD_SUBSCRIBE:
+      return sippak_cmd_subscribe(app);
+    case CMD_NOTIFY:
+      return sippak_cmd_notify(app);
+    case CMD_REGISTER:
+      return sippak_cmd_register(app);
+    case CMD_REFER:
+      return sippak_cmd_refer(app);
+    case CMD_MESSAGE:
+      return sippak_cmd_message(app);
+    case CMD_INVITE:
+      return sippak_cmd_invite(app);
+    default:
+      return PJ_ENOTSUP; // RAW, SERVE, BENCH and stateless own the loop
+  }
+}
+
+/* Events keep being handled, dialogs and refreshes go on. */
+static void pause_ms (struct sippak_app *app, unsigned ms)
+{
+  pj_timestamp start, now;
+
+  pj_get_timestamp(&start);
+  do {
+    pj_time_val timeout = {0, 10};
+    pjsip_endpt_handle_events(app->endpt, &timeout);
+    sippak_stats_poll(app);
+    pj_get_timestamp(&now);
+  } while (pj_elapsed_msec(&start, &now) < ms);
+}
+
+/* Options of the step over sippak command line, runtime state is kept. */
+static pj_status_t step_getopts (struct sippak_app *app, int argc, char *argv[],
+                                 char *line)
+{
+  char *sargv[SIPPAK_SCENARIO_MAX_ARGS];
+  struct sippak_tp_pool tp_pool = app->tp_pool;
+  struct sippak_cred_store creds = app->creds;
+  pj_hash_table_t *auth_sess = app->auth_sess;
+  int i, sargc;
+
+  if (argc >= SIPPAK_SCENARIO_MAX_ARGS) {
+    return PJ_ETOOMANY;
+  }
+  for (i = 0; i < argc; i++) {
+    sargv[i] = argv[i];
+  }
+  sargc = argc + sippak_cmdline_split(line, sargv + argc, SIPPAK_SCENARIO_MAX_ARGS - argc);
+
+  sippak_init(app);
+  app->tp_pool = tp_pool;
+  app->creds = creds;
+  app->auth_sess = auth_sess;
+
+  return sippak_getopts(sargc, sargv, app);
+}
+
+PJ_DEF(pj_status_t) sippak_scenario_run (struct sippak_app *app,
+                                         int argc, char *argv[])
+{
+  pj_timestamp start, step_start, now;
+  char *buf, *line, *next, *end;
+  char step[SIPPAK_CMDLINE_LEN];
+  const char *file = app->cfg.scenario;
+  unsigned ms, steps = 0, lineno = 0;
+  pj_status_t status = PJ_SUCCESS;
+  long size;
+  FILE *f;
+
+  f = fopen(file, "rb");
+  if (f == NULL) {
+    PJ_LOG(1, (NAME, "Failed to open scenario file %s.", file));
+    return PJ_ENOTFOUND;
+  }
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  // pipe or FIFO has no size
+  if (size <= 0) {
+    PJ_LOG(1, (NAME, "Scenario file %s is empty or not a regular file.", file));
+    fclose(f);
+    return PJ_EINVAL;
+  }
+
+  buf = pj_pool_alloc(app->pool, size + 1);
+  size = fread(buf, 1, size, f);
+  fclose(f);
+  buf[size] = '\0';
+  end = buf + size;
+
+  pj_get_timestamp(&start);
+
+  for (line = buf; line < end; line = next) {
+    next = strchr(line, '\n');
+    if (next) {
+      *next++ = '\0';
+    } else {
+      next = end;
+    }
+    lineno++;
+
+    while (pj_isspace(*line)) {
+      line++;
+    }
+    if (*line == '\0' || *line == '#') {
+      continue;
+    }
+    if (line[strlen(line) - 1] == '\r') {
+      line[strlen(line) - 1] = '\0';
+    }
+    steps++;
+
+    pj_get_timestamp(&step_start);
+    if (sscanf(line, "pause %u", &ms) == 1) {
+      pause_ms(app, ms);
+      pj_get_timestamp(&now);
+      PJ_LOG(3, (NAME, "Step %u: pause, %u ms", steps, pj_elapsed_msec(&step_start, &now)));
+      continue;
+    }
+
+    // options point into line, it is split in place and stays in pool
+    pj_ansi_strncpy(step, line, sizeof(step) - 1);
+    step[sizeof(step) - 1] = '\0';
+
+    status = step_getopts(app, argc, argv, line);
+    if (status == PJ_SUCCESS && app->cfg.stateless) {
+      status = PJ_ENOTSUP;
+    }
+    if (status == PJ_SUCCESS) {
+      status = run_cmd(app);
+    }
+    if (status != PJ_SUCCESS) {
+      PJ_LOG(1, (NAME, "Step %u, line %u failed: %s", steps, lineno, step));
+      break;
+    }
+
+    sippak_loop_run(app);
+    pj_get_timestamp(&now);
+
+    if (app->cmd_mod) {
+      pjsip_endpt_unregister_module(app->endpt, app->cmd_mod);
+      app->cmd_mod = NULL;
+    }
+    PJ_LOG(3, (NAME, "Step %u: %s, %u ms", steps, step, pj_elapsed_msec(&step_start, &now)));
+  }
+
+  pj_get_timestamp(&now);
+  PJ_LOG(3, (NAME, "Scenario: %u steps, %u ms", steps, pj_elapsed_msec(&start, &now)));
+
+  return status;
+}
@@ -0,0 +1,518 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file session.c
+ * @brief libsippak embedded session
+ *
+ * Session is endpoint with transaction layer, UDP transport on any
+ * port and worker threads polling it, or endpoint of the caller who
+ * polls it himself. Probe is request with its own
+ * pool holding callback, start time and auth session. Pool is given
+ * as transaction token and released when result is reported, so
+ * nothing is shared between probes and nothing is left after them.
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+#include <stdarg.h>
+#include <stdlib.h>
+#include "sippak.h"
+
+#define NAME "session"
+
+#define PROBE_POOL_SIZE 1024
+
+struct sippak_session {
+  pj_caching_pool cp;
+  pjsip_endpoint *endpt;
+  pj_pool_t *pool;
+  pj_atomic_t *pending;         // probes waiting for result
+  pj_lock_t *lock;              // sending and finished flags of probes
+  pj_thread_t *thread[SIPPAK_MAX_THREADS];
+  unsigned thread_cnt;
+  volatile pj_bool_t quit;
+  pj_bool_t attached;           // endpoint belongs to caller
+};
+
+static sippak_session *active; // pjsip has one transaction layer per process
+
+struct probe {
+  pj_pool_t *pool;
+  struct sippak_session *sess;
+  pjsip_auth_clt_sess auth;
+  pj_bool_t has_auth;
+  pj_timestamp start;
+  int timeout;
+  sippak_result_cb cb;
+  void *user_data;
+  pj_bool_t sending;            // in pjsip_endpt_send_request of sender
+  pj_bool_t finished;           // transaction ended, result is in res
+  struct sippak_result res;
+};
+
+/* Threads of embedding program are unknown to pjlib until they call in. */
+static void register_thread (void)
+{
+  static __thread pj_thread_desc desc;
+  pj_thread_t *thread;
+
+  if (!pj_thread_is_registered()) {
+    pj_bzero(desc, sizeof(desc));
+    pj_thread_register("sippak_ext", desc, &thread);
+  }
+}
+
+static int session_worker (void *arg)
+{
+  struct sippak_session *sess = arg;
+  pj_time_val timeout = {0, 10};
+
+  while (!sess->quit) {
+    pjsip_endpt_handle_events(sess->endpt, &timeout);
+  }
+  return 0;
+}
+
+static void probe_cb (void *token, pjsip_event *e);
+
+static void probe_report (struct probe *pr)
+{
+  struct sippak_session *sess = pr->sess;
+
+  pr->cb(&pr->res);
+
+  pj_pool_release(pr->pool);
+  pj_atomic_dec(sess->pending);
+}
+
+/* Transaction that ends inside of send is reported by sender, which
+ * knows whether pjsip has returned error for it. */
+static void probe_done (struct probe *pr, pjsip_transaction *tsx, pj_status_t status)
+{
+  struct sippak_session *sess = pr->sess;
+  pj_timestamp now;
+  pj_bool_t sending;
+
+  pj_get_timestamp(&now);
+
+  pr->res.status = status;
+  pr->res.code = tsx->status_code;
+  pj_strdup(pr->pool, &pr->res.reason, &tsx->status_text);
+  pr->res.latency_us = pj_elapsed_usec(&pr->start, &now);
+  pr->res.user_data = pr->user_data;
+
+  pj_lock_acquire(sess->lock);
+  sending = pr->sending;
+  pr->finished = PJ_TRUE;
+  pj_lock_release(sess->lock);
+
+  if (!sending) {
+    probe_report(pr);
+  }
+}
+
+/* Send request of probe. Result of transaction that ended in send is
+ * reported here on success, on error probe is left to the caller. */
+static pj_status_t probe_tsx_send (struct probe *pr, pjsip_tx_data *tdata)
+{
+  struct sippak_session *sess = pr->sess;
+  pj_status_t status;
+  pj_bool_t finished;
+
+  pr->sending = PJ_TRUE;
+  pr->finished = PJ_FALSE;
+  status = pjsip_endpt_send_request(sess->endpt, tdata, pr->timeout, pr, &probe_cb);
+
+  pj_lock_acquire(sess->lock);
+  pr->sending = PJ_FALSE;
+  finished = pr->finished;
+  pj_lock_release(sess->lock);
+
+  if (status == PJ_SUCCESS && finished) {
+    probe_report(pr);
+  }
+  return status;
+}
+
+static void probe_cb (void *token, pjsip_event *e)
+{
+  struct probe *pr = token;
+  pjsip_transaction *tsx = e->body.tsx_state.tsx;
+  pjsip_tx_data *tdata;
+  pj_status_t status;
+
+  // own timeout of probe terminates transaction with event of USER type
+  if (e->body.tsx_state.type == PJSIP_EVENT_TIMER ||
+      tsx->status_code == PJSIP_SC_REQUEST_TIMEOUT ||
+      tsx->status_code == PJSIP_SC_TSX_TIMEOUT) {
+    probe_done(pr, tsx, PJ_ETIMEDOUT);
+    return;
+  }
+  if (e->body.tsx_state.type != PJSIP_EVENT_RX_MSG) {
+    probe_done(pr, tsx, tsx->transport_err ? tsx->transport_err : PJ_EUNKNOWN);
+    return;
+  }
+
+  if (pr->has_auth && (tsx->status_code == 401 || tsx->status_code == 407)) {
+    // rejected credentials fail here with PJSIP_EFAILEDCREDENTIAL
+    status = pjsip_auth_clt_reinit_req(&pr->auth, e->body.tsx_state.src.rdata,
+        tsx->last_tx, &tdata);
+    if (status == PJ_SUCCESS) {
+      status = probe_tsx_send(pr, tdata);
+      if (status == PJ_SUCCESS) {
+        return;
+      }
+    }
+    probe_done(pr, tsx, status);
+    return;
+  }
+
+  probe_done(pr, tsx, PJ_SUCCESS);
+}
+
+static pj_status_t print_str (pj_pool_t *pool, pj_str_t *out, const char *fmt, ...)
+{
+  va_list ap;
+
+  out->ptr = pj_pool_alloc(pool, PJSIP_MAX_URL_SIZE);
+  va_start(ap, fmt);
+  out->slen = pj_ansi_vsnprintf(out->ptr, PJSIP_MAX_URL_SIZE, fmt, ap);
+  va_end(ap);
+
+  return out->slen > 0 && out->slen < PJSIP_MAX_URL_SIZE ? PJ_SUCCESS : PJSIP_EURITOOLONG;
+}
+
+/* From is user at destination host, like command line does. REGISTER
+ * goes to domain over transport of destination, From and To are
+ * address of record. */
+static pj_status_t probe_uris (pj_pool_t *pool, const pj_str_t *dest,
+                               const char *username, pj_bool_t is_reg,
+                               pj_str_t *ruri, pj_str_t *from, pj_str_t *to)
+{
+  pjsip_uri *uri;
+  pjsip_sip_uri *sip_uri;
+  pj_str_t buf;
+  pj_status_t status;
+  const char *user = username ? username : PROJECT_NAME;
+
+  pj_strdup_with_null(pool, &buf, dest);
+  uri = pjsip_parse_uri(pool, buf.ptr, buf.slen, 0);
+  if (uri == NULL || !(PJSIP_URI_SCHEME_IS_SIP(uri) || PJSIP_URI_SCHEME_IS_SIPS(uri))) {
+    return PJSIP_EINVALIDURI;
+  }
+  sip_uri = (pjsip_sip_uri *)pjsip_uri_get_uri(uri);
+
+  status = print_str(pool, from, "<sip:%s@%.*s>",
+      user, (int)sip_uri->host.slen, sip_uri->host.ptr);
+  if (status != PJ_SUCCESS || !is_reg) {
+    *ruri = *dest;
+    *to = *dest;
+    return status;
+  }
+
+  *to = *from;
+  if (sip_uri->port) {
+    return print_str(pool, ruri, "sip:%.*s:%d%s%.*s",
+        (int)sip_uri->host.slen, sip_uri->host.ptr, sip_uri->port,
+        sip_uri->transport_param.slen ? ";transport=" : "",
+        (int)sip_uri->transport_param.slen, sip_uri->transport_param.ptr);
+  }
+  return print_str(pool, ruri, "sip:%.*s%s%.*s",
+      (int)sip_uri->host.slen, sip_uri->host.ptr,
+      sip_uri->transport_param.slen ? ";transport=" : "",
+      (int)sip_uri->transport_param.slen, sip_uri->transport_param.ptr);
+}
+
+PJ_DEF(pj_status_t) sippak_session_create (unsigned threads,
+                                           sippak_session **p_sess)
+{
+  struct sippak_session *sess;
+  pj_status_t status;
+  unsigned i;
+
+  PJ_ASSERT_RETURN(p_sess && threads <= SIPPAK_MAX_THREADS, PJ_EINVAL);
+  if (active) {
+    PJ_LOG(1, (NAME, "Session already exists."));
+    return PJ_EINVALIDOP;
+  }
+
+  status = pj_init();
+  if (status != PJ_SUCCESS) {
+    return status;
+  }
+  register_thread();
+
+  sess = calloc(1, sizeof(*sess));
+  if (sess == NULL) {
+    pj_shutdown();
+    return PJ_ENOMEM;
+  }
+  pj_caching_pool_init(&sess->cp, &pj_pool_factory_default_policy, 0);
+
+  status = pjsip_endpt_create(&sess->cp.factory, "libsippak", &sess->endpt);
+  if (status != PJ_SUCCESS) {
+    goto fail;
+  }
+  sess->pool = pjsip_endpt_create_pool(sess->endpt, "session", POOL_INIT, POOL_INCR);
+
+  status = pjsip_tsx_layer_init_module(sess->endpt);
+  if (status == PJ_SUCCESS) {
+    status = pjsip_udp_transport_start(sess->endpt, NULL, NULL, 1, NULL);
+  }
+  if (status == PJ_SUCCESS) {
+    status = pj_atomic_create(sess->pool, 0, &sess->pending);
+  }
+  if (status == PJ_SUCCESS) {
+    status = pj_lock_create_simple_mutex(sess->pool, "session", &sess->lock);
+  }
+  if (status != PJ_SUCCESS) {
+    goto fail;
+  }
+
+  sess->thread_cnt = threads ? threads : 1;
+  for (i = 0; i < sess->thread_cnt; i++) {
+    status = pj_thread_create(sess->pool, "sippak%p", &session_worker, sess,
+        0, 0, &sess->thread[i]);
+    if (status != PJ_SUCCESS) {
+      sess->thread_cnt = i;
+      sippak_session_destroy(sess);
+      return status;
+    }
+  }
+
+  active = sess;
+  *p_sess = sess;
+  return PJ_SUCCESS;
+
+fail:
+  PJ_LOG(1, (NAME, "Failed to create session."));
+  if (sess->endpt) {
+    pjsip_endpt_destroy(sess->endpt);
+  }
+  pj_caching_pool_destroy(&sess->cp);
+  free(sess);
+  pj_shutdown();
+  return status;
+}
+
+PJ_DEF(pj_status_t) sippak_session_attach (pjsip_endpoint *endpt,
+                                           sippak_session **p_sess)
+{
+  struct sippak_session *sess;
+  pj_status_t status = PJ_SUCCESS;
+
+  PJ_ASSERT_RETURN(endpt && p_sess, PJ_EINVAL);
+  if (active) {
+    PJ_LOG(1, (NAME, "Session already exists."));
+    return PJ_EINVALIDOP;
+  }
+
+  sess = calloc(1, sizeof(*sess));
+  if (sess == NULL) {
+    return PJ_ENOMEM;
+  }
+  sess->endpt = endpt;
+  sess->attached = PJ_TRUE;
+  sess->pool = pjsip_endpt_create_pool(endpt, "session", POOL_INIT, POOL_INCR);
+
+  if (pjsip_tsx_layer_instance()->id == -1) {
+    status = pjsip_tsx_layer_init_module(endpt);
+  }
+  if (status == PJ_SUCCESS) {
+    status = pj_atomic_create(sess->pool, 0, &sess->pending);
+  }
+  if (status == PJ_SUCCESS) {
+    status = pj_lock_create_simple_mutex(sess->pool, "session", &sess->lock);
+  }
+  if (status != PJ_SUCCESS) {
+    pjsip_endpt_release_pool(endpt, sess->pool);
+    free(sess);
+    return status;
+  }
+
+  active = sess;
+  *p_sess = sess;
+  return PJ_SUCCESS;
+}
+
+static pj_status_t probe_send (sippak_session *sess,
+                               const struct sippak_probe *probe,
+                               const pjsip_method *method)
+{
+  struct probe *pr;
+  pjsip_tx_data *tdata;
+  pjsip_cred_info cred;
+  pj_pool_t *pool;
+  pj_str_t dest, ruri, from, to, contact, body;
+  pj_str_t *p_contact = NULL;
+  pj_status_t status;
+  pj_bool_t is_reg = method->id == PJSIP_REGISTER_METHOD;
+
+  PJ_ASSERT_RETURN(sess && probe && probe->uri && probe->cb, PJ_EINVAL);
+
+  register_thread();
+
+  pool = pjsip_endpt_create_pool(sess->endpt, "probe%p", PROBE_POOL_SIZE, PROBE_POOL_SIZE);
+  if (pool == NULL) {
+    return PJ_ENOMEM;
+  }
+  pr = PJ_POOL_ZALLOC_T(pool, struct probe);
+  pr->pool = pool;
+  pr->sess = sess;
+  pr->timeout = probe->timeout_ms ? (int)probe->timeout_ms : -1;
+  pr->cb = probe->cb;
+  pr->user_data = probe->user_data;
+
+  pj_strdup2_with_null(pool, &dest, probe->uri);
+  status = probe_uris(pool, &dest, probe->username, is_reg, &ruri, &from, &to);
+  if (status != PJ_SUCCESS) {
+    goto fail;
+  }
+  if (probe->contact) {
+    contact = pj_str((char *)probe->contact);
+    p_contact = &contact;
+  }
+
+  if (probe->cred || probe->password) {
+    status = pjsip_auth_clt_init(&pr->auth, sess->endpt, pool, 0);
+    if (status != PJ_SUCCESS) {
+      goto fail;
+    }
+    if (probe->cred) {
+      cred = *probe->cred;
+    } else {
+      cred.realm     = pj_str("*");
+      cred.scheme    = pj_str("digest");
+      cred.username  = pj_str((char *)(probe->username ? probe->username : PROJECT_NAME));
+      cred.data_type = PJSIP_CRED_DATA_PLAIN_PASSWD;
+      cred.data      = pj_str((char *)probe->password);
+    }
+    // session keeps its own copy
+    pjsip_auth_clt_set_credentials(&pr->auth, 1, &cred);
+    pr->has_auth = PJ_TRUE;
+  }
+
+  body = pj_str((char *)(probe->body ? probe->body : ""));
+  status = pjsip_endpt_create_request(sess->endpt,
+              method,                 // method
+              &ruri,                  // request URI
+              &from,                  // from header value
+              &to,                    // to header value
+              p_contact,              // Contact header
+              NULL,                   // Call-ID
+              -1,                     // CSeq
+              probe->body ? &body : NULL, // text/plain body
+              &tdata);
+  if (status != PJ_SUCCESS) {
+    goto fail;
+  }
+  // probe answers challenges with own credentials only
+  sippak_auth_cache_skip(tdata);
+  // REGISTER without Contact only queries bindings
+  if (is_reg && p_contact) {
+    pjsip_msg_add_hdr(tdata->msg, (pjsip_hdr*)
+        pjsip_expires_hdr_create(tdata->pool, probe->expires));
+  }
+
+  pj_atomic_inc(sess->pending);
+  pj_get_timestamp(&pr->start);
+
+  // request is released by pjsip on failure
+  status = probe_tsx_send(pr, tdata);
+  if (status != PJ_SUCCESS) {
+    pj_atomic_dec(sess->pending);
+    goto fail;
+  }
+
+  return PJ_SUCCESS;
+
+fail:
+  pj_pool_release(pool);
+  return status;
+}
+
+PJ_DEF(pj_status_t) sippak_session_ping (sippak_session *sess,
+                                         const struct sippak_probe *probe)
+{
+  return probe_send(sess, probe, &pjsip_options_method);
+}
+
+PJ_DEF(pj_status_t) sippak_session_request (sippak_session *sess,
+                                            const struct sippak_probe *probe)
+{
+  pjsip_method method;
+  pj_str_t name;
+
+  PJ_ASSERT_RETURN(probe, PJ_EINVAL);
+  if (probe->method == NULL) {
+    return probe_send(sess, probe, &pjsip_options_method);
+  }
+
+  name = pj_str((char *)probe->method);
+  pjsip_method_init_np(&method, &name);
+  if (method.id == PJSIP_INVITE_METHOD || method.id == PJSIP_ACK_METHOD ||
+      method.id == PJSIP_CANCEL_METHOD) {
+    return PJ_ENOTSUP; // dialog and transaction control are not probes
+  }
+
+  return probe_send(sess, probe, &method);
+}
+
+PJ_DEF(void) sippak_session_destroy (sippak_session *sess)
+{
+  pj_time_val tick = {0, 10};
+  unsigned i;
+
+  if (sess == NULL) {
+    return;
+  }
+  register_thread();
+
+  // every probe ends at the latest with its transaction timeout
+  while (pj_atomic_get(sess->pending) > 0) {
+    if (sess->attached) {
+      pjsip_endpt_handle_events(sess->endpt, &tick);
+    } else if (sess->thread_cnt) {
+      pj_thread_sleep(10);
+    } else {
+      break;
+    }
+  }
+
+  sess->quit = PJ_TRUE;
+  for (i = 0; i < sess->thread_cnt; i++) {
+    pj_thread_join(sess->thread[i]);
+    pj_thread_destroy(sess->thread[i]);
+  }
+
+  pj_atomic_destroy(sess->pending);
+  pj_lock_destroy(sess->lock);
+  active = NULL;
+
+  if (sess->attached) {
+    pjsip_endpt_release_pool(sess->endpt, sess->pool);
+    free(sess);
+    return;
+  }
+  pjsip_endpt_destroy(sess->endpt);
+  pj_caching_pool_destroy(&sess->cp);
+  free(sess);
+  pj_shutdown();
+}
@@ -25,84 +25,106 @@
  * @author Stas Kobzar <stas.kobzar@modulis.ca>
  */
 
+#include <stdio.h>
 #include "sippak.h"
 
 #define NAME "sip_helper"
 
-/* Create From SIP header */
-PJ_DEF(pj_str_t) sippak_create_from_hdr(struct sippak_app *app)
+/* Print URI to pool as null terminated string. */
+static pj_status_t print_uri (pj_pool_t *pool, pjsip_uri_context_e context,
+                              const void *uri, pj_str_t *out)
+{
+  char buf[PJSIP_MAX_URL_SIZE];
+  pj_str_t printed = { buf, 0 };
+
+  printed.slen = pjsip_uri_print(context, uri, buf, PJSIP_MAX_URL_SIZE);
+  if (printed.slen == -1) {
+    return PJSIP_EURITOOLONG;
+  }
+  pj_strdup_with_null(pool, out, &printed);
+
+  return PJ_SUCCESS;
+}
+
+/* Parse destination once and print all URIs request builders need. */
+PJ_DEF(pj_status_t) sippak_dest_init(struct sippak_app *app)
 {
-  pj_str_t from = {0,0};
-  from.ptr = (char*)pj_pool_alloc(app->pool, PJSIP_MAX_URL_SIZE);
+  pj_status_t status;
+  pj_str_t dest_user;
+  struct sippak_dest *dest = &app->dest;
   pjsip_sip_uri *dest_uri = (pjsip_sip_uri*)pjsip_parse_uri(app->pool, app->cfg.dest.ptr,
                           app->cfg.dest.slen, 0);
   if (dest_uri == NULL) {
-    PJ_LOG(1, (NAME, "Failed to parse URI %s for From header.", app->cfg.dest));
-    return app->cfg.dest;
+    PJ_LOG(1, (NAME, "Failed to parse destination URI: %.*s",
+          app->cfg.dest.slen, app->cfg.dest.ptr));
+    return PJSIP_EINVALIDURI;
   }
 
-  dest_uri->user = app->cfg.username;
-  from.slen = pjsip_uri_print(PJSIP_URI_IN_FROMTO_HDR, dest_uri, from.ptr, PJSIP_MAX_URL_SIZE);
-
-  if (from.slen == -1) {
-    PJ_LOG(1, (NAME, "Failed to print from uri to buffer."));
-    return app->cfg.dest;
+  // default username is user part of destination URI
+  if (app->cfg.username.ptr == NULL) {
+    app->cfg.username = dest_uri->user;
   }
 
+  dest->to = app->cfg.dest;
+
+  // From header: destination URI with username and display name
+  dest_user = dest_uri->user;
+  dest_uri->user = app->cfg.username;
   if (app->cfg.from_name.ptr) {
     pjsip_name_addr *name_uri = pjsip_name_addr_create(app->pool);
     name_uri->uri = (pjsip_uri*) dest_uri;
     name_uri->display = app->cfg.from_name;
+    status = print_uri(app->pool, PJSIP_URI_IN_FROMTO_HDR, name_uri, &dest->from);
+  } else {
+    status = print_uri(app->pool, PJSIP_URI_IN_FROMTO_HDR, dest_uri, &dest->from);
+  }
+  dest_uri->user = dest_user;
+  SIPPAK_ASSERT_SUCC(status, "Failed to print From URI to buffer.");
 
-    from.slen = pjsip_uri_print(PJSIP_URI_IN_FROMTO_HDR, name_uri, from.ptr, PJSIP_MAX_URL_SIZE);
+  if (app->cfg.proto == PJSIP_TRANSPORT_TCP) {
+    dest_uri->transport_param = pj_str("tcp");
   }
+  status = print_uri(app->pool, PJSIP_URI_IN_REQ_URI, dest_uri, &dest->ruri);
+  SIPPAK_ASSERT_SUCC(status, "Failed to print Request-URI to buffer.");
+
+  // REGISTER Request-URI has no userinfo, rfc3261 section 10.2
+  dest_uri->user.slen = 0;
+  dest_uri->user.ptr = NULL;
+  status = print_uri(app->pool, PJSIP_URI_IN_REQ_URI, dest_uri, &dest->reg_ruri);
+  dest_uri->user = dest_user;
+  SIPPAK_ASSERT_SUCC(status, "Failed to print REGISTER Request-URI to buffer.");
+
+  dest->uri = dest_uri;
+  dest->ready = PJ_TRUE;
 
-  return from;
+  return PJ_SUCCESS;
 }
 
-/* Create Requst-URI */
-PJ_DEF(pj_str_t) sippak_create_ruri(struct sippak_app *app)
+/* Create From SIP header */
+PJ_DEF(pj_str_t) sippak_create_from_hdr(struct sippak_app *app)
 {
-  pj_str_t ruri = {0,0};
-  ruri.ptr = (char*)pj_pool_alloc(app->pool, PJSIP_MAX_URL_SIZE);
-  pjsip_sip_uri *dest_uri = (pjsip_sip_uri*)pjsip_parse_uri(app->pool, app->cfg.dest.ptr,
-                          app->cfg.dest.slen, 0);
-  if (dest_uri == NULL) {
-    PJ_LOG(1, (NAME, "Failed to parse URI %s for Request-URI.", app->cfg.dest));
+  if (!app->dest.ready && sippak_dest_init(app) != PJ_SUCCESS) {
     return app->cfg.dest;
   }
+  return app->dest.from;
+}
 
-  if (app->cfg.proto == PJSIP_TRANSPORT_TCP) {
-    dest_uri->transport_param = pj_str("tcp");
-  }
-
-  ruri.slen = pjsip_uri_print(PJSIP_URI_IN_REQ_URI, dest_uri, ruri.ptr, PJSIP_MAX_URL_SIZE);
-  if (ruri.slen == -1) {
-    PJ_LOG(1, (NAME, "Failed to print Request-URI to buffer."));
+/* Create Requst-URI */
+PJ_DEF(pj_str_t) sippak_create_ruri(struct sippak_app *app)
+{
+  if (!app->dest.ready && sippak_dest_init(app) != PJ_SUCCESS) {
     return app->cfg.dest;
   }
-
-  return ruri;
+  return app->dest.ruri;
 }
 
 /* Create REGISTER Requst-URI */
 PJ_DEF(pj_str_t) sippak_create_reg_ruri(struct sippak_app *app)
 {
-  pj_str_t reg_ruri = {0,0};
-  reg_ruri.ptr = (char*)pj_pool_alloc(app->pool, PJSIP_MAX_URL_SIZE);
-  pj_str_t ruri = sippak_create_ruri(app);
-
-  pjsip_sip_uri *ruri_s = (pjsip_sip_uri*)pjsip_parse_uri(app->pool,
-      ruri.ptr, ruri.slen, 0);
-
-  // remove user part
-  ruri_s->user.slen = 0;
-  ruri_s->user.ptr = NULL;
-
-  reg_ruri.slen = pjsip_uri_print(PJSIP_URI_IN_REQ_URI, ruri_s,
-      reg_ruri.ptr, PJSIP_MAX_URL_SIZE);
-
-  return reg_ruri;
+  if (!app->dest.ready && sippak_dest_init(app) != PJ_SUCCESS) {
+    return app->cfg.dest;
+  }
+  return app->dest.reg_ruri;
 }
 
 /* Create Contact SIP header */
@@ -126,19 +148,22 @@ PJ_DEF(pj_str_t) sippak_create_contact_hdr (struct sippak_app *app,
   return cnt;
 }
 
-/* Init transport */
-PJ_DEF(pj_status_t) sippak_transport_init(struct sippak_app *app,
-                                  pj_str_t **local_addr,
-                                  int *local_port)
+/* Bind transport to one local tuple. */
+static pj_status_t transport_start (struct sippak_app *app,
+                                    const pj_str_t *host,
+                                    pj_uint16_t port,
+                                    pj_str_t **local_addr,
+                                    int *local_port,
+                                    pjsip_transport **p_tp)
 {
   pj_status_t status;
   pj_sockaddr_in addr;
   pjsip_transport *tp = NULL;
   pjsip_tpfactory *tpfactory = NULL;
 
-  status = pj_sockaddr_in_init(&addr, &app->cfg.local_host, app->cfg.local_port);
+  status = pj_sockaddr_in_init(&addr, host, port);
   SIPPAK_ASSERT_SUCC(status, "Failed to initiate socket %.*s:%d.",
-      app->cfg.local_host.slen, app->cfg.local_host.ptr, app->cfg.local_port);
+      host->slen, host->ptr, port);
 
   // set transport TCP/UDP
   if (app->cfg.proto == PJSIP_TRANSPORT_TCP) {
@@ -166,12 +191,361 @@ PJ_DEF(pj_status_t) sippak_transport_init(struct sippak_app *app,
           pj_sockaddr_print(&addr, addr_str, PJSIP_MAX_URL_SIZE, 1)));
   }
 
+  *p_tp = tp;
+  return status;
+}
+
+PJ_DEF(pj_status_t) sippak_transport_init(struct sippak_app *app,
+                                  pj_str_t **local_addr,
+                                  int *local_port)
+{
+  pj_status_t status;
+  pj_str_t *hosts;
+  unsigned host_cnt, port_cnt = 1, i;
+  struct sippak_tp_pool *pool = &app->tp_pool;
+
+  // bound by previous step of scenario
+  if (pool->cnt > 0) {
+    *local_addr = pool->ent[0].host;
+    *local_port = pool->ent[0].port;
+    return PJ_SUCCESS;
+  }
+
+  hosts = pj_pool_calloc(app->pool, SIPPAK_MAX_SOURCES, sizeof(pj_str_t));
+  status = sippak_local_hosts(app, hosts, SIPPAK_MAX_SOURCES, &host_cnt);
+  if (status != PJ_SUCCESS) {
+    return status;
+  }
+  if (app->cfg.local_port_max) {
+    port_cnt = app->cfg.local_port_max - app->cfg.local_port + 1;
+  }
+
+  pool->cnt = host_cnt * port_cnt;
+  if (pool->cnt > SIPPAK_MAX_SOURCES) {
+    PJ_LOG(1, (NAME, "Too many local address and port tuples: %u. Max is %d.",
+          pool->cnt, SIPPAK_MAX_SOURCES));
+    return PJ_EINVAL;
+  }
+
+  if (pool->cnt > 1 && app->cfg.proto != PJSIP_TRANSPORT_UDP) {
+    PJ_LOG(1, (NAME, "Local address lists and port ranges are supported only with UDP."));
+    return PJ_EINVAL;
+  }
+
+  // transaction based commands send from one address
+  if (pool->cnt > 1 && !app->cfg.stateless && app->cfg.cmd != CMD_RAW) {
+    PJ_LOG(2, (NAME, "Local address lists and port ranges are used only in stateless mode. "
+          "Binding first address and port."));
+    pool->cnt = 1;
+  }
+
+  // stateless workers send from own port each, replies come back to them
+  if (app->cfg.threads > 1 && (app->cfg.stateless || app->cfg.cmd == CMD_RAW)) {
+    if (pool->cnt > 1) {
+      PJ_LOG(1, (NAME, "Local address lists and port ranges can not be used with --threads."));
+      return PJ_EINVAL;
+    }
+    pool->cnt = app->cfg.threads;
+  }
+
+  pool->ent = pj_pool_calloc(app->pool, pool->cnt, sizeof(*pool->ent));
+
+  // neighbour tuples differ in address, then in port
+  for (i = 0; i < pool->cnt; i++) {
+    status = transport_start(app, &hosts[i % host_cnt],
+        (pj_uint16_t)(app->cfg.local_port + (app->cfg.local_port ? i / host_cnt : 0)),
+        &pool->ent[i].host, &pool->ent[i].port, &pool->ent[i].tp);
+    if (status != PJ_SUCCESS) {
+      pool->cnt = 0;
+      return status;
+    }
+  }
+
+  if (pool->cnt > 1) {
+    PJ_LOG(3, (NAME, "Bound %u local address and port tuples.", pool->cnt));
+  }
+
+  *local_addr = pool->ent[0].host;
+  *local_port = pool->ent[0].port;
+
+  return PJ_SUCCESS;
+}
+
+/* Add every host address of IPv4 CIDR block "item", like 10.0.0.0/24. */
+static pj_status_t add_cidr (pj_pool_t *pool, const pj_str_t *item,
+                             pj_str_t *hosts, unsigned max, unsigned *cnt)
+{
+  pj_str_t net, bits, rest;
+  pj_in_addr in;
+  pj_uint32_t first, last, mask, a;
+  unsigned long prefix;
+  char *slash = pj_strchr(item, '/');
+
+  net.ptr = item->ptr;
+  net.slen = slash - item->ptr;
+  bits.ptr = slash + 1;
+  bits.slen = item->slen - net.slen - 1;
+  prefix = pj_strtoul2(&bits, &rest, 10);
+
+  if (bits.slen == 0 || rest.slen != 0 || prefix > 32 || !pj_inet_aton(&net, &in)) {
+    PJ_LOG(1, (NAME, "Invalid local address block %.*s. Expected IPv4 CIDR like 10.0.0.0/24.",
+          (int)item->slen, item->ptr));
+    return PJ_EINVAL;
+  }
+
+  mask = prefix ? 0xffffffff << (32 - prefix) : 0;
+  first = pj_ntohl(in.s_addr) & mask;
+  last = first | ~mask;
+  if (prefix < 31) {
+    first++; // network and broadcast addresses are skipped
+    last--;
+  }
+
+  if ((pj_uint64_t)last - first + 1 > max - *cnt) {
+    PJ_LOG(1, (NAME, "Local address block %.*s is too big. Max is %u addresses.",
+          (int)item->slen, item->ptr, max));
+    return PJ_EINVAL;
+  }
+
+  for (a = first; ; a++) {
+    in.s_addr = pj_htonl(a);
+    hosts[*cnt].ptr = pj_pool_alloc(pool, PJ_INET_ADDRSTRLEN);
+    pj_inet_ntop(pj_AF_INET(), &in, hosts[*cnt].ptr, PJ_INET_ADDRSTRLEN);
+    hosts[*cnt].slen = pj_ansi_strlen(hosts[*cnt].ptr);
+    (*cnt)++;
+    if (a == last) {
+      break;
+    }
+  }
+
+  return PJ_SUCCESS;
+}
+
+PJ_DEF(pj_status_t) sippak_tsx_layer_init(struct sippak_app *app)
+{
+  if (pjsip_tsx_layer_instance()->id != -1) {
+    return PJ_SUCCESS;
+  }
+  return pjsip_tsx_layer_init_module(app->endpt);
+}
+
+PJ_DEF(pj_status_t) sippak_ua_layer_init(struct sippak_app *app)
+{
+  if (pjsip_ua_instance()->id != -1) {
+    return PJ_SUCCESS;
+  }
+  return pjsip_ua_init_module(app->endpt, NULL);
+}
+
+PJ_DEF(pj_status_t) sippak_cmd_module_register(struct sippak_app *app,
+                                  pjsip_module *mod)
+{
+  pj_status_t status;
+
+  if (mod->id != -1) {
+    return PJ_SUCCESS;
+  }
+  status = pjsip_endpt_register_module(app->endpt, mod);
+  if (status == PJ_SUCCESS) {
+    app->cmd_mod = mod;
+  }
   return status;
 }
 
+PJ_DEF(pj_status_t) sippak_local_hosts(struct sippak_app *app,
+                                       pj_str_t *hosts,
+                                       unsigned max,
+                                       unsigned *cnt)
+{
+  pj_status_t status;
+  pj_str_t list = app->cfg.local_host;
+  pj_str_t delim = pj_str(",");
+  pj_str_t item, host;
+  pj_ssize_t pos;
+
+  *cnt = 0;
+
+  if (list.slen == 0) {
+    hosts[(*cnt)++] = list;
+    return PJ_SUCCESS;
+  }
+
+  for (pos = pj_strtok(&list, &delim, &item, 0); pos != list.slen;
+       pos = pj_strtok(&list, &delim, &item, pos + item.slen))
+  {
+    host = item; // item is position of next token
+    pj_strtrim(&host);
+    if (host.slen == 0) {
+      continue;
+    }
+
+    if (pj_strchr(&host, '/')) {
+      status = add_cidr(app->pool, &host, hosts, max, cnt);
+      if (status != PJ_SUCCESS) {
+        return status;
+      }
+      continue;
+    }
+
+    if (*cnt == max) {
+      PJ_LOG(1, (NAME, "Too many local hosts. Max is %u.", max));
+      return PJ_EINVAL;
+    }
+    hosts[(*cnt)++] = host;
+  }
+
+  if (*cnt == 0) {
+    hosts[(*cnt)++] = pj_str("");
+  }
+
+  return PJ_SUCCESS;
+}
+
+/* Entry of credentials store, hash entry is kept with credentials,
+ * so every user costs one allocation. */
+struct cred_entry {
+  pj_hash_entry_buf hbuf;
+  pjsip_cred_info cred;
+};
+
+static pj_bool_t is_ha1 (pj_str_t *ha1)
+{
+  pj_ssize_t i;
+
+  if (ha1->slen != PJSIP_MD5STRLEN) {
+    return PJ_FALSE;
+  }
+  for (i = 0; i < ha1->slen; i++) {
+    if (!pj_isxdigit(ha1->ptr[i])) {
+      return PJ_FALSE;
+    }
+    ha1->ptr[i] = pj_tolower(ha1->ptr[i]); // digest is computed over lower case hex
+  }
+  return PJ_TRUE;
+}
+
+/* Split "username:realm:HA1" line in place. */
+static pj_status_t cred_parse (char *line, struct cred_entry *en)
+{
+  char *realm, *ha1;
+
+  realm = strchr(line, ':');
+  ha1 = realm ? strchr(realm + 1, ':') : NULL;
+  if (ha1 == NULL || realm == line) {
+    return PJ_EINVAL;
+  }
+  *realm++ = '\0';
+  *ha1++ = '\0';
+
+  en->cred.scheme    = pj_str("digest");
+  en->cred.username  = pj_str(line);
+  en->cred.realm     = pj_str(realm);
+  en->cred.data_type = PJSIP_CRED_DATA_DIGEST;
+  en->cred.data      = pj_str(ha1);
+  pj_strtrim(&en->cred.data);
+
+  return is_ha1(&en->cred.data) ? PJ_SUCCESS : PJ_EINVAL;
+}
+
+PJ_DEF(pj_status_t) sippak_cred_store_load(struct sippak_app *app,
+                                           const char *path)
+{
+  struct sippak_cred_store *store = &app->creds;
+  struct cred_entry *en;
+  char *buf, *line, *next, *end;
+  unsigned lines = 1, lineno = 0;
+  long size;
+  FILE *f;
+
+  f = fopen(path, "rb");
+  if (f == NULL) {
+    PJ_LOG(1, (NAME, "Failed to open credentials file %s.", path));
+    return PJ_ENOTFOUND;
+  }
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  // pipe or FIFO has no size
+  if (size <= 0) {
+    PJ_LOG(1, (NAME, "Credentials file %s is empty or not a regular file.", path));
+    fclose(f);
+    return PJ_EINVAL;
+  }
+
+  // entries point into file buffer, nothing is copied
+  buf = pj_pool_alloc(app->pool, size + 1);
+  size = fread(buf, 1, size, f);
+  fclose(f);
+  buf[size] = '\0';
+  end = buf + size;
+
+  for (line = buf; line < end; line++) {
+    if (*line == '\n') {
+      lines++;
+    }
+  }
+
+  // table of line count size, so chains stay one entry long
+  store->ht = pj_hash_create(app->pool, lines);
+  store->cnt = 0;
+  en = pj_pool_calloc(app->pool, lines, sizeof(*en));
+
+  for (line = buf; line < end; line = next) {
+    next = strchr(line, '\n');
+    if (next) {
+      *next++ = '\0';
+    } else {
+      next = end;
+    }
+    lineno++;
+
+    while (pj_isspace(*line)) {
+      line++;
+    }
+    if (*line == '\0' || *line == '#') {
+      continue;
+    }
+
+    if (cred_parse(line, en) != PJ_SUCCESS) {
+      PJ_LOG(1, (NAME, "Invalid credentials at %s:%u. Must be username:realm:HA1.",
+            path, lineno));
+      return PJ_EINVAL;
+    }
+
+    if (pj_hash_get(store->ht, en->cred.username.ptr, en->cred.username.slen, NULL) == NULL) {
+      store->cnt++;
+    }
+    // same user again replaces value and keeps existing entry
+    pj_hash_set_np(store->ht, en->cred.username.ptr, en->cred.username.slen,
+        0, en->hbuf, &en->cred);
+    en++;
+  }
+
+  PJ_LOG(4, (NAME, "Loaded credentials of %u users from %s.", store->cnt, path));
+
+  return PJ_SUCCESS;
+}
+
+PJ_DEF(const pjsip_cred_info*) sippak_cred_store_find(struct sippak_app *app,
+                                                      const pj_str_t *username)
+{
+  if (app->creds.ht == NULL || username->slen == 0) {
+    return NULL;
+  }
+  return pj_hash_get(app->creds.ht, username->ptr, username->slen, NULL);
+}
+
 PJ_DEF(void) sippak_set_cred(struct sippak_app *app,
                             pjsip_cred_info *cred)
 {
+  const pjsip_cred_info *stored = sippak_cred_store_find(app, &app->cfg.username);
+
+  if (stored) {
+    *cred = *stored;
+    return;
+  }
+
   cred->realm     = pj_str("*");
   cred->scheme    = pj_str("digest");
   cred->username  = app->cfg.username;
@@ -179,28 +553,175 @@ PJ_DEF(void) sippak_set_cred(struct sippak_app *app,
   cred->data      = app->cfg.password;
 }
 
-PJ_DEF(void) sippak_add_sip_headers (pjsip_tx_data *tdata, struct sippak_app *app)
+/* Client auth session of one target. Key is stored after the entry. */
+struct auth_entry {
+  pj_hash_entry_buf hbuf;
+  pjsip_auth_clt_sess sess;
+  pj_pool_t *pool;
+};
+
+#define AUTH_POOL_SIZE 1024
+
+/* Target of request is host and port of SIP request URI, whole URI otherwise. */
+static int auth_target (const pjsip_tx_data *tdata, char *buf, int size)
+{
+  const pjsip_uri *uri = pjsip_uri_get_uri(tdata->msg->line.req.uri);
+
+  if (PJSIP_URI_SCHEME_IS_SIP(uri) || PJSIP_URI_SCHEME_IS_SIPS(uri)) {
+    const pjsip_sip_uri *sip_uri = (const pjsip_sip_uri *)uri;
+    return pj_ansi_snprintf(buf, size, "%.*s:%d",
+        (int)sip_uri->host.slen, sip_uri->host.ptr, sip_uri->port);
+  }
+  return pjsip_uri_print(PJSIP_URI_IN_REQ_URI, uri, buf, size);
+}
+
+PJ_DEF(pj_status_t) sippak_auth_sess(struct sippak_app *app,
+                                     const pjsip_tx_data *tdata,
+                                     pjsip_auth_clt_sess **sess)
+{
+  struct auth_entry *en;
+  pjsip_cred_info cred;
+  pj_pool_t *pool;
+  pj_status_t status;
+  char key[PJSIP_MAX_URL_SIZE];
+  int len;
+
+  len = auth_target(tdata, key, sizeof(key));
+  if (len <= 0 || len >= (int)sizeof(key)) {
+    return PJSIP_EURITOOLONG;
+  }
+
+  if (app->auth_sess == NULL) {
+    app->auth_sess = pj_hash_create(app->pool, SIPPAK_AUTH_SESS_HASH);
+  }
+
+  en = pj_hash_get(app->auth_sess, key, len, NULL);
+  if (en) {
+    *sess = &en->sess;
+    return PJ_SUCCESS;
+  }
+
+  // own pool, challenges cached by session outlive every transaction
+  pool = pjsip_endpt_create_pool(app->endpt, "auth", AUTH_POOL_SIZE, AUTH_POOL_SIZE);
+  en = pj_pool_zalloc(pool, sizeof(*en) + len);
+  en->pool = pool;
+  pj_memcpy(en + 1, key, len);
+
+  status = pjsip_auth_clt_init(&en->sess, app->endpt, pool, 0);
+  if (status != PJ_SUCCESS) {
+    pj_pool_release(pool);
+    return status;
+  }
+  sippak_set_cred(app, &cred);
+  pjsip_auth_clt_set_credentials(&en->sess, 1, &cred);
+
+  pj_hash_set_np(app->auth_sess, en + 1, len, 0, en->hbuf, en);
+  *sess = &en->sess;
+
+  return PJ_SUCCESS;
+}
+
+PJ_DEF(pj_status_t) sippak_auth_reinit_req(struct sippak_app *app,
+                                           pjsip_rx_data *rdata,
+                                           pjsip_tx_data *tdata,
+                                           pjsip_tx_data **new_tdata)
+{
+  pjsip_auth_clt_sess *sess;
+  pjsip_cached_auth *auth;
+  pj_status_t status;
+
+  status = sippak_auth_sess(app, tdata, &sess);
+  if (status != PJ_SUCCESS) {
+    return status;
+  }
+
+  // pjsip counts stale nonces of realm for session life, count them
+  // per request: request without credentials starts new exchange
+  if (pjsip_msg_find_hdr(tdata->msg, PJSIP_H_AUTHORIZATION, NULL) == NULL &&
+      pjsip_msg_find_hdr(tdata->msg, PJSIP_H_PROXY_AUTHORIZATION, NULL) == NULL) {
+    for (auth = sess->cached_auth.next; auth != &sess->cached_auth; auth = auth->next) {
+      auth->stale_cnt = 0;
+    }
+  }
+
+  // request that carried credentials is rejected with
+  // PJSIP_EFAILEDCREDENTIAL, repeated stale nonce with PJSIP_EAUTHSTALECOUNT
+  return pjsip_auth_clt_reinit_req(sess, rdata, tdata, new_tdata);
+}
+
+/* Add header to template unless header with same name is there. */
+static void hdr_tpl_add (struct sippak_hdr_tpl *tpl, pjsip_hdr *hdr)
+{
+  pj_uint32_t hval = pj_hash_calc_tolower(0, NULL, &hdr->name);
+
+  for (unsigned i = 0; i < tpl->cnt; i++) {
+    if (tpl->hash[i] == hval && pj_stricmp(&tpl->hdr[i]->name, &hdr->name) == 0) {
+      return;
+    }
+  }
+  tpl->hdr[tpl->cnt] = hdr;
+  tpl->hash[tpl->cnt] = hval;
+  tpl->mask |= (pj_uint64_t)1 << (hval % 64);
+  tpl->cnt++;
+}
+
+PJ_DEF(void) sippak_hdr_tpl_init (struct sippak_app *app)
 {
+  struct sippak_hdr_tpl *tpl = &app->hdr_tpl;
   pj_str_t ua_hname = pj_str("User-Agent");
-  pjsip_hdr *hdr;
+  unsigned max = app->cfg.hdrs.cnt + 1;
+
+  tpl->cnt = 0;
+  tpl->mask = 0;
+  tpl->hdr = pj_pool_calloc(app->pool, max, sizeof(pjsip_hdr*));
+  tpl->hash = pj_pool_calloc(app->pool, max, sizeof(pj_uint32_t));
+
+  if (app->cfg.user_agent.slen > 0) {
+    hdr_tpl_add (tpl, (pjsip_hdr*) pjsip_generic_string_hdr_create(app->pool,
+          &ua_hname, &app->cfg.user_agent));
+  }
+
+  for (unsigned i = 0; i < app->cfg.hdrs.cnt; i++) {
+    hdr_tpl_add (tpl, (pjsip_hdr*) app->cfg.hdrs.h[i]);
+  }
 
-  if(pjsip_msg_find_hdr_by_name(tdata->msg, &ua_hname, NULL) == NULL
-      && app->cfg.user_agent.slen > 0) {
-    hdr = (pjsip_hdr*) pjsip_generic_string_hdr_create(tdata->pool,
-        &ua_hname, &app->cfg.user_agent);
+  tpl->ready = PJ_TRUE;
+}
+
+PJ_DEF(void) sippak_add_sip_headers (pjsip_tx_data *tdata, struct sippak_app *app)
+{
+  struct sippak_hdr_tpl *tpl = &app->hdr_tpl;
+  pjsip_hdr *hdr;
 
-    pjsip_msg_add_hdr(tdata->msg, hdr);
+  if (!tpl->ready) {
+    sippak_hdr_tpl_init (app);
+  }
+  if (tpl->cnt == 0) {
+    return;
   }
 
-  if (app->cfg.hdrs.cnt > 0) {
-    for(int i = 0; i < app->cfg.hdrs.cnt; i++) {
-      pjsip_hdr *hdr_add = (pjsip_hdr *)app->cfg.hdrs.h[i];
-      hdr = pjsip_msg_find_hdr_by_name(tdata->msg, &hdr_add->name, NULL);
-      if(hdr == NULL) {
-        pjsip_msg_add_hdr(tdata->msg, hdr_add);
+  // one pass over message headers marks template headers already present
+  pj_bool_t present[tpl->cnt];
+  pj_bzero(present, sizeof(present));
+
+  for (hdr = tdata->msg->hdr.next; hdr != &tdata->msg->hdr; hdr = hdr->next) {
+    pj_uint32_t hval = pj_hash_calc_tolower(0, NULL, &hdr->name);
+    if (!(tpl->mask & ((pj_uint64_t)1 << (hval % 64)))) {
+      continue;
+    }
+    for (unsigned i = 0; i < tpl->cnt; i++) {
+      if (tpl->hash[i] == hval && pj_stricmp(&tpl->hdr[i]->name, &hdr->name) == 0) {
+        present[i] = PJ_TRUE;
       }
     }
   }
+
+  for (unsigned i = 0; i < tpl->cnt; i++) {
+    if (!present[i]) {
+      // shallow clone shares name and value with template in app pool
+      pjsip_msg_add_hdr(tdata->msg, pjsip_hdr_shallow_clone(tdata->pool, tpl->hdr[i]));
+    }
+  }
 }
 
 PJ_DEF(pj_bool_t) sippak_set_proxies_list(struct sippak_app *app, pjsip_route_hdr **rset)
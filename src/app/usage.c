@@ -43,6 +43,14 @@ PJ_DEF(void) usage ()
   puts("              This command requires parameter --to for Refer-To header.");
   puts("    MESSAGE   Send MESSAGE method with text. SIP instant messaging.");
   puts("    INVITE    Initiates and handles INVITE session. After session is confirmed (200) sends BYE.");
+  puts("    RAW       Send SIP messages from files as is, see --file. Stateless, over UDP only.");
+  puts("    SERVE     Answer incoming requests until SIGINT: 200 to OPTIONS, MESSAGE, REGISTER, PUBLISH,");
+  puts("              NOTIFY, BYE and CANCEL, 202 to SUBSCRIBE and REFER, 180 and 200 with SDP to INVITE.");
+  puts("              202 to SUBSCRIBE is followed by NOTIFY. Stateless, no destination.");
+  puts("    BENCH     Run every command against SERVE in the same process over pjsip loop transport, no");
+  puts("              sockets. Prints messages per second, CPU and pool memory per message.");
+  puts("              Runs per command are --count, default 1000, one after another, so --delay adds up.");
+  puts("              Use -q to leave out logging.");
 
   puts("");
   puts("  OPTIONS:");
@@ -59,16 +67,89 @@ printf("    --ns=LIST       Define DNS nameservers to use. Comma separated list
   puts("    --log-time      Print time and microseconds in logs.");
   puts("    --log-level     Print log level: ERROR, INFO etc.");
   puts("    --log-snd       Print log sender file or module name.");
+  puts("    --log-method=LIST");
+  puts("                    Log only messages of given methods. Comma separated list.");
+  puts("                    Responses are matched by CSeq method. For example: --log-method=INVITE,BYE");
+  puts("    --log-status=LIST");
+  puts("                    Log only responses of given status classes. Comma separated list.");
+  puts("                    Class with \"!\" is excluded. For example: --log-status=4xx,5xx or --log-status=!1xx");
+  puts("    --log-sample=N  Log only 1-in-N dialogs sampled by Call-ID. Default is 1, log all.");
+  puts("    --log-compact   Print only first line of SIP messages.");
+  puts("    --timing        Report timing of every request: DNS, connect, first transmission,");
+  puts("                    retransmissions, first provisional and final response. Summary on exit");
+  puts("                    includes retransmissions, duplicate responses and estimated loss per destination.");
+  puts("    --timeseries=FILE");
+  puts("                    Write one CSV row per second to FILE: requests sent, responses by class,");
+  puts("                    retransmissions, timeouts and p50/p99 latency of final responses.");
+  puts("    --stats-interval=SEC");
+  puts("                    Write messages counters per method and status, transactions, dialogs");
+  puts("                    and pool memory to stats file every SEC seconds. Signal SIGUSR1");
+  puts("                    prints the same counters to stdout at any time.");
+  puts("    --stats-file=FILE");
+  puts("                    Stats file path. Default is \"sippak.stats\". File is replaced atomically.");
+  puts("    --stateless     Send requests without transaction layer. Request is serialized once and");
+  puts("                    only Via branch, Call-ID, From tag and CSeq are patched per send.");
+  puts("                    Responses are matched by Via branch. Only PING command over UDP.");
+  puts("    --retrans       Retransmit stateless requests with T1/T2 timers. Disabled by default.");
+  puts("    --count=N       Number of requests to send in stateless mode. Default is 1.");
+  puts("    --rate=N        Requests per second in stateless mode. Default is 0, as fast as possible.");
+  puts("                    Every request has own send slot, waits use timerfd when available.");
+  puts("    --mmsg          Batch stateless UDP datagrams, up to 64 per sendmmsg/recvmmsg call. Linux only.");
+  puts("    --uring         Stateless UDP I/O with io_uring: batched submits and multishot receive into");
+  puts("                    kernel registered buffers. Linux 6.0 or newer, built with liburing.");
+  puts("    --threads=N     Stateless worker threads, up to 64. Every worker sends and receives on own");
+  puts("                    local port, next ports of --local-port or ephemeral ones. Not combined with");
+  puts("                    --mmsg, --uring or local address lists and port ranges.");
+  puts("    --spin=USEC     Busy wait last USEC microseconds before paced send for sub-microsecond");
+  puts("                    accuracy at cost of CPU. Default is 0, sleep only. Max is 1000.");
+  puts("    --daemon        Keep endpoint, resolver and transports and run command lines received");
+  puts("                    on UNIX socket, one per line, like: ping sip:alice@example.com -p secret");
+  puts("                    Result of every line is one JSON line with \"id\" of line per connection.");
+  puts("                    Commands PING, REGISTER and MESSAGE. Stops on SIGINT or SIGTERM.");
+  puts("                    Lines with --proxy, -H, --proto, --from-name, --local-host, --local-port,");
+  puts("                    --user-agent or --contact are refused, requests use shared transports.");
+  puts("    --socket=PATH   Daemon socket path. Default is \"/tmp/sippak.sock\".");
+  puts("    --batch[=FILE]  Run command lines from FILE or stdin, one per line, like daemon does.");
+  puts("                    Endpoint, transports and DNS are shared. Result of every line is one");
+  puts("                    JSON line on stdout. Empty lines and lines starting with \"#\" are skipped.");
+printf("    --concurrency=N Batch requests in flight, up to %d. Default is %d.\n",
+      SIPPAK_BATCH_MAX_CONCURRENCY, SIPPAK_BATCH_CONCURRENCY);
+  puts("    --ordered       Write batch results in input order. Default is as requests complete.");
+  puts("    --scenario=FILE Run steps of FILE in one process, one per line. Step is command with options");
+  puts("                    and destination, like \"register -X 60 sip:alice@example.com\", or \"pause MS\".");
+  puts("                    Options of sippak command line apply to every step. Steps share transport,");
+  puts("                    contact, dialogs and auth sessions. Every step is timed. Not stateless or RAW.");
+  puts("    --delay=MS      Delay final responses of SERVE command by MS milliseconds. Default is 0.");
+  puts("    --fail-ratio=PCT");
+  puts("                    Percent of requests SERVE command answers with --fail-code. Default is 0.");
+  puts("    --fail-code=CODE");
+printf("                    Failure response code of SERVE command, 300 to 699. Default is %d.\n",
+      SIPPAK_SERVE_FAIL_CODE);
+  puts("    --file=FILE     SIP message file for RAW command. Option can be repeated up to 12 times,");
+  puts("                    files are sent round robin, every file --count times. Message is not parsed.");
+  puts("                    Tokens replaced per send: [branch], [call_id], [from_tag], [cseq].");
+  puts("                    Tokens replaced once: [local_ip], [local_port], [remote_ip], [remote_port],");
+  puts("                    [transport] and [len] (body length). Responses are matched by [branch].");
 
-  puts("    -P, --local-port=PORT");
-  puts("                    Bind local port. Default is random port.");
-  puts("    -l, --local-host=HOST|IP");
+  puts("    -P, --local-port=PORT|FIRST-LAST");
+  puts("                    Bind local port. Default is random port. Range binds every port of it.");
+  puts("    -l, --local-host=HOST|IP|LIST|CIDR");
   puts("                    Bind local hostname or IP. Default is first available local inface.");
+  puts("                    Comma separated list or IPv4 CIDR block, like 10.0.0.0/24, binds every");
+  puts("                    address. In stateless mode requests are spread over every address and");
+  puts("                    port, so source IP/port hashing load balancers see many clients.");
   puts("    -u, --username=USER");
   puts("                    Username part in Authentication as well as in Contact and");
   puts("                    From header URI. Default is from destination URI.");
   puts("    -p, --password=PASS");
   puts("                    Password for authentication.");
+  puts("    --auth-cache=FILE");
+  puts("                    Keep digest challenges in FILE between runs. With password, requests");
+  puts("                    to known server carry credentials from cached nonce and are not challenged.");
+  puts("    --cred-file=FILE");
+  puts("                    Credentials file of \"username:realm:HA1\" lines, htdigest format. HA1 is");
+  puts("                    used instead of password for users found in file. Users are hash indexed.");
+  puts("                    Daemon and batch lines without -p use HA1 of their -u user.");
   puts("    -c, --contact=CONTACT");
   puts("                    Custom contact header value. Must be valid SIP URI. For example: sip:alice@10.10.10.1:123");
   puts("                    If not set, contact header is generated automatically.");
@@ -123,7 +204,7 @@ printf("    --ns=LIST       Define DNS nameservers to use. Comma separated list
   puts("    -A, --user-agent=STRING");
   puts("                    Set User-Agent SIP header value.");
   puts("    -H, --header=HEADER");
-  puts("                    Add custom header to request. Multiple custom headers (up to 12) can be added.");
+  puts("                    Add custom header to request. Multiple custom headers can be added.");
   puts("                    Parameter value must contain header name and value separated by colon.");
   puts("                    Examples:");
   puts("                    --header=\"X-Foo: bar\", -H X-Foo:bar, -H \"X-Assert: sip:123@sip.com\"");
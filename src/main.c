@@ -27,20 +27,15 @@
 
 #include "sippak.h"
 
-static pj_bool_t sippak_loop_stop = PJ_FALSE;
 struct sippak_app app;
 
-static void sippak_main_loop()
+/* Reports and cache files written on exit of every run mode. */
+static void run_finish (struct sippak_app *app)
 {
-  while (sippak_loop_stop == PJ_FALSE) {
-    pj_time_val timeout = {0, 500};
-    pjsip_endpt_handle_events(app.endpt, &timeout);
-  }
-}
-
-PJ_DEF(void) sippak_loop_cancel()
-{
-  sippak_loop_stop = PJ_TRUE;
+  sippak_serve_report(app);
+  sippak_timeseries_stop();
+  sippak_timing_report(app);
+  sippak_auth_cache_save(app);
 }
 
 int main(int argc, char *argv[])
@@ -76,6 +71,50 @@ int main(int argc, char *argv[])
   status = sippak_mod_sip_mangler_register (&app);
   SIPPAK_ASSERT_SUCC(status, "Failed to register SIP mangler module.");
 
+  status = sippak_mod_stats_register (&app);
+  SIPPAK_ASSERT_SUCC(status, "Failed to register stats module.");
+
+  if (app.cfg.cred_file) {
+    status = sippak_cred_store_load (&app, app.cfg.cred_file);
+    SIPPAK_ASSERT_SUCC(status, "Failed to load credentials file.");
+  }
+
+  if ((app.cfg.password.slen || app.creds.cnt) && !app.cfg.stateless && app.cfg.cmd != CMD_RAW) {
+    status = sippak_mod_auth_cache_register (&app);
+    SIPPAK_ASSERT_SUCC(status, "Failed to register auth cache module.");
+  }
+
+  if (app.cfg.timing || app.cfg.timeseries) {
+    status = sippak_mod_timing_register (&app);
+    SIPPAK_ASSERT_SUCC(status, "Failed to register timing module.");
+  }
+
+  if (app.cfg.timeseries) {
+    status = sippak_timeseries_start (&app);
+    SIPPAK_ASSERT_SUCC(status, "Failed to start time series.");
+  }
+
+  if (app.cfg.daemon) {
+    status = sippak_daemon_run(&app);
+    SIPPAK_ASSERT_SUCC(status, "Failed to run daemon.");
+    run_finish(&app);
+    goto done;
+  }
+
+  if (app.cfg.scenario) {
+    status = sippak_scenario_run(&app, argc, argv);
+    SIPPAK_ASSERT_SUCC(status, "Failed to run scenario.");
+    run_finish(&app);
+    goto done;
+  }
+
+  if (app.cfg.batch.enabled) {
+    status = sippak_batch_run(&app);
+    SIPPAK_ASSERT_SUCC(status, "Failed to run batch.");
+    run_finish(&app);
+    goto done;
+  }
+
   // run
   switch (app.cfg.cmd)
   {
@@ -119,6 +158,20 @@ int main(int argc, char *argv[])
       status = sippak_cmd_invite(&app);
       SIPPAK_ASSERT_SUCC(status, "Failed INVITE command.");
       break;
+    case CMD_RAW:
+      status = sippak_cmd_raw(&app);
+      SIPPAK_ASSERT_SUCC(status, "Failed RAW command.");
+      break;
+    case CMD_SERVE:
+      status = sippak_cmd_serve(&app);
+      SIPPAK_ASSERT_SUCC(status, "Failed SERVE command.");
+      break;
+    case CMD_BENCH:
+      status = sippak_cmd_bench(&app);
+      run_finish(&app);
+      SIPPAK_ASSERT_SUCC(status, "Failed BENCH command.");
+      goto done;
+      break;
 
     // fail
     case CMD_UNKNOWN:
@@ -129,7 +182,9 @@ int main(int argc, char *argv[])
       break;
   }
   // main loop
-  sippak_main_loop();
+  sippak_loop_run(&app);
+
+  run_finish(&app);
 
 done:
   pj_caching_pool_destroy(&cp);
@@ -0,0 +1,460 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file auth_cache.c
+ * @brief sippak preemptive digest authentication
+ *
+ * Digest challenges are remembered by server address and realm. Later
+ * requests to the same server carry credentials computed from cached
+ * nonce with incremented nonce-count, so they are not challenged again.
+ * nextnonce of Authentication-Info replaces cached nonce.
+ *
+ * When server challenges request anyway, preemptive header is removed
+ * before command re-sends request with its own auth session, and the
+ * new challenge is cached. With --auth-cache cache is kept in file
+ * between runs.
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sippak.h"
+
+#define NAME "mod_auth_cache"
+
+#define AUTH_CACHE_MAX 32     // cached challenges
+#define AUTH_SERVER_LEN 64    // "addr:port" of server
+#define AUTH_VALUE_LEN 256    // realm, nonce and opaque
+
+struct auth_entry {
+  char server[AUTH_SERVER_LEN];
+  char realm[AUTH_VALUE_LEN];
+  char nonce[AUTH_VALUE_LEN];
+  char opaque[AUTH_VALUE_LEN];
+  pj_uint32_t nc;             // last nonce-count sent with nonce
+  pj_bool_t qop_auth;         // qop=auth, otherwise RFC 2069 digest
+  pj_bool_t proxy;            // Proxy-Authorization
+};
+
+static struct {
+  struct sippak_app *app;
+  struct auth_entry entry[AUTH_CACHE_MAX];
+  unsigned cnt;
+  unsigned next;              // entry replaced when cache is full
+  pj_uint32_t sent;           // requests sent with preemptive credentials
+  pj_uint32_t challenged;     // of them challenged anyway
+} cache;
+
+static pj_bool_t on_rx_response (pjsip_rx_data *rdata);
+static pj_status_t on_tx_request (pjsip_tx_data *tdata);
+
+// mod_data of request with own auth session, left alone by cache
+static pjsip_hdr skip_mark;
+
+/* Before transaction layer on receive, before message print on send. */
+static pjsip_module mod_auth_cache =
+{
+  NULL, NULL,                 /* prev, next.    */
+  { "mod-auth-cache", 14 },   /* Name.    */
+  -1,                         /* Id      */
+  PJSIP_MOD_PRIORITY_TRANSPORT_LAYER + 1, /* Priority          */
+  NULL,                       /* load()    */
+  NULL,                       /* start()    */
+  NULL,                       /* stop()    */
+  NULL,                       /* unload()    */
+  NULL,                       /* on_rx_request()  */
+  &on_rx_response,            /* on_rx_response()  */
+  &on_tx_request,             /* on_tx_request.  */
+  NULL,                       /* on_tx_response()  */
+  NULL,                       /* on_tsx_state()  */
+};
+
+static pj_bool_t copy_value (char *dst, const pj_str_t *src)
+{
+  if (src->slen >= AUTH_VALUE_LEN) {
+    return PJ_FALSE;
+  }
+  pj_memcpy(dst, src->ptr, src->slen);
+  dst[src->slen] = '\0';
+  return PJ_TRUE;
+}
+
+static struct auth_entry *entry_find (const char *server, const pj_str_t *realm)
+{
+  unsigned i;
+
+  for (i = 0; i < cache.cnt; i++) {
+    if (pj_ansi_strcmp(cache.entry[i].server, server) == 0 &&
+        (realm == NULL || pj_strcmp2(realm, cache.entry[i].realm) == 0)) {
+      return &cache.entry[i];
+    }
+  }
+  return NULL;
+}
+
+static struct auth_entry *entry_add (const char *server, const pj_str_t *realm)
+{
+  struct auth_entry *en = entry_find(server, realm);
+
+  if (en) {
+    return en;
+  }
+  if (cache.cnt < AUTH_CACHE_MAX) {
+    en = &cache.entry[cache.cnt++];
+  } else {
+    en = &cache.entry[cache.next];
+    cache.next = (cache.next + 1) % AUTH_CACHE_MAX;
+  }
+  pj_bzero(en, sizeof(*en));
+  pj_ansi_strncpy(en->server, server, AUTH_SERVER_LEN - 1);
+  copy_value(en->realm, realm);
+
+  return en;
+}
+
+/* qop list has "auth", not just "auth-int" */
+static pj_bool_t qop_has_auth (const pj_str_t *qop)
+{
+  pj_ssize_t i;
+
+  for (i = 0; i + 4 <= qop->slen; i++) {
+    if (pj_ansi_strnicmp(qop->ptr + i, "auth", 4) == 0 &&
+        (i + 4 == qop->slen || qop->ptr[i + 4] != '-')) {
+      return PJ_TRUE;
+    }
+  }
+  return PJ_FALSE;
+}
+
+/* Cache MD5 digest challenges of 401/407 response. */
+static void cache_challenges (pjsip_rx_data *rdata, const char *server)
+{
+  pjsip_msg *msg = rdata->msg_info.msg;
+  pj_bool_t proxy = msg->line.status.code == PJSIP_SC_PROXY_AUTHENTICATION_REQUIRED;
+  pjsip_hdr_e type = proxy ? PJSIP_H_PROXY_AUTHENTICATE : PJSIP_H_WWW_AUTHENTICATE;
+  pjsip_www_authenticate_hdr *hchal = NULL;
+  struct auth_entry *en;
+
+  while ((hchal = pjsip_msg_find_hdr(msg, type, hchal ? hchal->next : NULL)) != NULL) {
+    pjsip_digest_challenge *d = &hchal->challenge.digest;
+
+    if (pj_stricmp2(&hchal->scheme, "digest") != 0 ||
+        (d->algorithm.slen && pj_stricmp2(&d->algorithm, "md5") != 0) ||
+        (d->qop.slen && !qop_has_auth(&d->qop))) {
+      continue;
+    }
+
+    en = entry_add(server, &d->realm);
+    if (!copy_value(en->nonce, &d->nonce) || !copy_value(en->opaque, &d->opaque)) {
+      en->nonce[0] = '\0'; // too long to cache, never used
+      continue;
+    }
+    en->qop_auth = d->qop.slen > 0;
+    en->proxy = proxy;
+    en->nc = 1; // command answers challenge with first nonce-count
+  }
+}
+
+/* Authentication-Info: nextnonce="..." replaces nonce of server. */
+static void cache_nextnonce (pjsip_rx_data *rdata, const char *server)
+{
+  const pj_str_t name = { "Authentication-Info", 19 };
+  const pj_str_t param = { "nextnonce=", 10 };
+  pjsip_generic_string_hdr *hdr;
+  struct auth_entry *en;
+  pj_str_t nonce;
+  char *p, *end;
+  unsigned i;
+
+  hdr = pjsip_msg_find_hdr_by_name(rdata->msg_info.msg, &name, NULL);
+  if (hdr == NULL) {
+    return;
+  }
+
+  p = pj_strstr(&hdr->hvalue, &param);
+  if (p == NULL) {
+    return;
+  }
+  p += 10;
+  end = hdr->hvalue.ptr + hdr->hvalue.slen;
+  if (p < end && *p == '"') {
+    p++;
+  }
+  for (nonce.ptr = p; p < end && *p != '"' && *p != ',' && *p != ' '; p++);
+  nonce.slen = p - nonce.ptr;
+
+  for (i = 0; i < cache.cnt; i++) {
+    en = &cache.entry[i];
+    if (pj_ansi_strcmp(en->server, server) == 0 && copy_value(en->nonce, &nonce)) {
+      en->nc = 0;
+    }
+  }
+}
+
+/* Remove preemptive credentials from challenged request, so command's
+ * auth session answers challenge as if request was sent without them. */
+static void strip_preemptive (pjsip_rx_data *rdata)
+{
+  pj_str_t key;
+  pjsip_transaction *tsx;
+  pjsip_hdr *hdr;
+
+  if (pjsip_tsx_layer_instance()->id == -1 || rdata->msg_info.cseq == NULL) {
+    return;
+  }
+  if (pjsip_tsx_create_key(rdata->tp_info.pool, &key, PJSIP_ROLE_UAC,
+        &rdata->msg_info.cseq->method, rdata) != PJ_SUCCESS) {
+    return;
+  }
+
+  tsx = pjsip_tsx_layer_find_tsx(&key, PJ_FALSE);
+  if (tsx == NULL || tsx->last_tx == NULL) {
+    return;
+  }
+
+  hdr = tsx->last_tx->mod_data[mod_auth_cache.id];
+  if (hdr && hdr != &skip_mark) {
+    pj_list_erase(hdr);
+    pjsip_tx_data_invalidate_msg(tsx->last_tx);
+    tsx->last_tx->mod_data[mod_auth_cache.id] = NULL;
+    cache.challenged++;
+  }
+}
+
+static pj_bool_t on_rx_response (pjsip_rx_data *rdata)
+{
+  int code = rdata->msg_info.msg->line.status.code;
+  char server[AUTH_SERVER_LEN];
+
+  pj_ansi_snprintf(server, sizeof(server), "%s:%d",
+      rdata->pkt_info.src_name, rdata->pkt_info.src_port);
+
+  if (code == PJSIP_SC_UNAUTHORIZED || code == PJSIP_SC_PROXY_AUTHENTICATION_REQUIRED) {
+    strip_preemptive(rdata);
+    cache_challenges(rdata, server);
+  } else if (code >= 200) {
+    cache_nextnonce(rdata, server);
+  }
+
+  return PJ_FALSE;
+}
+
+/* Add credentials computed from cached challenge. */
+static void add_credentials (struct auth_entry *en, pjsip_tx_data *tdata,
+                             const pjsip_cred_info *cred)
+{
+  pj_pool_t *pool = tdata->pool;
+  pjsip_authorization_hdr *hdr;
+  pjsip_digest_credential *dc;
+  char uri[PJSIP_MAX_URL_SIZE];
+  pj_str_t printed;
+
+  printed.ptr = uri;
+  printed.slen = pjsip_uri_print(PJSIP_URI_IN_REQ_URI, tdata->msg->line.req.uri, uri, sizeof(uri));
+  if (printed.slen <= 0) {
+    return;
+  }
+
+  hdr = en->proxy ? pjsip_proxy_authorization_hdr_create(pool) : pjsip_authorization_hdr_create(pool);
+  hdr->scheme = pj_str("Digest");
+  dc = &hdr->credential.digest;
+  pj_strdup(pool, &dc->username, &cred->username);
+  pj_strdup2(pool, &dc->realm, en->realm);
+  pj_strdup2(pool, &dc->nonce, en->nonce);
+  pj_strdup(pool, &dc->uri, &printed);
+  dc->algorithm = pj_str("MD5");
+  if (en->opaque[0]) {
+    pj_strdup2(pool, &dc->opaque, en->opaque);
+  }
+
+  dc->response.ptr = pj_pool_alloc(pool, PJSIP_MD5STRLEN);
+  if (en->qop_auth) {
+    en->nc++;
+    dc->qop = pj_str("auth");
+    dc->nc.ptr = pj_pool_alloc(pool, 9);
+    dc->nc.slen = pj_ansi_snprintf(dc->nc.ptr, 9, "%08x", en->nc);
+    dc->cnonce.ptr = pj_pool_alloc(pool, 16);
+    pj_create_random_string(dc->cnonce.ptr, 16);
+    dc->cnonce.slen = 16;
+    pjsip_auth_create_digest(&dc->response, &dc->nonce, &dc->nc, &dc->cnonce,
+        &dc->qop, &dc->uri, &dc->realm, cred, &tdata->msg->line.req.method.name);
+  } else {
+    pjsip_auth_create_digest(&dc->response, &dc->nonce, NULL, NULL,
+        NULL, &dc->uri, &dc->realm, cred, &tdata->msg->line.req.method.name);
+  }
+
+  pjsip_msg_add_hdr(tdata->msg, (pjsip_hdr*)hdr);
+  pjsip_tx_data_invalidate_msg(tdata);
+  tdata->mod_data[mod_auth_cache.id] = hdr;
+  cache.sent++;
+}
+
+/* Credentials of process user are only for requests from that user. */
+static pj_bool_t from_cred_user (pjsip_msg *msg, pjsip_cred_info *cred)
+{
+  pjsip_from_hdr *from = PJSIP_MSG_FROM_HDR(msg);
+  pjsip_uri *uri;
+
+  if (from == NULL) {
+    return PJ_FALSE;
+  }
+  uri = pjsip_uri_get_uri(from->uri);
+  if (!PJSIP_URI_SCHEME_IS_SIP(uri) && !PJSIP_URI_SCHEME_IS_SIPS(uri)) {
+    return PJ_FALSE;
+  }
+
+  sippak_set_cred(cache.app, cred);
+
+  return cred->username.slen > 0 &&
+    pj_strcmp(&((pjsip_sip_uri *)uri)->user, &cred->username) == 0;
+}
+
+static pj_status_t on_tx_request (pjsip_tx_data *tdata)
+{
+  pjsip_msg *msg = tdata->msg;
+  struct auth_entry *en;
+  pjsip_cred_info cred;
+  char server[AUTH_SERVER_LEN];
+
+  if (msg->line.req.method.id == PJSIP_ACK_METHOD ||
+      msg->line.req.method.id == PJSIP_CANCEL_METHOD) {
+    return PJ_SUCCESS;
+  }
+
+  // retransmission, answer to challenge or request of dialog with own session
+  if (tdata->mod_data[mod_auth_cache.id] ||
+      pjsip_msg_find_hdr(msg, PJSIP_H_AUTHORIZATION, NULL) ||
+      pjsip_msg_find_hdr(msg, PJSIP_H_PROXY_AUTHORIZATION, NULL)) {
+    return PJ_SUCCESS;
+  }
+
+  pj_ansi_snprintf(server, sizeof(server), "%s:%d",
+      tdata->tp_info.dst_name, tdata->tp_info.dst_port);
+
+  en = entry_find(server, NULL);
+  if (en && en->nonce[0] && from_cred_user(msg, &cred)) {
+    add_credentials(en, tdata, &cred);
+  }
+
+  return PJ_SUCCESS;
+}
+
+PJ_DEF(void) sippak_auth_cache_skip (pjsip_tx_data *tdata)
+{
+  if (mod_auth_cache.id != -1) {
+    tdata->mod_data[mod_auth_cache.id] = &skip_mark;
+  }
+}
+
+/* One entry per line, tab separated: server realm nonce opaque nc qop proxy */
+static void cache_load (const char *path)
+{
+  char line[AUTH_SERVER_LEN + 3 * AUTH_VALUE_LEN + 64];
+  char *field[7], *p;
+  struct auth_entry *en;
+  pj_str_t realm, val;
+  unsigned i;
+  FILE *f = fopen(path, "r");
+
+  if (f == NULL) {
+    return; // first run
+  }
+
+  while (fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    for (i = 0, p = line; i < 7 && p; i++) {
+      field[i] = p;
+      p = strchr(p, '\t');
+      if (p) {
+        *p++ = '\0';
+      }
+    }
+    if (i < 7 || field[0][0] == '\0' || field[2][0] == '\0') {
+      continue;
+    }
+
+    realm = pj_str(field[1]);
+    en = entry_add(field[0], &realm);
+    val = pj_str(field[2]);
+    copy_value(en->nonce, &val);
+    val = pj_str(field[3]);
+    copy_value(en->opaque, &val);
+    en->nc = (pj_uint32_t)strtoul(field[4], NULL, 10);
+    en->qop_auth = field[5][0] == '1';
+    en->proxy = field[6][0] == '1';
+  }
+  fclose(f);
+
+  PJ_LOG(4, (NAME, "Loaded %u cached challenges from %s.", cache.cnt, path));
+}
+
+PJ_DEF(void) sippak_auth_cache_save (struct sippak_app *app)
+{
+  char tmp[PJ_MAXPATH];
+  const char *path = app->cfg.auth_cache;
+  struct auth_entry *en;
+  unsigned i;
+  FILE *f;
+
+  if (cache.app == NULL) {
+    return;
+  }
+
+  if (cache.sent) {
+    PJ_LOG(3, (NAME, "Preemptive credentials sent: %u, challenged anyway: %u.",
+          cache.sent, cache.challenged));
+  }
+
+  if (path == NULL) {
+    return;
+  }
+
+  // write to temporary file and rename, concurrent runs never see partial file
+  pj_ansi_snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  f = fopen(tmp, "w");
+  if (f == NULL) {
+    PJ_LOG(1, (NAME, "Failed to open auth cache file %s.", tmp));
+    return;
+  }
+  for (i = 0; i < cache.cnt; i++) {
+    en = &cache.entry[i];
+    if (en->nonce[0]) {
+      fprintf(f, "%s\t%s\t%s\t%s\t%u\t%d\t%d\n", en->server, en->realm,
+          en->nonce, en->opaque, en->nc, en->qop_auth, en->proxy);
+    }
+  }
+  if (fclose(f) != 0 || rename(tmp, path) != 0) {
+    PJ_LOG(1, (NAME, "Failed to write auth cache file %s.", path));
+  }
+}
+
+PJ_DEF(pj_status_t) sippak_mod_auth_cache_register (struct sippak_app *app)
+{
+  pj_bzero(&cache, sizeof(cache));
+  cache.app = app;
+
+  if (app->cfg.auth_cache) {
+    cache_load(app->cfg.auth_cache);
+  }
+
+  return pjsip_endpt_register_module(app->endpt, &mod_auth_cache);
+}
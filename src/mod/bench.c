@@ -0,0 +1,221 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file bench.c
+ * @brief sippak in-process benchmark over loop transport
+ *
+ * Commands run against serve module in one endpoint connected by pjsip
+ * loop transport, one after another like scenario steps, so request
+ * build, callbacks and loop cancel of every command module are run.
+ * Commands bind loop transport as if previous step had bound it, their
+ * Contact routes in-dialog requests back over loop. Loop transport
+ * without delay delivers message inside send call, so command usually
+ * completes before its event loop starts and no socket or poll is
+ * involved. Command succeeds when final response to its method is 2xx.
+ * Messages are counted when sent, CPU is process time and memory is
+ * growth of pool memory over the run, that holds completed transactions
+ * until their timers expire and clients, dialogs and subscriptions
+ * commands leave.
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+#include <stdio.h>
+#include <time.h>
+#include "sippak.h"
+
+#define NAME "mod_bench"
+
+#define BENCH_URI "sip:" PROJECT_NAME "@127.0.0.1;transport=loop-dgram"
+#define BENCH_POLL 256 // commands between timer polls
+
+static const struct {
+  const char *method;
+  pj_status_t (*run)(struct sippak_app *app);
+} methods[] = {
+  { "OPTIONS", &sippak_cmd_ping },
+  { "REGISTER", &sippak_cmd_register },
+  { "MESSAGE", &sippak_cmd_message },
+  { "PUBLISH", &sippak_cmd_publish },
+  { "SUBSCRIBE", &sippak_cmd_subscribe },
+  { "NOTIFY", &sippak_cmd_notify },
+  { "REFER", &sippak_cmd_refer },
+  { "INVITE", &sippak_cmd_invite },
+};
+
+static struct {
+  const char *method;           // benched method
+  int code;                     // last final response to it
+  pj_uint64_t msgs;             // sent by commands and serve
+} bench;
+
+static pj_status_t on_tx_msg (pjsip_tx_data *tdata)
+{
+  PJ_UNUSED_ARG(tdata);
+  bench.msgs++;
+  return PJ_SUCCESS;
+}
+
+static pj_bool_t on_rx_response (pjsip_rx_data *rdata)
+{
+  int code = rdata->msg_info.msg->line.status.code;
+
+  // responses to in-dialog requests and to NOTIFY of serve are skipped
+  if (code >= 200 && pj_stricmp2(&rdata->msg_info.cseq->method.name, bench.method) == 0) {
+    bench.code = code;
+  }
+  return PJ_FALSE;
+}
+
+static pjsip_module mod_bench =
+{
+  NULL, NULL,                 /* prev, next.    */
+  { "mod-bench", 9 },         /* Name.    */
+  -1,                         /* Id      */
+  PJSIP_MOD_PRIORITY_TRANSPORT_LAYER, /* Priority          */
+  NULL,                       /* load()    */
+  NULL,                       /* start()    */
+  NULL,                       /* stop()    */
+  NULL,                       /* unload()    */
+  NULL,                       /* on_rx_request()  */
+  &on_rx_response,            /* on_rx_response()  */
+  &on_tx_msg,                 /* on_tx_request.  */
+  &on_tx_msg,                 /* on_tx_response()  */
+  NULL,                       /* on_tsx_state()  */
+};
+
+static double cpu_sec (void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Run command once, PJ_TRUE when it got 2xx. */
+static pj_bool_t run_once (struct sippak_app *app, unsigned m)
+{
+  bench.code = 0;
+  if (methods[m].run(app) != PJ_SUCCESS) {
+    return PJ_FALSE;
+  }
+  // answers are delayed with --delay
+  sippak_loop_run(app);
+
+  return bench.code / 100 == 2;
+}
+
+static void report (const char *name, unsigned ok, unsigned failed,
+                    pj_uint64_t msgs, pj_uint32_t usec, double cpu, long mem)
+{
+  printf("%-10s %10u %8u %10llu %12.0f %12.2f %10ld\n", name, ok, failed,
+      (unsigned long long)msgs,
+      usec ? msgs * 1e6 / usec : 0.0,
+      msgs ? cpu * 1e6 / msgs : 0.0,
+      msgs ? mem / (long)msgs : 0);
+}
+
+PJ_DEF(pj_status_t) sippak_cmd_bench (struct sippak_app *app)
+{
+  pj_status_t status;
+  pjsip_transport *loop;
+  pj_time_val zero = {0, 0};
+  pj_timestamp start, now;
+  unsigned count = app->cfg.count > 1 ? app->cfg.count : SIPPAK_BENCH_COUNT;
+  unsigned m, i, ok, failed, total_ok = 0, total_failed = 0;
+  pj_uint64_t msgs, total_msgs = 0;
+  pj_uint32_t usec, total_usec = 0;
+  double cpu, total_cpu = 0;
+  long mem, total_mem = 0;
+
+  if (app->cfg.stateless) {
+    PJ_LOG(1, (NAME, "Bench runs transaction commands, stateless mode is not supported."));
+    return PJ_EINVAL;
+  }
+
+  status = pjsip_loop_start(app->endpt, &loop);
+  SIPPAK_ASSERT_SUCC(status, "Failed to start loop transport.");
+
+  app->tp_pool.cnt = 1;
+  app->tp_pool.ent = pj_pool_calloc(app->pool, 1, sizeof(*app->tp_pool.ent));
+  app->tp_pool.ent[0].host = &loop->local_name.host;
+  app->tp_pool.ent[0].port = loop->local_name.port;
+
+  app->cfg.dest = pj_str(BENCH_URI);
+  app->cfg.contact = pj_str("<" BENCH_URI ">");
+  if (app->cfg.refer_to.slen == 0) {
+    app->cfg.refer_to = app->cfg.dest;
+  }
+
+  status = sippak_serve_start(app, &app->cfg.contact);
+  SIPPAK_ASSERT_SUCC(status, "Failed to start serve module.");
+  app->cmd_mod = NULL; // serve answers all commands
+
+  status = pjsip_endpt_register_module(app->endpt, &mod_bench);
+  SIPPAK_ASSERT_SUCC(status, "Failed to register module mod_bench.");
+
+  printf("%-10s %10s %8s %10s %12s %12s %10s\n", "method", "completed", "failed",
+      "messages", "msg/s", "cpu us/msg", "B/msg");
+
+  for (m = 0; m < PJ_ARRAY_SIZE(methods); m++) {
+    bench.method = methods[m].method;
+    ok = failed = 0;
+    msgs = bench.msgs;
+    mem = (long)app->cp->used_size;
+    cpu = cpu_sec();
+    pj_get_timestamp(&start);
+
+    for (i = 0; i < count; i++) {
+      if (run_once(app, m)) {
+        ok++;
+      } else {
+        failed++;
+      }
+      // expired transactions are freed on long runs
+      if (i % BENCH_POLL == BENCH_POLL - 1) {
+        pjsip_endpt_handle_events(app->endpt, &zero);
+      }
+    }
+
+    pj_get_timestamp(&now);
+    usec = pj_elapsed_usec(&start, &now);
+    cpu = cpu_sec() - cpu;
+    mem = (long)app->cp->used_size - mem;
+    msgs = bench.msgs - msgs;
+    report(methods[m].method, ok, failed, msgs, usec, cpu, mem);
+
+    // like scenario step, next command gets only own responses
+    if (app->cmd_mod) {
+      pjsip_endpt_unregister_module(app->endpt, app->cmd_mod);
+      app->cmd_mod = NULL;
+    }
+
+    total_ok += ok;
+    total_failed += failed;
+    total_msgs += msgs;
+    total_usec += usec;
+    total_cpu += cpu;
+    total_mem += mem;
+  }
+  report("total", total_ok, total_failed, total_msgs, total_usec, total_cpu, total_mem);
+
+  pjsip_endpt_unregister_module(app->endpt, &mod_bench);
+
+  return total_failed ? PJ_EUNKNOWN : PJ_SUCCESS;
+}
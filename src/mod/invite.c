@@ -147,10 +147,10 @@ PJ_DEF(pj_status_t) sippak_cmd_invite (struct sippak_app *app)
   status = sippak_transport_init(app, &local_addr, &local_port);
   SIPPAK_ASSERT_SUCC(status, "Failed to initiate transport.");
 
-  status = pjsip_tsx_layer_init_module(app->endpt);
+  status = sippak_tsx_layer_init(app);
   SIPPAK_ASSERT_SUCC(status, "Failed to initiate transaction layer.");
 
-  status = pjsip_ua_init_module(app->endpt, NULL);
+  status = sippak_ua_layer_init(app);
   SIPPAK_ASSERT_SUCC(status, "Failed to initiate UA module.");
 
   /* Initialize 100rel support */
@@ -162,10 +162,12 @@ PJ_DEF(pj_status_t) sippak_cmd_invite (struct sippak_app *app)
   inv_cb.on_state_changed = &call_on_state_changed;
   inv_cb.on_new_session = &call_on_forked;
   inv_cb.on_tsx_state_changed = &call_tsx_state_changed;
-  status = pjsip_inv_usage_init(app->endpt, &inv_cb);
+  if (pjsip_inv_usage_instance()->id == -1) {
+    status = pjsip_inv_usage_init(app->endpt, &inv_cb);
+  }
   SIPPAK_ASSERT_SUCC(status, "Failed to set invite callback usage functions.");
 
-  status = pjsip_endpt_register_module(app->endpt, &mod_invite);
+  status = sippak_cmd_module_register(app, &mod_invite);
   SIPPAK_ASSERT_SUCC(status, "Failed to register module mod_invite.");
 
   cnt  = sippak_create_contact_hdr(app, local_addr, local_port);
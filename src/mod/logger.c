@@ -32,6 +32,8 @@
 
 #define NAME "mod_logger"
 
+static struct sippak_app *local_app;
+
 static pjsip_module msg_logger = {
     NULL, NULL,                 /* prev, next.    */
     { "mod-logger", 11 },      /* Name.    */
@@ -209,11 +211,63 @@ static void print_sipmsg_headers (const pjsip_msg *msg)
 
 }
 
+/*
+ * Check message against logger filter before anything is formatted.
+ * Responses are matched by CSeq method and status class.
+ * Sampling keeps or drops whole dialogs by Call-ID hash.
+ */
+static pj_bool_t log_filter_match (const pjsip_msg *msg,
+    const pjsip_cid_hdr *cid, const pjsip_cseq_hdr *cseq)
+{
+  unsigned i;
+
+  if (msg->type == PJSIP_RESPONSE_MSG) {
+    unsigned st_class = msg->line.status.code / 100;
+    if (st_class > 6 || !(local_app->cfg.log_filter.status_mask & (1 << st_class))) {
+      return PJ_FALSE;
+    }
+  }
+
+  if (local_app->cfg.log_filter.method_cnt > 0) {
+    const pjsip_method *method = (msg->type == PJSIP_REQUEST_MSG)
+      ? &msg->line.req.method
+      : (cseq ? &cseq->method : NULL);
+    if (method == NULL) {
+      return PJ_FALSE;
+    }
+    for (i = 0; i < local_app->cfg.log_filter.method_cnt; i++) {
+      if (pjsip_method_cmp(method, &local_app->cfg.log_filter.method[i]) == 0) {
+        break;
+      }
+    }
+    if (i == local_app->cfg.log_filter.method_cnt) {
+      return PJ_FALSE;
+    }
+  }
+
+  if (local_app->cfg.log_filter.sample > 1 && cid) {
+    pj_uint32_t hval = pj_hash_calc(0, cid->id.ptr, (unsigned)cid->id.slen);
+    // mix bits, pjlib hash is weak in low bits for similar ids
+    hval ^= hval >> 16;
+    hval *= 0x45d9f3b;
+    hval ^= hval >> 16;
+    if (hval % local_app->cfg.log_filter.sample != 0) {
+      return PJ_FALSE;
+    }
+  }
+
+  return PJ_TRUE;
+}
+
 /* Notification on incoming messages */
 static pj_bool_t logging_on_rx_msg(pjsip_rx_data *rdata)
 {
   pjsip_msg *msg = rdata->msg_info.msg;
 
+  if (!log_filter_match (msg, rdata->msg_info.cid, rdata->msg_info.cseq)) {
+    return PJ_FALSE; // continue with othe modules
+  }
+
   PJ_LOG(3, (PROJECT_NAME, "RX %d bytes %s from %s %s:%d:\n",
         rdata->msg_info.len,
         pjsip_rx_data_get_info(rdata),
@@ -223,6 +277,10 @@ static pj_bool_t logging_on_rx_msg(pjsip_rx_data *rdata)
 
   print_sipmsg_head (msg);
 
+  if (local_app->cfg.log_filter.compact) {
+    return PJ_FALSE; // continue with othe modules
+  }
+
   print_sipmsg_headers (msg);
 
   print_sipmsg_body (msg, PJ_FALSE);
@@ -236,6 +294,11 @@ static pj_bool_t logging_on_rx_msg(pjsip_rx_data *rdata)
 static pj_status_t logging_on_tx_msg(pjsip_tx_data *tdata)
 {
   pjsip_msg *msg = tdata->msg;
+  pjsip_cseq_hdr *cseq = pjsip_msg_find_hdr(msg, PJSIP_H_CSEQ, NULL);
+
+  if (!log_filter_match (msg, PJSIP_MSG_CID_HDR(msg), cseq)) {
+    return PJ_SUCCESS; //continue with other modules
+  }
 
   PJ_LOG(3, (PROJECT_NAME, "TX %d bytes %s to %s %s:%d:\n",
         (tdata->buf.cur - tdata->buf.start),
@@ -246,6 +309,10 @@ static pj_status_t logging_on_tx_msg(pjsip_tx_data *tdata)
 
   print_sipmsg_head (msg);
 
+  if (local_app->cfg.log_filter.compact) {
+    return PJ_SUCCESS; //continue with other modules
+  }
+
   print_sipmsg_headers (msg);
 
   print_sipmsg_body (msg, PJ_TRUE);
@@ -257,6 +324,8 @@ static pj_status_t logging_on_tx_msg(pjsip_tx_data *tdata)
 
 PJ_DEF(pj_status_t) sippak_mod_logger_register(struct sippak_app *app)
 {
+  local_app = app;
+
   ENABLE_COLORS = (app->cfg.log_decor & PJ_LOG_HAS_COLOR)
     ? PJ_TRUE
     : PJ_FALSE;
@@ -30,6 +30,8 @@ static void print_content_type_hdr (const pjsip_msg_body *body);
 static void print_sipmsg_body (pjsip_msg *msg, pj_bool_t is_tx);
 static void print_hdr_clid (pjsip_cid_hdr *cid);
 static void print_trail_chr ();
+static pj_bool_t log_filter_match (const pjsip_msg *msg,
+    const pjsip_cid_hdr *cid, const pjsip_cseq_hdr *cseq);
 
 static pj_bool_t logging_on_rx_msg(pjsip_rx_data *rdata);
 static pj_status_t logging_on_tx_msg(pjsip_tx_data *tdata);
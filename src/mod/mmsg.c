@@ -0,0 +1,271 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file mmsg.c
+ * @brief sippak batched UDP I/O with sendmmsg/recvmmsg
+ *
+ * Works on socket of pjsip UDP transport. Outgoing datagrams are
+ * queued and written with one sendmmsg call per batch. Incoming
+ * datagrams are drained with one recvmmsg call straight into packet
+ * buffers of rx data and handed to transport manager, so parsing and
+ * modules see them as if they came from the UDP transport itself.
+ * Transport is paused while engine owns its socket.
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+#define _GNU_SOURCE
+#include "sippak.h"
+
+#define NAME "mod_mmsg"
+
+#ifdef HAVE_MMSG
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+static struct {
+  pj_pool_t *pool;
+  pj_pool_t *rx_pool;         // parser pool, reset after every packet
+  pjsip_transport *tp;
+  int sock;
+
+  struct mmsghdr tx_hdr[SIPPAK_MMSG_BATCH];
+  struct iovec tx_iov[SIPPAK_MMSG_BATCH];
+  pj_sockaddr tx_addr[SIPPAK_MMSG_BATCH];
+  char *tx_buf[SIPPAK_MMSG_BATCH];
+  pj_size_t tx_max;
+  unsigned tx_cnt;            // queued datagrams
+
+  struct mmsghdr rx_hdr[SIPPAK_MMSG_BATCH];
+  struct iovec rx_iov[SIPPAK_MMSG_BATCH];
+  pjsip_rx_data *rx[SIPPAK_MMSG_BATCH];
+
+  pj_uint64_t tx_calls;
+  pj_uint64_t tx_pkts;
+  pj_uint64_t rx_calls;
+  pj_uint64_t rx_pkts;
+} mm;
+
+static pj_status_t mmsg_flush (void);
+
+static pj_status_t mmsg_init (pjsip_endpoint *endpt, pjsip_transport *tp, pj_size_t tx_max)
+{
+  unsigned i;
+
+  pj_bzero(&mm, sizeof(mm));
+  mm.pool = pjsip_endpt_create_pool(endpt, "mmsg", POOL_INIT, POOL_INCR);
+  mm.rx_pool = pjsip_endpt_create_pool(endpt, "mmsg_rx", PJSIP_POOL_RDATA_LEN, PJSIP_POOL_RDATA_INC);
+  mm.tp = tp;
+  mm.sock = (int)pjsip_udp_transport_get_socket(tp);
+  mm.tx_max = tx_max;
+
+  for (i = 0; i < SIPPAK_MMSG_BATCH; i++) {
+    mm.tx_buf[i] = pj_pool_alloc(mm.pool, tx_max);
+
+    // rx data set up once, like UDP transport does for its own
+    mm.rx[i] = PJ_POOL_ZALLOC_T(mm.pool, pjsip_rx_data);
+    mm.rx[i]->tp_info.pool = mm.rx_pool;
+    mm.rx[i]->tp_info.transport = tp;
+    mm.rx[i]->tp_info.op_key.rdata = mm.rx[i];
+    pj_ioqueue_op_key_init(&mm.rx[i]->tp_info.op_key.op_key, sizeof(pj_ioqueue_op_key_t));
+
+    // one byte is left for parser NULL terminator
+    mm.rx_iov[i].iov_base = mm.rx[i]->pkt_info.packet;
+    mm.rx_iov[i].iov_len = sizeof(mm.rx[i]->pkt_info.packet) - 1;
+  }
+
+  return PJ_SUCCESS;
+}
+
+static char *mmsg_tx_buf (void)
+{
+  if (mm.tx_cnt == SIPPAK_MMSG_BATCH) {
+    mmsg_flush();
+    if (mm.tx_cnt == SIPPAK_MMSG_BATCH) {
+      return NULL; // socket buffer is full
+    }
+  }
+  return mm.tx_buf[mm.tx_cnt];
+}
+
+static void mmsg_tx_push (pj_size_t len, const pj_sockaddr *dst, int dst_len)
+{
+  unsigned i = mm.tx_cnt++;
+
+  pj_memcpy(&mm.tx_addr[i], dst, dst_len);
+  mm.tx_iov[i].iov_base = mm.tx_buf[i];
+  mm.tx_iov[i].iov_len = len;
+  pj_bzero(&mm.tx_hdr[i], sizeof(mm.tx_hdr[i]));
+  mm.tx_hdr[i].msg_hdr.msg_name = &mm.tx_addr[i];
+  mm.tx_hdr[i].msg_hdr.msg_namelen = dst_len;
+  mm.tx_hdr[i].msg_hdr.msg_iov = &mm.tx_iov[i];
+  mm.tx_hdr[i].msg_hdr.msg_iovlen = 1;
+}
+
+/* Move "n" unsent datagrams starting at "from" to queue head. Buffers
+ * are swapped, not copied. */
+static void tx_shift (unsigned from, unsigned n)
+{
+  unsigned i;
+  char *buf;
+
+  for (i = 0; i < n; i++) {
+    buf = mm.tx_buf[i];
+    mm.tx_buf[i] = mm.tx_buf[from + i];
+    mm.tx_buf[from + i] = buf;
+
+    mm.tx_addr[i] = mm.tx_addr[from + i];
+    mm.tx_iov[i].iov_base = mm.tx_buf[i];
+    mm.tx_iov[i].iov_len = mm.tx_iov[from + i].iov_len;
+    mm.tx_hdr[i].msg_hdr.msg_name = &mm.tx_addr[i];
+    mm.tx_hdr[i].msg_hdr.msg_namelen = mm.tx_hdr[from + i].msg_hdr.msg_namelen;
+    mm.tx_hdr[i].msg_hdr.msg_iov = &mm.tx_iov[i];
+  }
+  mm.tx_cnt = n;
+}
+
+static pj_status_t mmsg_flush (void)
+{
+  int sent;
+
+  while (mm.tx_cnt) {
+    sent = sendmmsg(mm.sock, mm.tx_hdr, mm.tx_cnt, MSG_DONTWAIT);
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return PJ_STATUS_FROM_OS(PJ_BLOCKING_ERROR_VAL);
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      // error belongs to first datagram, drop it and keep the rest
+      tx_shift(1, mm.tx_cnt - 1);
+      return PJ_RETURN_OS_ERROR(errno);
+    }
+    if (sent == 0) {
+      return PJ_STATUS_FROM_OS(PJ_BLOCKING_ERROR_VAL);
+    }
+    mm.tx_calls++;
+    mm.tx_pkts += sent;
+    tx_shift(sent, mm.tx_cnt - sent);
+  }
+
+  return PJ_SUCCESS;
+}
+
+/* Waits for socket up to timeout when nothing is there, transport is
+ * paused and endpoint only runs timers. */
+static unsigned mmsg_poll (pj_time_val *timeout)
+{
+  int i, n;
+  pjsip_rx_data *rdata;
+  pjsip_tpmgr *tpmgr = mm.tp->tpmgr;
+  struct pollfd pfd = { mm.sock, POLLIN, 0 };
+
+  for (i = 0; i < SIPPAK_MMSG_BATCH; i++) {
+    mm.rx_hdr[i].msg_hdr.msg_name = &mm.rx[i]->pkt_info.src_addr;
+    mm.rx_hdr[i].msg_hdr.msg_namelen = sizeof(mm.rx[i]->pkt_info.src_addr);
+    mm.rx_hdr[i].msg_hdr.msg_iov = &mm.rx_iov[i];
+    mm.rx_hdr[i].msg_hdr.msg_iovlen = 1;
+    mm.rx_hdr[i].msg_hdr.msg_control = NULL;
+    mm.rx_hdr[i].msg_hdr.msg_controllen = 0;
+    mm.rx_hdr[i].msg_hdr.msg_flags = 0;
+  }
+
+  n = recvmmsg(mm.sock, mm.rx_hdr, SIPPAK_MMSG_BATCH, MSG_DONTWAIT, NULL);
+  if (n <= 0 && timeout && PJ_TIME_VAL_MSEC(*timeout) > 0 &&
+      poll(&pfd, 1, PJ_TIME_VAL_MSEC(*timeout)) > 0) {
+    n = recvmmsg(mm.sock, mm.rx_hdr, SIPPAK_MMSG_BATCH, MSG_DONTWAIT, NULL);
+  }
+  if (timeout) {
+    timeout->sec = 0;
+    timeout->msec = 0;
+  }
+  if (n <= 0) {
+    return 0;
+  }
+  mm.rx_calls++;
+  mm.rx_pkts += n;
+
+  for (i = 0; i < n; i++) {
+    rdata = mm.rx[i];
+    pj_bzero(&rdata->endpt_info, sizeof(rdata->endpt_info));
+    rdata->pkt_info.len = mm.rx_hdr[i].msg_len;
+    rdata->pkt_info.zero = 0;
+    rdata->pkt_info.src_addr_len = mm.rx_hdr[i].msg_hdr.msg_namelen;
+    pj_gettimeofday(&rdata->pkt_info.timestamp);
+    pj_sockaddr_print(&rdata->pkt_info.src_addr, rdata->pkt_info.src_name,
+        sizeof(rdata->pkt_info.src_name), 0);
+    rdata->pkt_info.src_port = pj_sockaddr_get_port(&rdata->pkt_info.src_addr);
+
+    pjsip_tpmgr_receive_packet(tpmgr, rdata);
+    pj_pool_reset(mm.rx_pool);
+  }
+
+  return n;
+}
+
+static void mmsg_report (void)
+{
+  PJ_LOG(3, (NAME, "Batched UDP: sent %llu datagrams in %llu sendmmsg calls, "
+        "received %llu datagrams in %llu recvmmsg calls.",
+        mm.tx_pkts, mm.tx_calls, mm.rx_pkts, mm.rx_calls));
+}
+
+static void mmsg_destroy (void)
+{
+  if (mm.pool) {
+    pj_pool_release(mm.rx_pool);
+    pj_pool_release(mm.pool);
+    mm.pool = NULL;
+  }
+}
+
+#else /* HAVE_MMSG */
+
+static pj_status_t mmsg_init (pjsip_endpoint *endpt, pjsip_transport *tp, pj_size_t tx_max)
+{
+  PJ_UNUSED_ARG(endpt);
+  PJ_UNUSED_ARG(tp);
+  PJ_UNUSED_ARG(tx_max);
+  PJ_LOG(1, (NAME, "sendmmsg/recvmmsg are not available on this platform."));
+  return PJ_ENOTSUP;
+}
+
+static char *mmsg_tx_buf (void) { return NULL; }
+static void mmsg_tx_push (pj_size_t len, const pj_sockaddr *dst, int dst_len) {}
+static pj_status_t mmsg_flush (void) { return PJ_ENOTSUP; }
+static unsigned mmsg_poll (pj_time_val *timeout) { return 0; }
+static void mmsg_report (void) {}
+static void mmsg_destroy (void) {}
+
+#endif /* HAVE_MMSG */
+
+const struct sippak_udp_io sippak_mmsg_io = {
+  "mmsg",
+  &mmsg_init,
+  &mmsg_tx_buf,
+  &mmsg_tx_push,
+  &mmsg_flush,
+  &mmsg_poll,
+  &mmsg_report,
+  &mmsg_destroy
+};
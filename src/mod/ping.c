@@ -30,9 +30,6 @@
 
 #define NAME "mod_ping"
 
-static pjsip_auth_clt_sess auth_sess;
-static int auth_tries = 0;
-
 static pj_bool_t on_rx_response (pjsip_rx_data *rdata);
 
 static pjsip_module mod_ping =
@@ -82,29 +79,21 @@ static void send_cb(void *token, pjsip_event *e)
 {
   pj_status_t status;
   pjsip_tx_data *tdata;
-  pjsip_cred_info	cred[1];
   pjsip_transaction *tsx = e->body.tsx_state.tsx;
   pjsip_rx_data *rdata = e->body.tsx_state.src.rdata;
   struct sippak_app *app = token;
+  if (tsx->status_code == PJSIP_SC_TSX_TIMEOUT) {
+    PJ_LOG(1, (NAME, "Response timeout after %d retransmitions.", tsx->retransmit_count));
+    sippak_loop_cancel();
+    return;
+  }
   if (tsx->status_code == 401 || tsx->status_code == 407) {
-    auth_tries++;
-    if (auth_tries > 1) {
+    status = sippak_auth_reinit_req(app, rdata, tsx->last_tx, &tdata);
+    if (status == PJSIP_EFAILEDCREDENTIAL || status == PJSIP_EAUTHSTALECOUNT) {
       PJ_LOG(1, (NAME, "Authentication failed. Check your username and password"));
       sippak_loop_cancel();
       return;
     }
-    sippak_set_cred(app, cred);
-
-    status = pjsip_auth_clt_init (&auth_sess, app->endpt, rdata->tp_info.pool, 0);
-    if (status != PJ_SUCCESS) {
-      PJ_LOG(1, (NAME, "Failed init authentication credentials."));
-      return;
-    }
-
-    pjsip_auth_clt_set_credentials(&auth_sess, 1, cred);
-
-    status = pjsip_auth_clt_reinit_req(&auth_sess, rdata,
-        tsx->last_tx, &tdata);
     if (status != PJ_SUCCESS) {
       PJ_LOG(1, (NAME, "Failed to re-init client authentication session."));
       return;
@@ -114,25 +103,16 @@ static void send_cb(void *token, pjsip_event *e)
   }
 }
 
-/* Ping */
-PJ_DEF(pj_status_t) sippak_cmd_ping (struct sippak_app *app)
+static pj_status_t create_options (struct sippak_app *app, pj_str_t *local_addr,
+                                   int local_port, pjsip_tx_data **tdata)
 {
-  pj_status_t status;
-  pj_str_t *local_addr;
-  int local_port;
-
-  pjsip_tx_data *tdata = NULL;
-
   pj_str_t cnt, from, ruri;
 
-  status = sippak_transport_init(app, &local_addr, &local_port);
-  SIPPAK_ASSERT_SUCC(status, "Failed to initiate transport.");
-
   cnt  = sippak_create_contact_hdr(app, local_addr, local_port);
   from = sippak_create_from_hdr(app);
   ruri = sippak_create_ruri(app);
 
-  status = pjsip_endpt_create_request(app->endpt,
+  return pjsip_endpt_create_request(app->endpt,
               &pjsip_options_method,  // method OPTIONS
               &ruri,                  // request URI
               &from,                  // from header value
@@ -141,13 +121,63 @@ PJ_DEF(pj_status_t) sippak_cmd_ping (struct sippak_app *app)
               NULL,                   // Call-ID
               -1,                     // CSeq
               NULL,                   // body
-              &tdata);
+              tdata);
+}
+
+/* Send OPTIONS from template without transaction layer, one template
+ * per local source tuple */
+static pj_status_t ping_stateless (struct sippak_app *app)
+{
+  pj_status_t status;
+  pjsip_tx_data *tdata;
+  struct sippak_msg_tpl **tpl;
+  unsigned i;
+
+  tpl = pj_pool_calloc(app->pool, app->tp_pool.cnt, sizeof(*tpl));
+
+  for (i = 0; i < app->tp_pool.cnt; i++) {
+    pj_str_t *local_addr = app->tp_pool.ent[i].host;
+    int local_port = app->tp_pool.ent[i].port;
+
+    status = create_options(app, local_addr, local_port, &tdata);
+    SIPPAK_ASSERT_SUCC(status, "Failed to create endpoint request.");
+
+    status = sippak_msg_tpl_create(app, tdata, local_addr, local_port, &tpl[i]);
+    pjsip_tx_data_dec_ref(tdata);
+    SIPPAK_ASSERT_SUCC(status, "Failed to create request template.");
+  }
+
+  return sippak_stateless_start(app, tpl, 1);
+}
+
+/* Ping */
+PJ_DEF(pj_status_t) sippak_cmd_ping (struct sippak_app *app)
+{
+  pj_status_t status;
+  pj_str_t *local_addr;
+  int local_port;
+
+  pjsip_tx_data *tdata = NULL;
+
+  if (app->cfg.stateless && app->cfg.proto != PJSIP_TRANSPORT_UDP) {
+    PJ_LOG(1, (NAME, "Stateless mode supports only UDP transport."));
+    return PJ_EINVAL;
+  }
+
+  status = sippak_transport_init(app, &local_addr, &local_port);
+  SIPPAK_ASSERT_SUCC(status, "Failed to initiate transport.");
+
+  if (app->cfg.stateless) {
+    return ping_stateless(app);
+  }
+
+  status = create_options(app, local_addr, local_port, &tdata);
   SIPPAK_ASSERT_SUCC(status, "Failed to create endpoint request.");
 
-  status = pjsip_tsx_layer_init_module(app->endpt);
+  status = sippak_tsx_layer_init(app);
   SIPPAK_ASSERT_SUCC(status, "Failed to initiate transaction layer.");
 
-  status = pjsip_endpt_register_module(app->endpt, &mod_ping);
+  status = sippak_cmd_module_register(app, &mod_ping);
   SIPPAK_ASSERT_SUCC(status, "Failed to register module mod_ping.");
 
   return pjsip_endpt_send_request(app->endpt, tdata, -1, app, &send_cb);
@@ -57,14 +57,14 @@ static pj_bool_t on_rx_response (pjsip_rx_data *rdata)
 {
   pjsip_msg *msg = rdata->msg_info.msg;
 
-  auth_tries++;
-
   if (msg->type != PJSIP_RESPONSE_MSG) {
     return PJ_FALSE;
   }
 
+  // publish client answers first challenge with its own auth session
   if (msg->line.status.code == PJSIP_SC_PROXY_AUTHENTICATION_REQUIRED ||
       msg->line.status.code == PJSIP_SC_UNAUTHORIZED) {
+    auth_tries++;
     if (auth_tries > 1) {
       sippak_loop_cancel();
       PJ_LOG(1, (NAME, "Authentication failed. Check your username and password"));
@@ -100,6 +100,8 @@ PJ_DEF(pj_status_t) sippak_cmd_publish (struct sippak_app *app)
   pjsip_cred_info cred[1];
   pj_str_t event;
 
+  auth_tries = 0; // scenario step answers its own challenge
+
   if (app->cfg.event.slen == 0) {
     event = pj_str("presence");
   } else{
@@ -161,10 +163,10 @@ PJ_DEF(pj_status_t) sippak_cmd_publish (struct sippak_app *app)
     status = pjsip_pres_create_pidf(tdata->pool, &pres_status, &pres_id, &tdata->msg->body);
   }
 
-  status = pjsip_tsx_layer_init_module(app->endpt);
+  status = sippak_tsx_layer_init(app);
   SIPPAK_ASSERT_SUCC(status, "Failed to initiate transaction layer.");
 
-  status = pjsip_endpt_register_module(app->endpt, &mod_publish);
+  status = sippak_cmd_module_register(app, &mod_publish);
   SIPPAK_ASSERT_SUCC(status, "Failed to register module mod_publish.");
 
   return pjsip_publishc_send(publish_sess, tdata);
@@ -0,0 +1,114 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file raw.c
+ * @brief sippak send hand-crafted SIP messages from files. Stateless.
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+#include <stdio.h>
+#include "sippak.h"
+
+#define NAME "mod_raw"
+
+static pj_status_t read_file (pj_pool_t *pool, const char *path, pj_str_t *text)
+{
+  FILE *f;
+  long size;
+
+  f = fopen(path, "rb");
+  if (f == NULL) {
+    PJ_LOG(1, (NAME, "Failed to open raw message file %s.", path));
+    return PJ_ENOTFOUND;
+  }
+
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  if (size <= 0 || size > SIPPAK_TPL_MAX_LEN) {
+    PJ_LOG(1, (NAME, "Raw message file %s is empty or longer than %d bytes.",
+          path, SIPPAK_TPL_MAX_LEN));
+    fclose(f);
+    return PJ_ETOOBIG;
+  }
+
+  text->ptr = pj_pool_alloc(pool, size);
+  text->slen = fread(text->ptr, 1, size, f);
+  fclose(f);
+
+  return PJ_SUCCESS;
+}
+
+/* Raw */
+PJ_DEF(pj_status_t) sippak_cmd_raw (struct sippak_app *app)
+{
+  pj_status_t status;
+  pj_str_t *local_addr;
+  int local_port;
+  pj_str_t *text;
+  unsigned i, j, cnt = app->cfg.raw.cnt;
+  struct sippak_msg_tpl **tpl;
+
+  if (app->cfg.raw.cnt == 0) {
+    PJ_LOG(1, (NAME, "RAW command requires message file. Use --file option."));
+    return PJ_EINVAL;
+  }
+
+  if (app->cfg.proto != PJSIP_TRANSPORT_UDP) {
+    PJ_LOG(1, (NAME, "RAW command supports only UDP transport."));
+    return PJ_EINVAL;
+  }
+
+  status = sippak_transport_init(app, &local_addr, &local_port);
+  SIPPAK_ASSERT_SUCC(status, "Failed to initiate transport.");
+
+  text = pj_pool_calloc(app->pool, cnt, sizeof(*text));
+  tpl = pj_pool_calloc(app->pool, cnt * app->tp_pool.cnt, sizeof(*tpl));
+
+  for (i = 0; i < cnt; i++) {
+    const char *path = app->cfg.raw.file[i];
+
+    status = read_file(app->pool, path, &text[i]);
+    if (status != PJ_SUCCESS) {
+      return status;
+    }
+  }
+
+  // every local source tuple has its own set of templates
+  for (j = 0; j < app->tp_pool.cnt; j++) {
+    local_addr = app->tp_pool.ent[j].host;
+    local_port = app->tp_pool.ent[j].port;
+
+    for (i = 0; i < cnt; i++) {
+      const char *path = app->cfg.raw.file[i];
+
+      status = sippak_msg_tpl_load(app, &text[i], local_addr, local_port, &tpl[j * cnt + i]);
+      SIPPAK_ASSERT_SUCC(status, "Failed to load raw message file %s.", path);
+
+      if (j == 0 && !tpl[i]->has_branch) {
+        PJ_LOG(2, (NAME, "No [branch] token in %s. Responses will not be matched.", path));
+      }
+    }
+  }
+
+  return sippak_stateless_start(app, tpl, cnt);
+}
@@ -105,10 +105,10 @@ PJ_DEF(pj_status_t) sippak_cmd_register (struct sippak_app *app)
   status = sippak_transport_init(app, &local_addr, &local_port);
   SIPPAK_ASSERT_SUCC(status, "Failed to initiate transport.");
 
-  status = pjsip_tsx_layer_init_module(app->endpt);
+  status = sippak_tsx_layer_init(app);
   SIPPAK_ASSERT_SUCC(status, "Failed to initiate transaction layer.");
 
-  status = pjsip_endpt_register_module(app->endpt, &mod_register);
+  status = sippak_cmd_module_register(app, &mod_register);
   SIPPAK_ASSERT_SUCC(status, "Failed to register module mod_register.");
 
   status = pjsip_regc_create(app->endpt,
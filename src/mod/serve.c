@@ -0,0 +1,377 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file serve.c
+ * @brief sippak answer incoming requests as UAS
+ *
+ * Requests are answered statelessly, without transaction or dialog
+ * layers, so every request costs one response build and one send.
+ * OPTIONS, MESSAGE, REGISTER, PUBLISH, NOTIFY, BYE and CANCEL get 200,
+ * SUBSCRIBE and REFER get 202, INVITE gets 180 and 200 with SDP built
+ * once at start. 202 of SUBSCRIBE is followed by stateless NOTIFY with
+ * Subscription-State, its response is not awaited. ACK is absorbed, other methods are left to endpoint,
+ * that answers 501. Retransmitted request is
+ * answered again, 2xx of INVITE is not retransmitted. To tag is hash
+ * of Call-ID, so provisional and final responses of INVITE match.
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+#include <signal.h>
+#include <stdlib.h>
+#include <pjsip_ua.h>
+#include <pjsip_simple.h>
+#include "sippak.h"
+
+#define NAME "mod_serve"
+
+struct delayed {
+  pj_timer_entry timer;
+  pjsip_rx_data *rdata;         // cloned request
+  int code;
+};
+
+/* Methods without pjsip id. */
+static const struct {
+  pj_str_t name;
+  int code;
+} other_methods[] = {
+  { { "MESSAGE", 7 }, PJSIP_SC_OK },
+  { { "PUBLISH", 7 }, PJSIP_SC_OK },
+  { { "NOTIFY", 6 }, PJSIP_SC_OK },
+  { { "SUBSCRIBE", 9 }, PJSIP_SC_ACCEPTED },
+  { { "REFER", 5 }, PJSIP_SC_ACCEPTED },
+};
+
+static struct {
+  struct sippak_app *app;
+  pjsip_msg_body *sdp;          // INVITE 200 body
+  pjsip_hdr contact;            // INVITE 2xx headers
+  unsigned long rx, answered, failed;
+} serve;
+
+static pj_bool_t on_rx_request (pjsip_rx_data *rdata);
+
+static pjsip_module mod_serve =
+{
+  NULL, NULL,                 /* prev, next.    */
+  { "mod-serve", 9 },         /* Name.    */
+  -1,                         /* Id      */
+  PJSIP_MOD_PRIORITY_APPLICATION, /* Priority          */
+  NULL,                       /* load()    */
+  NULL,                       /* start()    */
+  NULL,                       /* stop()    */
+  NULL,                       /* unload()    */
+  &on_rx_request,             /* on_rx_request()  */
+  NULL,                       /* on_rx_response()  */
+  NULL,                       /* on_tx_request.  */
+  NULL,                       /* on_tx_response()  */
+  NULL,                       /* on_tsx_state()  */
+};
+
+static void on_signal (int signum)
+{
+  PJ_UNUSED_ARG(signum);
+  sippak_loop_cancel();
+}
+
+/* Success code of served method, 0 if it is not served. */
+static int answer_code (const pjsip_method *method)
+{
+  unsigned i;
+
+  switch (method->id) {
+    case PJSIP_INVITE_METHOD:
+    case PJSIP_OPTIONS_METHOD:
+    case PJSIP_REGISTER_METHOD:
+    case PJSIP_BYE_METHOD:
+    case PJSIP_CANCEL_METHOD:
+      return PJSIP_SC_OK;
+    default:
+      break;
+  }
+  for (i = 0; i < PJ_ARRAY_SIZE(other_methods); i++) {
+    if (pj_stricmp(&method->name, &other_methods[i].name) == 0) {
+      return other_methods[i].code;
+    }
+  }
+  return 0;
+}
+
+/* NOTIFY of subscription accepted with response res, RFC 6665 4.2.1. */
+static pj_status_t create_notify (pjsip_rx_data *rdata, pjsip_tx_data *res,
+                                  pjsip_tx_data **tdata)
+{
+  pjsip_msg *req = rdata->msg_info.msg;
+  pj_str_t event = pj_str("Event");
+  pj_str_t event_short = pj_str("o");
+  pj_str_t hname = pj_str("Subscription-State");
+  pj_str_t state;
+  pjsip_contact_hdr *contact;
+  pjsip_expires_hdr *expires;
+  pjsip_uri *target;
+  pjsip_hdr *hdr;
+  char buf[32];
+  pj_status_t status;
+
+  contact = pjsip_msg_find_hdr(req, PJSIP_H_CONTACT, NULL);
+  target = contact && contact->uri ? contact->uri : rdata->msg_info.from->uri;
+
+  status = pjsip_endpt_create_request_from_hdr(serve.app->endpt,
+      pjsip_get_notify_method(), target, PJSIP_MSG_TO_HDR(res->msg),
+      rdata->msg_info.from, NULL, rdata->msg_info.cid, -1, NULL, tdata);
+  if (status != PJ_SUCCESS) {
+    return status;
+  }
+
+  for (hdr = serve.contact.next; hdr != &serve.contact; hdr = hdr->next) {
+    pjsip_msg_add_hdr((*tdata)->msg, pjsip_hdr_clone((*tdata)->pool, hdr));
+  }
+  hdr = pjsip_msg_find_hdr_by_names(req, &event, &event_short, NULL);
+  if (hdr) {
+    pjsip_msg_add_hdr((*tdata)->msg, pjsip_hdr_clone((*tdata)->pool, hdr));
+  }
+
+  expires = pjsip_msg_find_hdr(req, PJSIP_H_EXPIRES, NULL);
+  if (expires && expires->ivalue == 0) {
+    state = pj_str("terminated;reason=timeout");
+  } else if (expires) {
+    state.ptr = buf;
+    state.slen = pj_ansi_snprintf(buf, sizeof(buf), "active;expires=%u", expires->ivalue);
+  } else {
+    state = pj_str("active");
+  }
+  hdr = (pjsip_hdr*) pjsip_generic_string_hdr_create((*tdata)->pool, &hname, &state);
+  pjsip_msg_add_hdr((*tdata)->msg, hdr);
+
+  return PJ_SUCCESS;
+}
+
+static void respond (pjsip_rx_data *rdata, int code)
+{
+  pjsip_endpoint *endpt = serve.app->endpt;
+  pjsip_msg *req = rdata->msg_info.msg;
+  pjsip_method *method = &req->line.req.method;
+  pjsip_tx_data *tdata, *notify = NULL;
+  pjsip_response_addr res_addr;
+  pjsip_to_hdr *to;
+  pjsip_hdr *hdr;
+  char tag[9];
+  pj_status_t status;
+
+  status = pjsip_endpt_create_response(endpt, rdata, code, NULL, &tdata);
+  if (status != PJ_SUCCESS) {
+    return;
+  }
+
+  to = PJSIP_MSG_TO_HDR(tdata->msg);
+  if (to->tag.slen == 0) {
+    pj_ansi_snprintf(tag, sizeof(tag), "%08x",
+        pj_hash_calc(0, rdata->msg_info.cid->id.ptr, rdata->msg_info.cid->id.slen));
+    pj_strdup2(tdata->pool, &to->tag, tag);
+  }
+
+  if (code / 100 == 2 && method->id == PJSIP_REGISTER_METHOD) {
+    // registrar echoes bindings
+    hdr = pjsip_msg_find_hdr(req, PJSIP_H_CONTACT, NULL);
+    while (hdr) {
+      pjsip_msg_add_hdr(tdata->msg, pjsip_hdr_clone(tdata->pool, hdr));
+      hdr = pjsip_msg_find_hdr(req, PJSIP_H_CONTACT, hdr->next);
+    }
+  } else if (code / 100 == 2 &&
+      (method->id == PJSIP_INVITE_METHOD || code == PJSIP_SC_ACCEPTED)) {
+    // dialog is established by INVITE, SUBSCRIBE and REFER
+    for (hdr = serve.contact.next; hdr != &serve.contact; hdr = hdr->next) {
+      pjsip_msg_add_hdr(tdata->msg, pjsip_hdr_clone(tdata->pool, hdr));
+    }
+  }
+  if (code / 100 == 2 && method->id == PJSIP_INVITE_METHOD) {
+    tdata->msg->body = pjsip_msg_body_clone(tdata->pool, serve.sdp);
+  }
+  if (code / 100 == 2 && method->id != PJSIP_INVITE_METHOD) {
+    hdr = pjsip_msg_find_hdr(req, PJSIP_H_EXPIRES, NULL);
+    if (hdr) {
+      pjsip_msg_add_hdr(tdata->msg, pjsip_hdr_clone(tdata->pool, hdr));
+    }
+  }
+
+  // built before response is sent, that releases it
+  if (code / 100 == 2 && pjsip_method_cmp(method, pjsip_get_subscribe_method()) == 0 &&
+      create_notify(rdata, tdata, &notify) != PJ_SUCCESS) {
+    notify = NULL;
+  }
+
+  status = pjsip_get_response_addr(tdata->pool, rdata, &res_addr);
+  if (status == PJ_SUCCESS) {
+    status = pjsip_endpt_send_response(endpt, &res_addr, tdata, NULL, NULL);
+  }
+  if (status != PJ_SUCCESS) {
+    pjsip_tx_data_dec_ref(tdata);
+    if (notify) {
+      pjsip_tx_data_dec_ref(notify);
+    }
+    return;
+  }
+  if (notify) {
+    pjsip_endpt_send_request_stateless(endpt, notify, NULL, NULL);
+  }
+
+  if (code >= 200) {
+    if (code < 300) {
+      serve.answered++;
+    } else {
+      serve.failed++;
+    }
+  }
+}
+
+static void on_delay (pj_timer_heap_t *ht, pj_timer_entry *entry)
+{
+  struct delayed *d = entry->user_data;
+
+  PJ_UNUSED_ARG(ht);
+  respond(d->rdata, d->code);
+  // entry lives in pool of cloned request
+  pjsip_rx_data_free_cloned(d->rdata);
+}
+
+static void final_response (pjsip_rx_data *rdata, int code)
+{
+  pj_time_val delay;
+  pjsip_rx_data *clone;
+  struct delayed *d;
+
+  if (serve.app->cfg.serve.delay == 0 ||
+      pjsip_rx_data_clone(rdata, 0, &clone) != PJ_SUCCESS) {
+    respond(rdata, code);
+    return;
+  }
+
+  d = PJ_POOL_ZALLOC_T(clone->tp_info.pool, struct delayed);
+  d->rdata = clone;
+  d->code = code;
+  pj_timer_entry_init(&d->timer, 0, d, &on_delay);
+
+  delay.sec = serve.app->cfg.serve.delay / 1000;
+  delay.msec = serve.app->cfg.serve.delay % 1000;
+  if (pjsip_endpt_schedule_timer(serve.app->endpt, &d->timer, &delay) != PJ_SUCCESS) {
+    respond(clone, code);
+    pjsip_rx_data_free_cloned(clone);
+  }
+}
+
+static pj_bool_t on_rx_request (pjsip_rx_data *rdata)
+{
+  struct sippak_app *app = serve.app;
+  pjsip_method *method = &rdata->msg_info.msg->line.req.method;
+  int code;
+
+  if (method->id == PJSIP_ACK_METHOD) {
+    return PJ_TRUE;
+  }
+  code = answer_code(method);
+  if (code == 0) {
+    return PJ_FALSE; // endpoint answers 501
+  }
+  serve.rx++;
+
+  if (app->cfg.serve.fail_ratio > 0 &&
+      (unsigned)(pj_rand() % 100) < app->cfg.serve.fail_ratio) {
+    final_response(rdata, app->cfg.serve.fail_code);
+    return PJ_TRUE;
+  }
+
+  if (method->id == PJSIP_INVITE_METHOD) {
+    respond(rdata, PJSIP_SC_RINGING);
+  }
+  final_response(rdata, code);
+
+  return PJ_TRUE;
+}
+
+PJ_DEF(pj_status_t) sippak_serve_start (struct sippak_app *app,
+                                        const pj_str_t *contact)
+{
+  pj_status_t status;
+  pj_str_t hname = pj_str("Contact");
+  pjsip_hdr *hdr;
+  pjmedia_sdp_session *sdp_sess;
+
+  serve.app = app;
+  serve.rx = serve.answered = serve.failed = 0;
+  pj_list_init(&serve.contact);
+
+  hdr = pjsip_parse_hdr(app->pool, &hname, contact->ptr, contact->slen, NULL);
+  if (hdr == NULL) {
+    PJ_LOG(1, (NAME, "Invalid contact: %.*s", (int)contact->slen, contact->ptr));
+    return PJ_EINVAL;
+  }
+  pj_list_push_back(&serve.contact, hdr);
+
+  status = sippak_set_media_sdp (app, &sdp_sess);
+  SIPPAK_ASSERT_SUCC(status, "Failed to set media SDP.");
+
+  status = pjsip_create_sdp_body(app->pool, sdp_sess, &serve.sdp);
+  SIPPAK_ASSERT_SUCC(status, "Failed to create SDP body.");
+
+  status = sippak_cmd_module_register(app, &mod_serve);
+  SIPPAK_ASSERT_SUCC(status, "Failed to register module mod_serve.");
+
+  return PJ_SUCCESS;
+}
+
+/* Serve */
+PJ_DEF(pj_status_t) sippak_cmd_serve (struct sippak_app *app)
+{
+  pj_status_t status;
+  pj_str_t *local_addr;
+  int local_port;
+  pj_str_t cnt;
+
+  status = sippak_transport_init(app, &local_addr, &local_port);
+  SIPPAK_ASSERT_SUCC(status, "Failed to initiate transport.");
+
+  if (app->cfg.username.slen == 0) {
+    app->cfg.username = pj_str(PROJECT_NAME);
+  }
+  cnt = sippak_create_contact_hdr(app, local_addr, local_port);
+
+  status = sippak_serve_start(app, &cnt);
+  if (status != PJ_SUCCESS) {
+    return status;
+  }
+
+  signal(SIGINT, &on_signal);
+  signal(SIGTERM, &on_signal);
+
+  PJ_LOG(3, (NAME, "Serving on %.*s:%d", (int)local_addr->slen, local_addr->ptr, local_port));
+
+  return PJ_SUCCESS;
+}
+
+/* Summary when loop is stopped. */
+PJ_DEF(void) sippak_serve_report (struct sippak_app *app)
+{
+  if (app->cfg.cmd != CMD_SERVE) {
+    return;
+  }
+  PJ_LOG(3, (NAME, "Requests: %lu, answered: %lu, failed: %lu",
+        serve.rx, serve.answered, serve.failed));
+}
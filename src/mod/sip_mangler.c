@@ -50,7 +50,13 @@ static pjsip_module mod_sip_mangler =
 
 static pj_status_t on_tx_request(pjsip_tx_data *tdata)
 {
-  sippak_add_sip_headers (tdata, local_app);
+  // retransmissions and re-sent requests already have headers
+  if (tdata->mod_data[mod_sip_mangler.id] == NULL) {
+    sippak_add_sip_headers (tdata, local_app);
+    tdata->mod_data[mod_sip_mangler.id] = local_app;
+  }
+
+  sippak_timing_tx_request (tdata);
 
   return PJ_SUCCESS;
 }
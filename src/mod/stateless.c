@@ -0,0 +1,957 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file stateless.c
+ * @brief sippak high rate requests without transaction layer
+ *
+ * Requests are rendered from templates, round robin when there are
+ * many, and written to UDP transport socket directly. In flight
+ * requests live in array indexed by send sequence number. Responses
+ * are matched with open addressing hash table keyed on sequence number
+ * decoded from Via branch. Retransmissions and timeouts are driven by
+ * hashed timer wheel. With --mmsg or --uring requests and responses
+ * go through batched UDP I/O backend instead of one call per packet.
+ *
+ * With --rate every request has its own send slot. When next slot is
+ * closer than main loop can sleep precisely, engine waits for it with
+ * pacer, which returns early if response arrives.
+ *
+ * With --threads every worker thread runs its own engine on socket of
+ * its own source tuple, bound to own local port. Worker N owns
+ * sequence numbers N, N + threads, N + 2 * threads... and so Call-IDs
+ * derived from them, and sends them with Via of its port, so replies
+ * come back to its socket and workers read in parallel. pjsip stops
+ * reading worker sockets while engines run. Response that still
+ * arrives on other socket is passed to owner through its inbox.
+ *
+ * With local address list or port range requests are spread round
+ * robin over transports of every source tuple, each with its own
+ * templates. Responses come back through the transports.
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+#include <string.h>
+#include <sys/socket.h>
+#include "sippak.h"
+
+#define NAME "mod_stateless"
+
+#define SL_BATCH 64           // max requests sent in one poll
+#define SL_TICK_MS 10         // timer wheel resolution
+#define SL_WHEEL_SIZE 1024    // timer wheel buckets, power of two
+#define SL_INBOX_SIZE 4096    // responses passed between workers, power of two
+#define SL_PACE_WINDOW 2000000 // nsec before send slot engine waits on pacer
+#define SL_NIL 0xffffffff
+
+enum sl_state {
+  SL_FREE = 0,
+  SL_SENT,
+  SL_PROVIS                   // provisional received, retransmit with T2
+};
+
+/* in flight request */
+struct sl_slot {
+  pj_uint64_t seq;
+  pj_timestamp sent;          // first transmission
+  pj_uint32_t due;            // tick of next retransmission or timeout
+  pj_uint32_t expire;         // tick of transaction timeout, 64*T1
+  pj_uint32_t next;           // timer wheel bucket links
+  pj_uint32_t prev;
+  pj_uint16_t retrans;
+  pj_uint16_t state;
+};
+
+struct sl_hent {
+  pj_uint64_t key;            // send sequence number
+  pj_uint32_t slot;           // SL_NIL when empty
+};
+
+/* response received by thread that does not own it */
+struct sl_msg {
+  pj_uint64_t seq;
+  pj_timestamp ts;
+  int code;
+};
+
+/* sender and matcher, one per worker thread */
+struct sl_engine {
+  unsigned id;
+  pj_pool_t *pool;
+  pj_sock_t sock;
+  char *buf;                  // render buffer
+  const struct sippak_udp_io *io; // NULL writes to socket directly
+
+  struct sl_slot *slot;       // indexed by local send counter & slot_mask
+  pj_uint32_t slot_mask;
+  struct sl_hent *ht;
+  pj_uint32_t ht_mask;
+  unsigned ht_bits;
+  pj_uint32_t wheel[SL_WHEEL_SIZE];
+  pj_uint32_t tick;           // last processed tick
+
+  pj_uint64_t total;          // requests this engine sends
+  pj_uint64_t sent;           // requests sent by this engine
+  pj_uint32_t inflight;
+  pj_bool_t done;
+
+  pj_uint32_t resp[6];        // by class 1xx to 6xx
+  pj_uint32_t retrans;
+  pj_uint32_t timeouts;
+  pj_uint32_t rtt_cnt;
+  pj_uint32_t rtt_min;        // usec
+  pj_uint32_t rtt_max;
+  pj_uint64_t rtt_sum;
+  pj_uint64_t rx;             // datagrams read from own socket
+  pj_uint64_t handoff;        // of them passed to other workers
+  struct sippak_pacer pacer;  // with --rate only
+
+  pj_thread_t *thread;
+  pj_mutex_t *inbox_lock;
+  struct sl_msg *inbox;
+  unsigned inbox_head;
+  unsigned inbox_cnt;
+  unsigned inbox_drop;
+};
+
+static struct {
+  struct sippak_app *app;
+  struct sippak_msg_tpl **tpl;  // tpl_cnt per source tuple
+  unsigned tpl_cnt;
+  pj_sock_t *src_sock;        // socket of every source tuple
+  unsigned src_cnt;
+  pj_pool_t *pool;
+  pj_sockaddr dst;
+  int dst_len;
+
+  pj_uint32_t t1;             // timers in ticks
+  pj_uint32_t t2;
+  pj_uint32_t timeout;
+
+  pj_timestamp start;
+  pj_uint64_t total;          // requests to send by all engines
+  struct sl_engine *eng;
+  unsigned eng_cnt;
+  pj_bool_t threaded;
+  unsigned eng_done;          // engines finished, atomic
+  pj_bool_t done;
+} sl;
+
+static pj_bool_t on_rx_response (pjsip_rx_data *rdata);
+
+static pjsip_module mod_stateless =
+{
+  NULL, NULL,                 /* prev, next.    */
+  { "mod-stateless", 13 },    /* Name.    */
+  -1,                         /* Id      */
+  PJSIP_MOD_PRIORITY_TRANSPORT_LAYER, /* Priority          */
+  NULL,                       /* load()    */
+  NULL,                       /* start()    */
+  NULL,                       /* stop()    */
+  NULL,                       /* unload()    */
+  NULL,                       /* on_rx_request()  */
+  &on_rx_response,            /* on_rx_response()  */
+  NULL,                       /* on_tx_request.  */
+  NULL,                       /* on_tx_response()  */
+  NULL,                       /* on_tsx_state()  */
+};
+
+/* Fibonacci hashing, sequence numbers are dense so multiply spreads them */
+static pj_uint32_t ht_home (struct sl_engine *e, pj_uint64_t key)
+{
+  return (pj_uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> (64 - e->ht_bits));
+}
+
+static void ht_insert (struct sl_engine *e, pj_uint64_t key, pj_uint32_t slot)
+{
+  pj_uint32_t i = ht_home(e, key);
+
+  while (e->ht[i].slot != SL_NIL) {
+    i = (i + 1) & e->ht_mask;
+  }
+  e->ht[i].key = key;
+  e->ht[i].slot = slot;
+}
+
+static pj_uint32_t ht_find (struct sl_engine *e, pj_uint64_t key)
+{
+  pj_uint32_t i = ht_home(e, key);
+
+  while (e->ht[i].slot != SL_NIL) {
+    if (e->ht[i].key == key) {
+      return i;
+    }
+    i = (i + 1) & e->ht_mask;
+  }
+  return SL_NIL;
+}
+
+/* Backward shift deletion, no tombstones, probe chains stay short. */
+static void ht_remove (struct sl_engine *e, pj_uint32_t i)
+{
+  pj_uint32_t j = i;
+
+  for (;;) {
+    j = (j + 1) & e->ht_mask;
+    if (e->ht[j].slot == SL_NIL) {
+      break;
+    }
+    // entry can fill the hole only if its home is not in (i, j]
+    if (((j - ht_home(e, e->ht[j].key)) & e->ht_mask) >= ((j - i) & e->ht_mask)) {
+      e->ht[i] = e->ht[j];
+      i = j;
+    }
+  }
+  e->ht[i].slot = SL_NIL;
+}
+
+static void wheel_add (struct sl_engine *e, pj_uint32_t s, pj_uint32_t due)
+{
+  pj_uint32_t *head = &e->wheel[due & (SL_WHEEL_SIZE - 1)];
+  struct sl_slot *sp = &e->slot[s];
+
+  sp->due = due;
+  sp->prev = SL_NIL;
+  sp->next = *head;
+  if (*head != SL_NIL) {
+    e->slot[*head].prev = s;
+  }
+  *head = s;
+}
+
+static void wheel_del (struct sl_engine *e, pj_uint32_t s)
+{
+  struct sl_slot *sp = &e->slot[s];
+
+  if (sp->prev != SL_NIL) {
+    e->slot[sp->prev].next = sp->next;
+  } else {
+    e->wheel[sp->due & (SL_WHEEL_SIZE - 1)] = sp->next;
+  }
+  if (sp->next != SL_NIL) {
+    e->slot[sp->next].prev = sp->prev;
+  }
+}
+
+/* Template of sequence number: source tuple, then round robin in its templates. */
+static struct sippak_msg_tpl *seq_tpl (pj_uint64_t seq)
+{
+  unsigned src = (unsigned)(seq % sl.src_cnt);
+
+  return sl.tpl[src * sl.tpl_cnt + (seq / sl.src_cnt) % sl.tpl_cnt];
+}
+
+static pj_status_t send_seq (struct sl_engine *e, pj_uint64_t seq,
+                             struct sippak_msg_tpl *tpl)
+{
+  char *buf = e->buf;
+  pj_ssize_t len;
+  unsigned src = (unsigned)(seq % sl.src_cnt);
+
+  if (e->io) {
+    buf = e->io->tx_buf();
+    if (buf == NULL) {
+      return PJ_STATUS_FROM_OS(PJ_BLOCKING_ERROR_VAL);
+    }
+  }
+
+  len = sippak_msg_tpl_render(tpl, seq, (pj_uint32_t)(seq % 0x7fffffff) + 1, buf);
+
+  // queued, sent on flush at the end of poll
+  if (e->io) {
+    e->io->tx_push(len, &sl.dst, sl.dst_len);
+    return PJ_SUCCESS;
+  }
+
+  if (sl.src_cnt > 1) {
+    return pj_sock_sendto(sl.src_sock[src], buf, &len, 0, &sl.dst, sl.dst_len);
+  }
+  return pj_sock_sendto(e->sock, buf, &len, 0, &sl.dst, sl.dst_len);
+}
+
+/* "h" is hash table index of slot or SL_NIL to look it up */
+static void slot_release (struct sl_engine *e, pj_uint32_t s, pj_uint32_t h)
+{
+  struct sl_slot *sp = &e->slot[s];
+
+  if (h == SL_NIL) {
+    h = ht_find(e, sp->seq);
+  }
+  if (h != SL_NIL) {
+    ht_remove(e, h);
+  }
+  wheel_del(e, s);
+  sp->state = SL_FREE;
+  e->inflight--;
+}
+
+static void slot_timeout (struct sl_engine *e, pj_uint32_t s)
+{
+  e->timeouts++;
+  sippak_timeseries_timeout();
+  slot_release(e, s, SL_NIL);
+}
+
+static pj_status_t send_next (struct sl_engine *e, pj_uint32_t tick)
+{
+  pj_status_t status;
+  pj_uint64_t seq = e->sent * sl.eng_cnt + e->id;
+  pj_uint32_t s = (pj_uint32_t)(e->sent & e->slot_mask);
+  struct sl_slot *sp = &e->slot[s];
+  struct sippak_msg_tpl *tpl = seq_tpl(seq);
+
+  // window is full, oldest request is given up
+  if (sp->state != SL_FREE) {
+    slot_timeout(e, s);
+  }
+
+  status = send_seq(e, seq, tpl);
+  if (status != PJ_SUCCESS) {
+    return status;
+  }
+
+  // no branch to match responses with, fire and forget
+  if (!tpl->has_branch) {
+    e->sent++;
+    sippak_timeseries_sent();
+    return PJ_SUCCESS;
+  }
+
+  sp->seq = seq;
+  pj_get_timestamp(&sp->sent);
+  sp->retrans = 0;
+  sp->state = SL_SENT;
+  sp->expire = tick + sl.timeout;
+  wheel_add(e, s, sl.app->cfg.retrans ? tick + sl.t1 : sp->expire);
+  ht_insert(e, seq, s);
+
+  e->sent++;
+  e->inflight++;
+  sippak_timeseries_sent();
+
+  return PJ_SUCCESS;
+}
+
+static void wheel_advance (struct sl_engine *e, pj_uint32_t now)
+{
+  pj_uint32_t s, next, interval;
+  struct sl_slot *sp;
+
+  while (e->tick != now) {
+    e->tick++;
+    for (s = e->wheel[e->tick & (SL_WHEEL_SIZE - 1)]; s != SL_NIL; s = next) {
+      sp = &e->slot[s];
+      next = sp->next;
+
+      if (sp->due != e->tick) {
+        continue; // later round
+      }
+      if (e->tick >= sp->expire) {
+        slot_timeout(e, s);
+        continue;
+      }
+
+      if (send_seq(e, sp->seq, seq_tpl(sp->seq)) == PJ_SUCCESS) {
+        sp->retrans++;
+        e->retrans++;
+        sippak_timeseries_retrans();
+      }
+
+      if (sp->state == SL_PROVIS || sp->retrans >= 31 || (sl.t1 << sp->retrans) > sl.t2) {
+        interval = sl.t2;
+      } else {
+        interval = sl.t1 << sp->retrans;
+      }
+      wheel_del(e, s);
+      wheel_add(e, s, PJ_MIN(e->tick + interval, sp->expire));
+    }
+  }
+}
+
+static void sl_report (void)
+{
+  pj_timestamp now;
+  pj_uint64_t ms, sent = 0, rtt_sum = 0;
+  pj_uint32_t resp[6] = {0}, retrans = 0, timeouts = 0;
+  struct sippak_pacer pacer;
+  pj_uint32_t rtt_cnt = 0, rtt_min = 0, rtt_max = 0;
+  unsigned i, c;
+
+  pj_get_timestamp(&now);
+  ms = pj_elapsed_msec64(&sl.start, &now);
+  pj_bzero(&pacer, sizeof(pacer));
+
+  for (i = 0; i < sl.eng_cnt; i++) {
+    struct sl_engine *e = &sl.eng[i];
+
+    sippak_pacer_merge(&pacer, &e->pacer);
+
+    sent += e->sent;
+    for (c = 0; c < 6; c++) {
+      resp[c] += e->resp[c];
+    }
+    retrans += e->retrans;
+    timeouts += e->timeouts;
+    if (e->rtt_cnt && (rtt_cnt == 0 || e->rtt_min < rtt_min)) {
+      rtt_min = e->rtt_min;
+    }
+    rtt_max = PJ_MAX(rtt_max, e->rtt_max);
+    rtt_cnt += e->rtt_cnt;
+    rtt_sum += e->rtt_sum;
+
+    if (sl.threaded) {
+      PJ_LOG(3, (NAME, "Worker %u: sent %llu, final responses %u, read from own socket %llu, "
+            "passed to other workers %llu, inbox drops %u.",
+            e->id, e->sent, e->rtt_cnt, e->rx, e->handoff, e->inbox_drop));
+    }
+  }
+
+  PJ_LOG(3, (NAME, "Sent %llu requests in %llu ms, %llu req/s.",
+        sent, ms, ms ? sent * 1000 / ms : sent));
+  PJ_LOG(3, (NAME, "Responses 1xx: %u, 2xx: %u, 3xx: %u, 4xx: %u, 5xx: %u, 6xx: %u. "
+        "Retransmissions: %u, timeouts: %u.",
+        resp[0], resp[1], resp[2], resp[3], resp[4], resp[5],
+        retrans, timeouts));
+  if (rtt_cnt) {
+    pj_uint32_t avg = (pj_uint32_t)(rtt_sum / rtt_cnt);
+    PJ_LOG(3, (NAME, "Final response time min/avg/max: %u.%03u/%u.%03u/%u.%03u ms",
+          rtt_min / 1000, rtt_min % 1000,
+          avg / 1000, avg % 1000,
+          rtt_max / 1000, rtt_max % 1000));
+  }
+  if (sl.app->cfg.rate) {
+    sippak_pacer_report(&pacer);
+  }
+  if (sl.eng[0].io) {
+    sl.eng[0].io->report();
+  }
+}
+
+/* Response to request sent by engine "e". */
+static void sl_response (struct sl_engine *e, pj_uint64_t seq, int code, const pj_timestamp *now)
+{
+  pj_uint32_t h, s, rtt;
+
+  h = ht_find(e, seq);
+  if (h == SL_NIL) {
+    return; // late or duplicate response
+  }
+  s = e->ht[h].slot;
+
+  rtt = pj_elapsed_usec(&e->slot[s].sent, now);
+  sippak_timeseries_response(code, rtt);
+
+  if (code >= 100 && code <= 699) {
+    e->resp[code / 100 - 1]++;
+  }
+  if (code < 200) {
+    e->slot[s].state = SL_PROVIS;
+    return;
+  }
+
+  if (e->rtt_cnt == 0 || rtt < e->rtt_min) {
+    e->rtt_min = rtt;
+  }
+  if (rtt > e->rtt_max) {
+    e->rtt_max = rtt;
+  }
+  e->rtt_sum += rtt;
+  e->rtt_cnt++;
+
+  slot_release(e, s, h);
+}
+
+static void inbox_post (struct sl_engine *e, pj_uint64_t seq, int code, const pj_timestamp *ts)
+{
+  struct sl_msg *m;
+
+  pj_mutex_lock(e->inbox_lock);
+  if (e->inbox_cnt == SL_INBOX_SIZE) {
+    e->inbox_drop++;
+  } else {
+    m = &e->inbox[(e->inbox_head + e->inbox_cnt++) & (SL_INBOX_SIZE - 1)];
+    m->seq = seq;
+    m->code = code;
+    m->ts = *ts;
+  }
+  pj_mutex_unlock(e->inbox_lock);
+}
+
+/* Responses are copied out in batches, lock is not held while matching. */
+static void inbox_drain (struct sl_engine *e)
+{
+  struct sl_msg msg[SL_BATCH];
+  unsigned i, n;
+
+  do {
+    pj_mutex_lock(e->inbox_lock);
+    n = PJ_MIN(e->inbox_cnt, SL_BATCH);
+    for (i = 0; i < n; i++) {
+      msg[i] = e->inbox[(e->inbox_head + i) & (SL_INBOX_SIZE - 1)];
+    }
+    e->inbox_head = (e->inbox_head + n) & (SL_INBOX_SIZE - 1);
+    e->inbox_cnt -= n;
+    pj_mutex_unlock(e->inbox_lock);
+
+    for (i = 0; i < n; i++) {
+      sl_response(e, msg[i].seq, msg[i].code, &msg[i].ts);
+    }
+  } while (n == SL_BATCH);
+}
+
+/* Response read by engine "e", or by transport when "e" is NULL.
+ * Returns PJ_FALSE when branch is not ours. */
+static pj_bool_t sl_dispatch (struct sl_engine *e, const pj_str_t *branch, int code)
+{
+  pj_uint64_t seq;
+  pj_timestamp now;
+  struct sl_engine *owner;
+
+  // all templates share salt, any of them decodes branch
+  if (!sippak_msg_tpl_match(sl.tpl[0], branch, &seq)) {
+    return PJ_FALSE;
+  }
+  if (sl.done) {
+    return PJ_TRUE; // workers are gone, late response
+  }
+  pj_get_timestamp(&now);
+
+  owner = &sl.eng[seq % sl.eng_cnt];
+  if (!sl.threaded || owner == e) {
+    sl_response(owner, seq, code, &now);
+    return PJ_TRUE;
+  }
+  if (e) {
+    e->handoff++;
+  }
+  inbox_post(owner, seq, code, &now);
+
+  return PJ_TRUE;
+}
+
+static pj_bool_t on_rx_response (pjsip_rx_data *rdata)
+{
+  pjsip_via_hdr *via = rdata->msg_info.via;
+
+  if (via == NULL) {
+    return PJ_FALSE;
+  }
+  return sl_dispatch(NULL, &via->branch_param, rdata->msg_info.msg->line.status.code);
+}
+
+/* Status code and top Via branch of response without full parse. */
+static pj_bool_t scan_response (char *buf, pj_ssize_t len, int *code, pj_str_t *branch)
+{
+  char *p = buf, *end = buf + len, *eol, *b;
+
+  if (len < 12 || pj_memcmp(buf, "SIP/2.0 ", 8) != 0 ||
+      !pj_isdigit(buf[8]) || !pj_isdigit(buf[9]) || !pj_isdigit(buf[10])) {
+    return PJ_FALSE;
+  }
+  *code = (buf[8] - '0') * 100 + (buf[9] - '0') * 10 + (buf[10] - '0');
+
+  for (;;) {
+    p = memchr(p, '\n', end - p);
+    if (p == NULL || ++p >= end || *p == '\r' || *p == '\n') {
+      return PJ_FALSE; // end of headers
+    }
+    eol = memchr(p, '\n', end - p);
+    if (eol == NULL) {
+      eol = end;
+    }
+
+    // "Via:" or compact "v:"
+    if (pj_tolower(*p) != 'v') {
+      continue;
+    }
+    b = p + 1;
+    if (eol - b >= 2 && pj_tolower(b[0]) == 'i' && pj_tolower(b[1]) == 'a') {
+      b += 2;
+    }
+    while (b < eol && (*b == ' ' || *b == '\t')) {
+      b++;
+    }
+    if (b == eol || *b != ':') {
+      continue;
+    }
+
+    for (; b + 7 < eol; b++) {
+      if (pj_memcmp(b, "branch=", 7) == 0) {
+        branch->ptr = b + 7;
+        for (b += 7; b < eol && *b != ';' && *b != ',' && *b != ' ' && *b != '\r'; b++);
+        branch->slen = b - branch->ptr;
+        return PJ_TRUE;
+      }
+    }
+    return PJ_FALSE;
+  }
+}
+
+/* Wait up to timeout for worker socket and read what is there. */
+static void worker_recv (struct sl_engine *e, const pj_time_val *timeout)
+{
+  pj_fd_set_t rset;
+  pj_ssize_t len;
+  pj_str_t branch;
+  char buf[PJSIP_MAX_PKT_LEN];
+  int code;
+  unsigned n;
+
+  PJ_FD_ZERO(&rset);
+  PJ_FD_SET(e->sock, &rset);
+  if (pj_sock_select((int)e->sock + 1, &rset, NULL, NULL, timeout) <= 0) {
+    return;
+  }
+
+  for (n = 0; n < SL_BATCH; n++) {
+    len = sizeof(buf);
+    if (pj_sock_recvfrom(e->sock, buf, &len, MSG_DONTWAIT, NULL, NULL) != PJ_SUCCESS) {
+      break;
+    }
+    e->rx++;
+    if (scan_response(buf, len, &code, &branch)) {
+      sl_dispatch(e, &branch, code);
+    }
+  }
+}
+
+static void send_failed (struct sl_engine *e, pj_status_t status)
+{
+  char errmsg[PJ_ERR_MSG_SIZE];
+
+  pj_strerror(status, errmsg, sizeof(errmsg));
+  PJ_LOG(1, (NAME, "Failed to send request: %s. Stop sending.", errmsg));
+  e->total = e->sent;
+}
+
+/* One round of engine: timers, due sends and backend I/O. Lowers
+ * timeout to time of next send or tick. */
+static void engine_poll (struct sl_engine *e, pj_time_val *timeout)
+{
+  pj_status_t status;
+  pj_timestamp ts;
+  pj_uint64_t now, slot = 0;
+  unsigned n, rate = sl.app->cfg.rate;
+  long wait = SL_TICK_MS;
+  // batched backends read their own way, nothing to watch
+  pj_sock_t watch = e->io ? PJ_INVALID_SOCKET : e->sock;
+
+  if (sl.threaded) {
+    inbox_drain(e);
+  }
+
+  pj_get_timestamp(&ts);
+  wheel_advance(e, (pj_uint32_t)(pj_elapsed_msec64(&sl.start, &ts) / SL_TICK_MS));
+
+  now = sippak_pacer_now();
+  for (n = 0; e->sent < e->total && n < SL_BATCH; n++) {
+    if (rate) {
+      // sequence numbers are striped over engines, so are slots
+      slot = sippak_pacer_slot(&e->pacer, e->sent * sl.eng_cnt + e->id);
+      if (slot > now && slot - now > SL_PACE_WINDOW) {
+        break;
+      }
+      status = slot > now ? sippak_pacer_wait(&e->pacer, slot, watch) : PJ_SUCCESS;
+      if (status == PJ_EPENDING) {
+        break; // response is read first
+      }
+      if (status != PJ_SUCCESS) {
+        send_failed(e, status);
+        break;
+      }
+    }
+
+    status = send_next(e, e->tick);
+    if (status == PJ_STATUS_FROM_OS(PJ_BLOCKING_ERROR_VAL)) {
+      break; // socket buffer is full, retry on next poll
+    }
+    if (status != PJ_SUCCESS) {
+      send_failed(e, status);
+      break;
+    }
+
+    if (rate) {
+      if (e->io) {
+        e->io->flush(); // paced sends are not batched
+      }
+      now = sippak_pacer_now();
+      sippak_pacer_sent(&e->pacer, slot, now);
+    }
+  }
+
+  if (e->io) {
+    status = e->io->flush();
+    if (status != PJ_SUCCESS && status != PJ_STATUS_FROM_OS(PJ_BLOCKING_ERROR_VAL)) {
+      send_failed(e, status);
+    }
+  }
+
+  if (e->sent >= e->total && e->inflight == 0) {
+    e->done = PJ_TRUE;
+    return;
+  }
+
+  // sleep until next slot is within pacer window, or until next tick
+  if (e->sent < e->total) {
+    wait = 0;
+    if (rate) {
+      slot = sippak_pacer_slot(&e->pacer, e->sent * sl.eng_cnt + e->id);
+      now = sippak_pacer_now();
+      if (slot > now + SL_PACE_WINDOW) {
+        wait = (long)PJ_MIN((slot - now - SL_PACE_WINDOW) / 1000000, SL_TICK_MS);
+      }
+    }
+  }
+
+  if (PJ_TIME_VAL_MSEC(*timeout) > wait) {
+    timeout->sec = 0;
+    timeout->msec = wait;
+  }
+
+  // backend drains responses, it may wait on its own completion queue
+  if (e->io) {
+    e->io->poll(timeout);
+  }
+}
+
+static int worker_thread (void *arg)
+{
+  struct sl_engine *e = arg;
+  pj_time_val timeout;
+
+  while (!e->done) {
+    timeout.sec = 0;
+    timeout.msec = SL_TICK_MS;
+    engine_poll(e, &timeout);
+    if (!e->done) {
+      worker_recv(e, &timeout);
+    }
+  }
+  __atomic_add_fetch(&sl.eng_done, 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+static void sl_finish (void)
+{
+  unsigned i;
+
+  for (i = 0; sl.threaded && i < sl.eng_cnt; i++) {
+    pj_thread_join(sl.eng[i].thread);
+    pj_thread_destroy(sl.eng[i].thread);
+    pj_mutex_destroy(sl.eng[i].inbox_lock);
+    pjsip_udp_transport_restart(sl.app->tp_pool.ent[i].tp,
+        PJSIP_UDP_TRANSPORT_KEEP_SOCKET, PJ_INVALID_SOCKET, NULL, NULL);
+  }
+
+  sl.done = PJ_TRUE;
+  sl_report();
+  for (i = 0; sl.app->cfg.rate && i < sl.eng_cnt; i++) {
+    sippak_pacer_destroy(&sl.eng[i].pacer);
+  }
+  if (sl.eng[0].io) {
+    sl.eng[0].io->destroy();
+    pjsip_udp_transport_restart(sl.app->tp_pool.ent[0].tp,
+        PJSIP_UDP_TRANSPORT_KEEP_SOCKET, PJ_INVALID_SOCKET, NULL, NULL);
+  }
+  sippak_loop_cancel();
+}
+
+PJ_DEF(void) sippak_stateless_poll (struct sippak_app *app, pj_time_val *timeout)
+{
+  PJ_UNUSED_ARG(app);
+
+  if (sl.tpl == NULL || sl.done) {
+    return;
+  }
+
+  // main thread only runs timers and passes on responses transport reads
+  if (sl.threaded) {
+    if (__atomic_load_n(&sl.eng_done, __ATOMIC_ACQUIRE) == sl.eng_cnt) {
+      sl_finish();
+    } else if (PJ_TIME_VAL_MSEC(*timeout) > SL_TICK_MS) {
+      timeout->sec = 0;
+      timeout->msec = SL_TICK_MS;
+    }
+    return;
+  }
+
+  engine_poll(&sl.eng[0], timeout);
+  if (sl.eng[0].done) {
+    sl_finish();
+  }
+}
+
+static pj_status_t engine_init (struct sippak_app *app, struct sl_engine *e, pj_size_t tx_max)
+{
+  unsigned cap = 1, i;
+
+  while (cap < e->total && cap < SIPPAK_STATELESS_MAX_INFLIGHT) {
+    cap <<= 1;
+  }
+  e->pool = pjsip_endpt_create_pool(app->endpt, "stateless", POOL_INIT, POOL_INCR);
+  e->buf = pj_pool_alloc(e->pool, tx_max);
+  e->slot = pj_pool_zalloc(e->pool, cap * sizeof(struct sl_slot));
+  e->slot_mask = cap - 1;
+
+  // load factor at most 0.5
+  for (e->ht_bits = 1; (1u << e->ht_bits) < 2 * cap; e->ht_bits++);
+  e->ht_mask = (1u << e->ht_bits) - 1;
+  e->ht = pj_pool_alloc(e->pool, (e->ht_mask + 1) * sizeof(struct sl_hent));
+  for (i = 0; i <= e->ht_mask; i++) {
+    e->ht[i].slot = SL_NIL;
+  }
+  for (i = 0; i < SL_WHEEL_SIZE; i++) {
+    e->wheel[i] = SL_NIL;
+  }
+  e->tick = 0;
+
+  if (!sl.threaded) {
+    return PJ_SUCCESS;
+  }
+
+  e->inbox = pj_pool_alloc(e->pool, SL_INBOX_SIZE * sizeof(struct sl_msg));
+  return pj_mutex_create_simple(e->pool, "sl_inbox", &e->inbox_lock);
+}
+
+PJ_DEF(pj_status_t) sippak_stateless_start (struct sippak_app *app,
+                                            struct sippak_msg_tpl **tpl,
+                                            unsigned tpl_cnt)
+{
+  pj_status_t status;
+  pjsip_transport *tp;
+  pj_str_t host = app->dest.uri->host;
+  int port = app->dest.uri->port;
+  pj_size_t tx_max = 0;
+  pj_uint64_t start;
+  unsigned i;
+
+  sl.app = app;
+  sl.total = (pj_uint64_t)app->cfg.count * tpl_cnt;
+  sl.eng_cnt = app->cfg.threads;
+  sl.threaded = sl.eng_cnt > 1;
+  sl.src_cnt = PJ_MAX(app->tp_pool.cnt, 1);
+
+  if (sl.threaded && app->cfg.udp_io != SIPPAK_UDP_IO_SOCK) {
+    PJ_LOG(1, (NAME, "Options --mmsg and --uring can not be used with --threads."));
+    return PJ_EINVAL;
+  }
+
+  if (sl.src_cnt > 1 && !sl.threaded && app->cfg.udp_io != SIPPAK_UDP_IO_SOCK) {
+    PJ_LOG(1, (NAME, "Local address lists and port ranges can not be used with "
+          "--mmsg or --uring."));
+    return PJ_EINVAL;
+  }
+
+  // source of sequence number is its owner, see sippak_transport_init
+  if (sl.threaded && sl.src_cnt != sl.eng_cnt) {
+    PJ_LOG(1, (NAME, "Expected %u local tuples for worker threads, bound %u.",
+          sl.eng_cnt, sl.src_cnt));
+    return PJ_EINVAL;
+  }
+
+  if (port == 0) {
+    port = pjsip_transport_get_default_port_for_type(PJSIP_TRANSPORT_UDP);
+  }
+  status = pj_sockaddr_init(pj_AF_INET(), &sl.dst, &host, (pj_uint16_t)port);
+  SIPPAK_ASSERT_SUCC(status, "Failed to resolve destination %.*s.", (int)host.slen, host.ptr);
+  sl.dst_len = pj_sockaddr_get_len(&sl.dst);
+
+  // requests are written to socket of transport created by sippak_transport_init
+  status = pjsip_endpt_acquire_transport(app->endpt, PJSIP_TRANSPORT_UDP,
+      &sl.dst, sl.dst_len, NULL, &tp);
+  SIPPAK_ASSERT_SUCC(status, "Failed to acquire UDP transport.");
+  pjsip_transport_dec_ref(tp);
+
+  for (i = 0; i < tpl_cnt * sl.src_cnt; i++) {
+    tx_max = PJ_MAX(tx_max, tpl[i]->len);
+  }
+
+  sl.pool = pjsip_endpt_create_pool(app->endpt, "stateless", POOL_INIT, POOL_INCR);
+  sl.src_sock = pj_pool_calloc(sl.pool, sl.src_cnt, sizeof(pj_sock_t));
+  for (i = 0; sl.src_cnt > 1 && i < sl.src_cnt; i++) {
+    sl.src_sock[i] = pjsip_udp_transport_get_socket(app->tp_pool.ent[i].tp);
+  }
+  sl.eng = pj_pool_zalloc(sl.pool, sl.eng_cnt * sizeof(struct sl_engine));
+
+  for (i = 0; i < sl.eng_cnt; i++) {
+    struct sl_engine *e = &sl.eng[i];
+
+    e->id = i;
+    e->total = sl.total / sl.eng_cnt + (i < sl.total % sl.eng_cnt);
+    status = engine_init(app, e, tx_max);
+    SIPPAK_ASSERT_SUCC(status, "Failed to initiate stateless engine.");
+
+    if (!sl.threaded) {
+      e->sock = pjsip_udp_transport_get_socket(tp);
+      continue;
+    }
+
+    // worker reads its socket, transport only keeps it open
+    e->sock = sl.src_sock[i];
+    status = pjsip_udp_transport_pause(app->tp_pool.ent[i].tp,
+        PJSIP_UDP_TRANSPORT_KEEP_SOCKET);
+    SIPPAK_ASSERT_SUCC(status, "Failed to take over socket for worker %u.", i);
+  }
+
+  if (app->cfg.udp_io != SIPPAK_UDP_IO_SOCK) {
+    struct sl_engine *e = &sl.eng[0];
+    e->io = app->cfg.udp_io == SIPPAK_UDP_IO_URING ? &sippak_uring_io : &sippak_mmsg_io;
+    // engine reads socket, ioqueue of transport must not race for datagrams
+    status = pjsip_udp_transport_pause(tp, PJSIP_UDP_TRANSPORT_KEEP_SOCKET);
+    SIPPAK_ASSERT_SUCC(status, "Failed to take over socket for %s UDP I/O.", e->io->name);
+    status = e->io->init(app->endpt, tp, tx_max);
+    SIPPAK_ASSERT_SUCC(status, "Failed to initiate %s UDP I/O.", e->io->name);
+  }
+
+  sl.t1 = PJ_MAX(pjsip_cfg()->tsx.t1 / SL_TICK_MS, 1);
+  sl.t2 = PJ_MAX(pjsip_cfg()->tsx.t2 / SL_TICK_MS, sl.t1);
+  sl.timeout = 64 * sl.t1;
+
+  status = pjsip_endpt_register_module(app->endpt, &mod_stateless);
+  SIPPAK_ASSERT_SUCC(status, "Failed to register module mod_stateless.");
+
+  PJ_LOG(3, (NAME, "Sending %llu requests stateless%s.", sl.total,
+        app->cfg.retrans ? " with retransmissions" : ""));
+
+  sl.tpl_cnt = tpl_cnt;
+  sl.tpl = tpl;
+  pj_get_timestamp(&sl.start);
+  start = sippak_pacer_now();
+
+  // all engines share one schedule, each sends its own stripe of it
+  for (i = 0; app->cfg.rate && i < sl.eng_cnt; i++) {
+    status = sippak_pacer_init(&sl.eng[i].pacer, start, app->cfg.rate, app->cfg.spin);
+    SIPPAK_ASSERT_SUCC(status, "Failed to initiate send pacer.");
+  }
+
+  for (i = 0; sl.threaded && i < sl.eng_cnt; i++) {
+    status = pj_thread_create(sl.pool, "sl_worker", &worker_thread, &sl.eng[i],
+        0, 0, &sl.eng[i].thread);
+    SIPPAK_ASSERT_SUCC(status, "Failed to start worker thread %u.", i);
+  }
+
+  if (sl.threaded) {
+    PJ_LOG(3, (NAME, "Started %u worker threads, each on own local port from %d.",
+          sl.eng_cnt, app->tp_pool.ent[0].port));
+  }
+
+  return PJ_SUCCESS;
+}
@@ -0,0 +1,300 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file stats.c
+ * @brief sippak live counters of SIP messages
+ *
+ * Every thread increments its own counters slot without locks.
+ * Slots are merged only when snapshot is taken: on SIGUSR1 or
+ * on --stats-interval timer.
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+#include <signal.h>
+#include "sippak.h"
+
+#define NAME "mod_stats"
+
+#define STATS_RX 0
+#define STATS_TX 1
+
+#define STATS_CODE_MIN 100
+#define STATS_CODE_CNT 600 // codes 100 to 699
+
+/* Order of first methods follows pjsip_method_e, so id is index. */
+static const char *stats_method_names[] = {
+  "INVITE", "CANCEL", "ACK", "BYE", "REGISTER", "OPTIONS",
+  "SUBSCRIBE", "NOTIFY", "PUBLISH", "MESSAGE", "REFER",
+  "INFO", "UPDATE", "PRACK", "OTHER"
+};
+
+#define STATS_METHOD_CNT PJ_ARRAY_SIZE(stats_method_names)
+#define STATS_METHOD_OTHER (STATS_METHOD_CNT - 1)
+
+/* counters owned by one thread */
+struct stats_slot {
+  PJ_DECL_LIST_MEMBER(struct stats_slot);
+  pj_uint32_t req[2][STATS_METHOD_CNT];
+  pj_uint32_t resp[2][STATS_CODE_CNT];
+};
+
+static struct sippak_app *local_app;
+static pj_pool_t *stats_pool;
+static pj_mutex_t *stats_mutex;
+static long stats_tls_id = -1;
+static struct stats_slot slot_list;
+static pj_timestamp stats_start;
+static pj_timer_entry stats_timer;
+static volatile sig_atomic_t dump_requested = 0;
+
+static pj_bool_t on_rx_request (pjsip_rx_data *rdata);
+static pj_bool_t on_rx_response (pjsip_rx_data *rdata);
+static pj_status_t on_tx_request (pjsip_tx_data *tdata);
+static pj_status_t on_tx_response (pjsip_tx_data *tdata);
+
+static pjsip_module mod_stats =
+{
+  NULL, NULL,                 /* prev, next.    */
+  { "mod-stats", 9 },         /* Name.    */
+  -1,                         /* Id      */
+  PJSIP_MOD_PRIORITY_TRANSPORT_LAYER - 1, /* Priority          */
+  NULL,                       /* load()    */
+  NULL,                       /* start()    */
+  NULL,                       /* stop()    */
+  NULL,                       /* unload()    */
+  &on_rx_request,             /* on_rx_request()  */
+  &on_rx_response,            /* on_rx_response()  */
+  &on_tx_request,             /* on_tx_request.  */
+  &on_tx_response,            /* on_tx_response()  */
+  NULL,                       /* on_tsx_state()  */
+};
+
+/* Slot is created once per thread, only then lock is taken. */
+static struct stats_slot *thread_slot (void)
+{
+  struct stats_slot *slot = pj_thread_local_get(stats_tls_id);
+
+  if (slot) {
+    return slot;
+  }
+
+  pj_mutex_lock(stats_mutex);
+  slot = PJ_POOL_ZALLOC_T(stats_pool, struct stats_slot);
+  pj_list_push_back(&slot_list, slot);
+  pj_mutex_unlock(stats_mutex);
+
+  pj_thread_local_set(stats_tls_id, slot);
+
+  return slot;
+}
+
+static unsigned method_idx (const pjsip_method *method)
+{
+  unsigned i;
+
+  if (method->id != PJSIP_OTHER_METHOD) {
+    return method->id;
+  }
+  for (i = PJSIP_OTHER_METHOD; i < STATS_METHOD_OTHER; i++) {
+    if (pj_strcmp2(&method->name, stats_method_names[i]) == 0) {
+      return i;
+    }
+  }
+  return STATS_METHOD_OTHER;
+}
+
+static void count_msg (const pjsip_msg *msg, int dir)
+{
+  struct stats_slot *slot = thread_slot();
+
+  if (msg->type == PJSIP_REQUEST_MSG) {
+    slot->req[dir][method_idx(&msg->line.req.method)]++;
+  } else {
+    int code = msg->line.status.code;
+    if (code >= STATS_CODE_MIN && code < STATS_CODE_MIN + STATS_CODE_CNT) {
+      slot->resp[dir][code - STATS_CODE_MIN]++;
+    }
+  }
+}
+
+static pj_bool_t on_rx_request (pjsip_rx_data *rdata)
+{
+  count_msg (rdata->msg_info.msg, STATS_RX);
+  return PJ_FALSE; // continue with other modules
+}
+
+static pj_bool_t on_rx_response (pjsip_rx_data *rdata)
+{
+  count_msg (rdata->msg_info.msg, STATS_RX);
+  return PJ_FALSE; // continue with other modules
+}
+
+static pj_status_t on_tx_request (pjsip_tx_data *tdata)
+{
+  count_msg (tdata->msg, STATS_TX);
+  return PJ_SUCCESS;
+}
+
+static pj_status_t on_tx_response (pjsip_tx_data *tdata)
+{
+  count_msg (tdata->msg, STATS_TX);
+  return PJ_SUCCESS;
+}
+
+/* merge all threads slots */
+static void stats_snapshot (struct stats_slot *snap)
+{
+  struct stats_slot *slot;
+  unsigned dir, i;
+
+  pj_bzero(snap, sizeof(*snap));
+
+  pj_mutex_lock(stats_mutex);
+  for (slot = slot_list.next; slot != &slot_list; slot = slot->next) {
+    for (dir = STATS_RX; dir <= STATS_TX; dir++) {
+      for (i = 0; i < STATS_METHOD_CNT; i++) {
+        snap->req[dir][i] += slot->req[dir][i];
+      }
+      for (i = 0; i < STATS_CODE_CNT; i++) {
+        snap->resp[dir][i] += slot->resp[dir][i];
+      }
+    }
+  }
+  pj_mutex_unlock(stats_mutex);
+}
+
+static void stats_print (FILE *f)
+{
+  struct stats_slot snap;
+  pj_timestamp now;
+  unsigned dir, i;
+  unsigned tsx_cnt = 0, dlg_cnt = 0;
+  static const char *dir_name[] = { "rx", "tx" };
+
+  stats_snapshot (&snap);
+
+  if (pjsip_tsx_layer_instance()->id != -1) {
+    tsx_cnt = pjsip_tsx_layer_get_tsx_count();
+  }
+  if (pjsip_ua_instance()->id != -1) {
+    dlg_cnt = pjsip_ua_get_dlg_set_count();
+  }
+
+  pj_get_timestamp(&now);
+  fprintf(f, "uptime_ms %u\n", pj_elapsed_msec(&stats_start, &now));
+  fprintf(f, "tsx_inflight %u\n", tsx_cnt);
+  fprintf(f, "dialogs %u\n", dlg_cnt);
+  fprintf(f, "pool_used %lu\n", (unsigned long)local_app->cp->used_size);
+  fprintf(f, "pool_peak %lu\n", (unsigned long)local_app->cp->peak_used_size);
+
+  for (dir = STATS_RX; dir <= STATS_TX; dir++) {
+    for (i = 0; i < STATS_METHOD_CNT; i++) {
+      if (snap.req[dir][i]) {
+        fprintf(f, "req_%s %s %u\n", dir_name[dir], stats_method_names[i], snap.req[dir][i]);
+      }
+    }
+    for (i = 0; i < STATS_CODE_CNT; i++) {
+      if (snap.resp[dir][i]) {
+        fprintf(f, "resp_%s %u %u\n", dir_name[dir], i + STATS_CODE_MIN, snap.resp[dir][i]);
+      }
+    }
+  }
+}
+
+/* write to temporary file and rename, so readers never see partial file */
+static void stats_write_file (const char *path)
+{
+  char tmp[PJ_MAXPATH];
+  FILE *f;
+
+  pj_ansi_snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+  f = fopen(tmp, "w");
+  if (f == NULL) {
+    PJ_LOG(1, (NAME, "Failed to open stats file %s.", tmp));
+    return;
+  }
+  stats_print (f);
+  if (fclose(f) != 0 || rename(tmp, path) != 0) {
+    PJ_LOG(1, (NAME, "Failed to write stats file %s.", path));
+  }
+}
+
+static void on_stats_timer (pj_timer_heap_t *ht, pj_timer_entry *entry)
+{
+  pj_time_val delay = { local_app->cfg.stats.interval, 0 };
+
+  PJ_UNUSED_ARG(ht);
+
+  stats_write_file (local_app->cfg.stats.file);
+
+  pjsip_endpt_schedule_timer(local_app->endpt, entry, &delay);
+}
+
+static void on_sigusr1 (int signum)
+{
+  PJ_UNUSED_ARG(signum);
+  dump_requested = 1;
+}
+
+/* called from main loop, dump is never done in signal handler */
+PJ_DEF(void) sippak_stats_poll (struct sippak_app *app)
+{
+  PJ_UNUSED_ARG(app);
+
+  if (!dump_requested || mod_stats.id == -1) {
+    return;
+  }
+  dump_requested = 0;
+
+  stats_print (stdout);
+  fflush(stdout);
+}
+
+PJ_DEF(pj_status_t) sippak_mod_stats_register (struct sippak_app *app)
+{
+  pj_status_t status;
+
+  local_app = app;
+  pj_list_init(&slot_list);
+  pj_get_timestamp(&stats_start);
+
+  stats_pool = pjsip_endpt_create_pool(app->endpt, "stats", POOL_INIT, POOL_INCR);
+
+  status = pj_mutex_create_simple(stats_pool, "stats", &stats_mutex);
+  SIPPAK_ASSERT_SUCC(status, "Failed to create stats mutex.");
+
+  status = pj_thread_local_alloc(&stats_tls_id);
+  SIPPAK_ASSERT_SUCC(status, "Failed to allocate stats thread local.");
+
+  status = pjsip_endpt_register_module(app->endpt, &mod_stats);
+  SIPPAK_ASSERT_SUCC(status, "Failed to register module mod_stats.");
+
+  signal(SIGUSR1, &on_sigusr1);
+
+  if (app->cfg.stats.interval > 0) {
+    pj_time_val delay = { app->cfg.stats.interval, 0 };
+    pj_timer_entry_init(&stats_timer, 0, NULL, &on_stats_timer);
+    return pjsip_endpt_schedule_timer(app->endpt, &stats_timer, &delay);
+  }
+
+  return PJ_SUCCESS;
+}
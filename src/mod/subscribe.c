@@ -41,6 +41,8 @@ static void on_rx_notify(pjsip_evsub *sub, pjsip_rx_data *rdata, int *p_st_code,
 static void on_tsx_state(pjsip_evsub *sub, pjsip_transaction *tsx, pjsip_event *event);
 static sippak_evtype_e set_sub_evtype(struct sippak_app *app);
 static short unsigned auth_tries = 0;
+static pj_bool_t pres_ready = PJ_FALSE; // event packages are added once
+static pj_bool_t mwi_ready = PJ_FALSE;
 
 static pjsip_module mod_subscribe =
 {
@@ -161,6 +163,8 @@ PJ_DEF(pj_status_t) sippak_cmd_subscribe (struct sippak_app *app)
 
   sippak_evtype_e evtype = set_sub_evtype(app);
 
+  auth_tries = 0; // scenario step answers its own challenge
+
   status = sippak_transport_init(app, &local_addr, &local_port);
   SIPPAK_ASSERT_SUCC(status, "Failed to initiate transport.");
 
@@ -168,7 +172,7 @@ PJ_DEF(pj_status_t) sippak_cmd_subscribe (struct sippak_app *app)
   from = sippak_create_from_hdr(app);
   ruri = sippak_create_ruri(app);
 
-  status = pjsip_ua_init_module(app->endpt, NULL);
+  status = sippak_ua_layer_init(app);
   SIPPAK_ASSERT_SUCC(status, "Failed to initiate UA module.");
 
   status = pjsip_dlg_create_uac(pjsip_ua_instance(),
@@ -182,19 +186,23 @@ PJ_DEF(pj_status_t) sippak_cmd_subscribe (struct sippak_app *app)
   status = pjsip_auth_clt_set_credentials(&dlg->auth_sess, 1, cred);
   SIPPAK_ASSERT_SUCC(status, "Failed to set auth credentials.");
 
-  /* Init core SIMPLE module : */
-  status = pjsip_evsub_init_module(app->endpt);
-  SIPPAK_ASSERT_SUCC(status, "Failed to intiate events subscribe module.");
+  /* Init core SIMPLE module, once for scenario steps : */
+  if (pjsip_evsub_instance()->id == -1) {
+    status = pjsip_evsub_init_module(app->endpt);
+    SIPPAK_ASSERT_SUCC(status, "Failed to intiate events subscribe module.");
+  }
 
-  if (app->cfg.pres_ev == EVTYPE_MWI) {
+  if (app->cfg.pres_ev == EVTYPE_MWI && !mwi_ready) {
     status = pjsip_mwi_init_module(app->endpt, &mod_subscribe);
     SIPPAK_ASSERT_SUCC(status, "Failed to intiate MWI module.");
-  } else {
+    mwi_ready = PJ_TRUE;
+  } else if (app->cfg.pres_ev != EVTYPE_MWI && !pres_ready) {
     status = pjsip_pres_init_module(app->endpt, &mod_subscribe);
     SIPPAK_ASSERT_SUCC(status, "Failed to intiate presence module.");
+    pres_ready = PJ_TRUE;
   }
 
-  status = pjsip_endpt_register_module(app->endpt, &mod_subscribe);
+  status = sippak_cmd_module_register(app, &mod_subscribe);
   SIPPAK_ASSERT_SUCC(status, "Failed to register module mod_subscribe.");
 
   pj_bzero(&pres_cb, sizeof(pres_cb));
@@ -218,7 +226,7 @@ PJ_DEF(pj_status_t) sippak_cmd_subscribe (struct sippak_app *app)
     SIPPAK_ASSERT_SUCC(status, "Failed to initiate presence request.");
   }
 
-  status = pjsip_tsx_layer_init_module(app->endpt);
+  status = sippak_tsx_layer_init(app);
   SIPPAK_ASSERT_SUCC(status, "Failed to initiate transaction layer.");
 
   if (app->cfg.pres_ev == EVTYPE_MWI) {
@@ -0,0 +1,230 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file timeseries.c
+ * @brief sippak per second metrics written to CSV file
+ *
+ * Events are fed by timing module. Counters and latency histogram
+ * are double buffered: writers increment the active interval with
+ * atomic adds, the once per second timer swaps active index and
+ * reads the retired interval. Buffers are never cleared, row is what
+ * was added since the buffer was last read, so add of a writer that
+ * loaded old index just before swap goes to the next row of that
+ * buffer, two seconds later. No locks are taken.
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+#include "sippak.h"
+
+#define NAME "mod_timeseries"
+
+/*
+ * Log-linear latency histogram in usec. Values below 2 * TS_HIST_SUB
+ * have own bucket, above that every power of two has TS_HIST_SUB
+ * buckets, so relative error is 1 / TS_HIST_SUB.
+ */
+#define TS_HIST_SUB 16
+#define TS_HIST_SIZE (32 * TS_HIST_SUB)
+
+/* Only pj_uint32_t counters, read as array. */
+struct ts_interval {
+  pj_uint32_t sent;
+  pj_uint32_t retrans;
+  pj_uint32_t timeouts;
+  pj_uint32_t resp[6];          // by class 1xx to 6xx
+  pj_uint32_t hist[TS_HIST_SIZE];
+};
+
+static struct sippak_app *local_app;
+static FILE *ts_file = NULL;
+static struct ts_interval ts_buf[2];
+static struct ts_interval ts_read[2];   // ts_buf values already in rows
+static int ts_cur = 0;
+static pj_timer_entry ts_timer;
+
+#define TS_ACTIVE() (&ts_buf[__atomic_load_n(&ts_cur, __ATOMIC_ACQUIRE)])
+#define TS_INC(field) __atomic_fetch_add(&TS_ACTIVE()->field, 1, __ATOMIC_RELAXED)
+
+static unsigned hist_idx (pj_uint32_t usec)
+{
+  unsigned shift = 0;
+
+  while ((usec >> shift) >= 2 * TS_HIST_SUB) {
+    shift++;
+  }
+  return shift * TS_HIST_SUB + (usec >> shift);
+}
+
+/* lower bound of bucket value */
+static pj_uint32_t hist_value (unsigned idx)
+{
+  unsigned shift;
+
+  if (idx < 2 * TS_HIST_SUB) {
+    return idx;
+  }
+  shift = idx / TS_HIST_SUB - 1;
+  return (pj_uint32_t)(idx - shift * TS_HIST_SUB) << shift;
+}
+
+static pj_uint32_t hist_percentile (const struct ts_interval *iv,
+    pj_uint32_t total, unsigned pct)
+{
+  pj_uint32_t rank = (pj_uint32_t)(((pj_uint64_t)total * pct + 99) / 100);
+  pj_uint32_t cnt = 0;
+  unsigned i;
+
+  for (i = 0; i < TS_HIST_SIZE; i++) {
+    cnt += iv->hist[i];
+    if (cnt >= rank) {
+      return hist_value(i);
+    }
+  }
+  return 0;
+}
+
+static void write_row (struct ts_interval *iv)
+{
+  pj_time_val now;
+  pj_uint32_t total = 0;
+  pj_uint32_t p50, p99;
+  unsigned i;
+
+  for (i = 0; i < TS_HIST_SIZE; i++) {
+    total += iv->hist[i];
+  }
+  p50 = total ? hist_percentile(iv, total, 50) : 0;
+  p99 = total ? hist_percentile(iv, total, 99) : 0;
+
+  pj_gettimeofday(&now);
+  fprintf(ts_file, "%ld,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u.%03u,%u.%03u\n",
+      (long)now.sec, iv->sent,
+      iv->resp[0], iv->resp[1], iv->resp[2], iv->resp[3], iv->resp[4], iv->resp[5],
+      iv->retrans, iv->timeouts,
+      p50 / 1000, p50 % 1000, p99 / 1000, p99 % 1000);
+  fflush(ts_file);
+}
+
+/* Add to row what was added to buffer idx since it was last read.
+ * Counters wrap, difference of unsigned values stays right. */
+static void read_buf (int idx, struct ts_interval *row)
+{
+  pj_uint32_t *cur = (pj_uint32_t*)&ts_buf[idx];
+  pj_uint32_t *done = (pj_uint32_t*)&ts_read[idx];
+  pj_uint32_t *out = (pj_uint32_t*)row;
+  pj_uint32_t val;
+  unsigned i;
+
+  for (i = 0; i < sizeof(*row) / sizeof(pj_uint32_t); i++) {
+    val = __atomic_load_n(&cur[i], __ATOMIC_RELAXED);
+    out[i] += val - done[i];
+    done[i] = val;
+  }
+}
+
+static void on_ts_timer (pj_timer_heap_t *ht, pj_timer_entry *entry)
+{
+  pj_time_val delay = { 1, 0 };
+  struct ts_interval row;
+  int old = ts_cur;
+
+  PJ_UNUSED_ARG(ht);
+
+  sippak_timing_expire();
+
+  __atomic_store_n(&ts_cur, !old, __ATOMIC_RELEASE);
+
+  pj_bzero(&row, sizeof(row));
+  read_buf(old, &row);
+  write_row (&row);
+
+  pjsip_endpt_schedule_timer(local_app->endpt, entry, &delay);
+}
+
+PJ_DEF(void) sippak_timeseries_sent (void)
+{
+  if (ts_file) {
+    TS_INC(sent);
+  }
+}
+
+PJ_DEF(void) sippak_timeseries_retrans (void)
+{
+  if (ts_file) {
+    TS_INC(retrans);
+  }
+}
+
+PJ_DEF(void) sippak_timeseries_timeout (void)
+{
+  if (ts_file) {
+    TS_INC(timeouts);
+  }
+}
+
+PJ_DEF(void) sippak_timeseries_response (int code, pj_uint32_t latency)
+{
+  if (ts_file == NULL || code < 100 || code > 699) {
+    return;
+  }
+  TS_INC(resp[code / 100 - 1]);
+  if (code >= 200) {
+    TS_INC(hist[hist_idx(latency)]);
+  }
+}
+
+PJ_DEF(pj_status_t) sippak_timeseries_start (struct sippak_app *app)
+{
+  pj_time_val delay = { 1, 0 };
+
+  local_app = app;
+
+  ts_file = fopen(app->cfg.timeseries, "w");
+  if (ts_file == NULL) {
+    PJ_LOG(1, (NAME, "Failed to open time series file %s.", app->cfg.timeseries));
+    return PJ_EINVAL;
+  }
+  fprintf(ts_file, "time,sent,1xx,2xx,3xx,4xx,5xx,6xx,retrans,timeouts,p50_ms,p99_ms\n");
+
+  pj_timer_entry_init(&ts_timer, 0, NULL, &on_ts_timer);
+
+  return pjsip_endpt_schedule_timer(app->endpt, &ts_timer, &delay);
+}
+
+PJ_DEF(void) sippak_timeseries_stop (void)
+{
+  struct ts_interval row;
+
+  if (ts_file == NULL) {
+    return;
+  }
+  pjsip_endpt_cancel_timer(local_app->endpt, &ts_timer);
+
+  // last partial interval and late adds to retired buffer
+  sippak_timing_expire();
+  pj_bzero(&row, sizeof(row));
+  read_buf(0, &row);
+  read_buf(1, &row);
+  write_row (&row);
+
+  fclose(ts_file);
+  ts_file = NULL;
+}
@@ -0,0 +1,794 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file timing.c
+ * @brief sippak per transaction phase timing
+ *
+ * Every outgoing request gets a record with monotonic timestamps:
+ * DNS start/end (external resolver wrapper), TCP/TLS connect
+ * (transport state callback), first TX and retransmissions (from
+ * mangler on_tx_request hook), first provisional and final response.
+ * Retransmissions and duplicate responses are also counted per
+ * destination to estimate packet loss on the path.
+ *
+ * Records are kept twice timer B/F after they are sent, to count late
+ * duplicates, then folded into summary and recycled. Memory stays
+ * bounded by request rate on long load runs.
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+#include <math.h>
+#include "sippak.h"
+
+#define NAME "mod_timing"
+
+#define TIMING_HASH_SIZE 127
+#define TIMING_MAX_KEY_LEN 128
+#define TIMING_EXPIRE_SEC 1   // expire and recycle period
+
+enum timing_stamp {
+  TS_DNS_START  = 1 << 0,
+  TS_DNS_END    = 1 << 1,
+  TS_CONNECT    = 1 << 2,
+  TS_FIRST_TX   = 1 << 3,
+  TS_PROVIS     = 1 << 4,
+  TS_FINAL      = 1 << 5,
+  TS_TIMEOUT    = 1 << 6
+};
+
+/* attempts of requests, lost ones and requests without response */
+struct timing_loss {
+  unsigned attempts;
+  unsigned lost;
+  unsigned timeouts;
+};
+
+/* retransmission and loss accounting per destination */
+struct timing_dest {
+  PJ_DECL_LIST_MEMBER(struct timing_dest);
+  char name[PJ_INET6_ADDRSTRLEN + 16]; // transport type, host and port
+  unsigned name_len;
+  unsigned requests;
+  unsigned retrans;
+  unsigned dup_resp;
+  pj_uint32_t rtt_min;          // usec, 0 when unknown
+  struct timing_loss retired;   // of recycled records
+  struct timing_loss loss;      // calculated on report
+};
+
+struct timing_rec {
+  PJ_DECL_LIST_MEMBER(struct timing_rec);
+  unsigned flags;               // set timestamps, enum timing_stamp
+  char key[TIMING_MAX_KEY_LEN]; // method and Via branch
+  unsigned key_len;
+  pjsip_transport *tp;
+  struct timing_dest *dest;
+  int status;
+  int last_provis;              // last provisional code, to detect duplicates
+  pj_timestamp dns_start;
+  pj_timestamp dns_end;
+  pj_timestamp connect;
+  pj_timestamp first_tx;
+  pj_timestamp provis;
+  pj_timestamp final;
+  unsigned retrans;
+  pj_timestamp retrans_ts[SIPPAK_TIMING_MAX_RETRANS];
+  pj_hash_entry_buf hent;       // timing_ht entry, recycled with record
+};
+
+/* phase aggregate in usec */
+struct timing_aggr {
+  unsigned cnt;
+  pj_uint32_t min;
+  pj_uint32_t max;
+  pj_uint64_t sum;
+};
+
+struct timing_sum {
+  unsigned total;
+  unsigned timeouts;
+  unsigned retrans;
+  struct timing_aggr dns, conn, tx, prov, fin;
+};
+
+static struct sippak_app *local_app;
+static pj_hash_table_t *timing_ht;
+static struct timing_rec timing_list;
+static struct timing_rec *expire_cursor; // last record known to be done
+static struct timing_rec free_list;
+static struct timing_sum retired_sum;
+static pj_timer_entry expire_timer;
+static pj_hash_table_t *dest_ht;
+static struct timing_dest dest_list;
+static pjsip_tp_state_callback prev_tp_state_cb;
+
+/* Resolver wrapper used to time DNS phase of requests. */
+struct timing_resolve_ctx {
+  void *token;
+  pjsip_resolver_callback *cb;
+};
+
+static pjsip_resolver_t *inner_resv;
+
+static void timing_resolve (pjsip_resolver_t *resolver,
+                            pj_pool_t *pool,
+                            const pjsip_host_info *target,
+                            void *token,
+                            pjsip_resolver_callback *cb);
+
+static pjsip_ext_resolver timing_ext_resv = { &timing_resolve };
+
+static pj_bool_t on_rx_response (pjsip_rx_data *rdata);
+
+static pjsip_module mod_timing =
+{
+  NULL, NULL,                 /* prev, next.    */
+  { "mod-timing", 10 },       /* Name.    */
+  -1,                         /* Id      */
+  PJSIP_MOD_PRIORITY_TRANSPORT_LAYER - 1, /* Priority, before tsx layer consumes response */
+  NULL,                       /* load()    */
+  NULL,                       /* start()    */
+  NULL,                       /* stop()    */
+  NULL,                       /* unload()    */
+  NULL,                       /* on_rx_request()  */
+  &on_rx_response,            /* on_rx_response()  */
+  NULL,                       /* on_tx_request.  */
+  NULL,                       /* on_tx_response()  */
+  NULL,                       /* on_tsx_state()  */
+};
+
+static unsigned make_key (char *buf, const pj_str_t *method, const pj_str_t *branch)
+{
+  int len = pj_ansi_snprintf(buf, TIMING_MAX_KEY_LEN, "%.*s:%.*s",
+      (int)method->slen, method->ptr, (int)branch->slen, branch->ptr);
+  if (len < 0 || len >= TIMING_MAX_KEY_LEN) {
+    len = TIMING_MAX_KEY_LEN - 1;
+  }
+  return len;
+}
+
+static struct timing_rec *timing_rec_new (pjsip_tx_data *tdata)
+{
+  struct timing_rec *rec;
+
+  if (pj_list_empty(&free_list)) {
+    rec = PJ_POOL_ZALLOC_T(local_app->pool, struct timing_rec);
+  } else {
+    rec = free_list.next;
+    pj_list_erase(rec);
+    pj_bzero(rec, sizeof(*rec));
+  }
+
+  pj_list_push_back(&timing_list, rec);
+  tdata->mod_data[mod_timing.id] = rec;
+
+  return rec;
+}
+
+static struct timing_dest *timing_dest_get (pjsip_tx_data *tdata)
+{
+  char name[PJ_INET6_ADDRSTRLEN + 16];
+  struct timing_dest *dest;
+  int len = pj_ansi_snprintf(name, sizeof(name), "%s %s:%d",
+      tdata->tp_info.transport ? tdata->tp_info.transport->type_name : "-",
+      tdata->tp_info.dst_name, tdata->tp_info.dst_port);
+
+  if (len < 0 || len >= (int)sizeof(name)) {
+    len = sizeof(name) - 1;
+  }
+  dest = pj_hash_get(dest_ht, name, len, NULL);
+  if (dest) {
+    return dest;
+  }
+
+  dest = PJ_POOL_ZALLOC_T(local_app->pool, struct timing_dest);
+  pj_memcpy(dest->name, name, len);
+  dest->name_len = len;
+  pj_list_push_back(&dest_list, dest);
+  pj_hash_set(local_app->pool, dest_ht, dest->name, dest->name_len, 0, dest);
+
+  return dest;
+}
+
+/* ACK has no response and is not tracked. */
+static pj_bool_t is_timed_request (pjsip_tx_data *tdata)
+{
+  return mod_timing.id != -1
+    && tdata->msg->type == PJSIP_REQUEST_MSG
+    && tdata->msg->line.req.method.id != PJSIP_ACK_METHOD;
+}
+
+static pj_uint32_t elapsed (const pj_timestamp *start, const pj_timestamp *stop)
+{
+  return pj_elapsed_usec(start, stop);
+}
+
+static const pj_timestamp *rec_start (const struct timing_rec *rec)
+{
+  return (rec->flags & TS_DNS_START) ? &rec->dns_start : &rec->first_tx;
+}
+
+/* print offset from start of request as "12.345ms" or "-" when not set */
+static char *fmt_offset (char *buf, const struct timing_rec *rec,
+    unsigned flag, const pj_timestamp *ts)
+{
+  if (!(rec->flags & flag)) {
+    pj_ansi_strcpy(buf, "-");
+  } else {
+    pj_uint32_t usec = elapsed(rec_start(rec), ts);
+    pj_ansi_snprintf(buf, 16, "%u.%03ums", usec / 1000, usec % 1000);
+  }
+  return buf;
+}
+
+static void print_rec (const struct timing_rec *rec)
+{
+  char dns[16], conn[16], tx[16], prov[16], fin[16];
+  char retrans[SIPPAK_TIMING_MAX_RETRANS * 16] = "";
+  unsigned i, n = rec->retrans < SIPPAK_TIMING_MAX_RETRANS
+    ? rec->retrans
+    : SIPPAK_TIMING_MAX_RETRANS;
+
+  for (i = 0; i < n; i++) {
+    char ts[16];
+    pj_ansi_strcat(retrans, i ? "," : " (");
+    pj_ansi_strcat(retrans, fmt_offset(ts, rec, TS_FIRST_TX, &rec->retrans_ts[i]));
+  }
+  if (n) {
+    pj_ansi_strcat(retrans, ")");
+  }
+
+  PJ_LOG(3, (NAME, "%.*s: dns %s, connect %s, tx %s, retrans %u%s, 1xx %s, final %s %d",
+        (int)rec->key_len, rec->key,
+        fmt_offset(dns, rec, TS_DNS_END, &rec->dns_end),
+        fmt_offset(conn, rec, TS_CONNECT, &rec->connect),
+        fmt_offset(tx, rec, TS_FIRST_TX, &rec->first_tx),
+        rec->retrans, retrans,
+        fmt_offset(prov, rec, TS_PROVIS, &rec->provis),
+        fmt_offset(fin, rec, TS_FINAL, &rec->final),
+        rec->status));
+}
+
+static void aggr_add (struct timing_aggr *aggr, pj_uint32_t usec)
+{
+  if (aggr->cnt == 0 || usec < aggr->min) {
+    aggr->min = usec;
+  }
+  if (usec > aggr->max) {
+    aggr->max = usec;
+  }
+  aggr->sum += usec;
+  aggr->cnt++;
+}
+
+static void aggr_print (const char *phase, const struct timing_aggr *aggr)
+{
+  pj_uint32_t avg;
+  if (aggr->cnt == 0) {
+    PJ_LOG(3, (NAME, "  %-12s -", phase));
+    return;
+  }
+  avg = (pj_uint32_t)(aggr->sum / aggr->cnt);
+  PJ_LOG(3, (NAME, "  %-12s min %u.%03ums, avg %u.%03ums, max %u.%03ums (%u)",
+        phase,
+        aggr->min / 1000, aggr->min % 1000,
+        avg / 1000, avg % 1000,
+        aggr->max / 1000, aggr->max % 1000,
+        aggr->cnt));
+}
+
+static pj_bool_t on_rx_response (pjsip_rx_data *rdata)
+{
+  char key[TIMING_MAX_KEY_LEN];
+  unsigned key_len;
+  struct timing_rec *rec;
+  int code = rdata->msg_info.msg->line.status.code;
+
+  if (!rdata->msg_info.via || !rdata->msg_info.cseq) {
+    return PJ_FALSE;
+  }
+
+  key_len = make_key(key, &rdata->msg_info.cseq->method.name,
+      &rdata->msg_info.via->branch_param);
+  rec = pj_hash_get(timing_ht, key, key_len, NULL);
+  if (rec == NULL) {
+    return PJ_FALSE; // not ours
+  }
+
+  // final records stay in hash table to count duplicates
+  if ((rec->flags & TS_FINAL) || (code < 200 && code == rec->last_provis)) {
+    rec->dest->dup_resp++;
+    return PJ_FALSE;
+  }
+
+  if (code < 200) {
+    if (!(rec->flags & TS_PROVIS)) {
+      pj_get_timestamp(&rec->provis);
+      rec->flags |= TS_PROVIS;
+    }
+    rec->last_provis = code;
+    sippak_timeseries_response(code, 0);
+    return PJ_FALSE;
+  }
+
+  pj_get_timestamp(&rec->final);
+  rec->flags |= TS_FINAL;
+  rec->status = code;
+  sippak_timeseries_response(code, elapsed(&rec->first_tx, &rec->final));
+
+  if (local_app->cfg.timing) {
+    print_rec(rec);
+  }
+
+  return PJ_FALSE; // continue with other modules
+}
+
+/* CONNECTED state of reliable transport completes connect phase. */
+static void on_tp_state (pjsip_transport *tp, pjsip_transport_state state,
+    const pjsip_transport_state_info *info)
+{
+  if (state == PJSIP_TP_STATE_CONNECTED) {
+    pj_timestamp now;
+    struct timing_rec *rec;
+
+    pj_get_timestamp(&now);
+    for (rec = timing_list.next; rec != &timing_list; rec = rec->next) {
+      if (rec->tp == tp && !(rec->flags & (TS_CONNECT | TS_FINAL))) {
+        rec->connect = now;
+        rec->flags |= TS_CONNECT;
+      }
+    }
+  }
+
+  if (prev_tp_state_cb) {
+    (*prev_tp_state_cb)(tp, state, info);
+  }
+}
+
+/* transmission time of attempt: 0 is first TX, then retransmissions */
+static const pj_timestamp *attempt_ts (const struct timing_rec *rec, unsigned idx)
+{
+  return idx == 0 ? &rec->first_tx : &rec->retrans_ts[idx - 1];
+}
+
+static unsigned attempts_cnt (const struct timing_rec *rec)
+{
+  return 1 + (rec->retrans < SIPPAK_TIMING_MAX_RETRANS
+      ? rec->retrans
+      : SIPPAK_TIMING_MAX_RETRANS);
+}
+
+static const pj_timestamp *first_resp (const struct timing_rec *rec)
+{
+  if ((rec->flags & TS_PROVIS)
+      && (!(rec->flags & TS_FINAL) || pj_cmp_timestamp(&rec->provis, &rec->final) < 0)) {
+    return &rec->provis;
+  }
+  return (rec->flags & TS_FINAL) ? &rec->final : NULL;
+}
+
+/*
+ * Attempt answered by response is the last one sent at least
+ * round trip time before the response. Attempts sent later were
+ * spurious retransmissions, earlier ones were lost.
+ */
+static unsigned answered_attempt (const struct timing_rec *rec,
+    const pj_timestamp *resp, pj_uint32_t rtt)
+{
+  unsigned i, found = 0, n = attempts_cnt(rec);
+
+  for (i = 0; i < n; i++) {
+    if (pj_cmp_timestamp(attempt_ts(rec, i), resp) > 0) {
+      break;
+    }
+    if (elapsed(attempt_ts(rec, i), resp) >= rtt) {
+      found = i;
+    }
+  }
+  return found;
+}
+
+/* Minimal round trip of destination, from last attempt before response. */
+static void rtt_update (const struct timing_rec *rec)
+{
+  const pj_timestamp *resp = first_resp(rec);
+  pj_uint32_t rtt;
+
+  if (!rec->dest || !resp) {
+    return;
+  }
+  rtt = elapsed(attempt_ts(rec, answered_attempt(rec, resp, 0)), resp);
+  if (rec->dest->rtt_min == 0 || rtt < rec->dest->rtt_min) {
+    rec->dest->rtt_min = rtt;
+  }
+}
+
+static void loss_add (struct timing_loss *loss, const struct timing_rec *rec)
+{
+  const pj_timestamp *resp = first_resp(rec);
+
+  if (resp) {
+    unsigned idx = answered_attempt(rec, resp, rec->dest->rtt_min);
+    loss->attempts += idx + 1;
+    loss->lost += idx;
+  } else {
+    loss->timeouts++;
+    loss->attempts += attempts_cnt(rec);
+    loss->lost += attempts_cnt(rec);
+  }
+}
+
+/*
+ * Estimate loss from timer A/E backoff pattern. Minimal round trip
+ * per destination tells which attempt was answered. Round trip loss
+ * is lost attempts ratio, one-way loss assumes symmetric path:
+ * (1 - p)^2 = 1 - rt_loss
+ * Recycled records were counted with minimal round trip known then.
+ */
+static void estimate_loss (void)
+{
+  struct timing_rec *rec;
+  struct timing_dest *dest;
+
+  for (dest = dest_list.next; dest != &dest_list; dest = dest->next) {
+    dest->loss = dest->retired;
+  }
+
+  for (rec = timing_list.next; rec != &timing_list; rec = rec->next) {
+    rtt_update(rec);
+  }
+
+  for (rec = timing_list.next; rec != &timing_list; rec = rec->next) {
+    if (rec->dest) {
+      loss_add(&rec->dest->loss, rec);
+    }
+  }
+}
+
+static void dest_print (const struct timing_dest *dest)
+{
+  double rt_loss = dest->loss.attempts ? (double)dest->loss.lost / dest->loss.attempts : 0;
+  double loss = 1.0 - sqrt(1.0 - rt_loss);
+
+  PJ_LOG(3, (NAME, "  %.*s: %u requests, %u retransmissions, %u duplicate responses, "
+        "%u timeouts, estimated one-way loss %.1f%%",
+        (int)dest->name_len, dest->name,
+        dest->requests, dest->retrans, dest->dup_resp, dest->loss.timeouts,
+        loss * 100));
+}
+
+static void timing_dns_start (pjsip_tx_data *tdata)
+{
+  struct timing_rec *rec;
+
+  if (!is_timed_request(tdata)) {
+    return;
+  }
+  rec = tdata->mod_data[mod_timing.id];
+  // same tdata is re-sent after authentication challenge
+  if (rec == NULL || (rec->flags & TS_FIRST_TX)) {
+    rec = timing_rec_new(tdata);
+  }
+  pj_get_timestamp(&rec->dns_start);
+  rec->flags |= TS_DNS_START;
+}
+
+static void timing_dns_end (pjsip_tx_data *tdata)
+{
+  struct timing_rec *rec;
+
+  if (!is_timed_request(tdata)) {
+    return;
+  }
+  rec = tdata->mod_data[mod_timing.id];
+  if (rec && !(rec->flags & TS_DNS_END)) {
+    pj_get_timestamp(&rec->dns_end);
+    rec->flags |= TS_DNS_END;
+  }
+}
+
+/*
+ * Endpoint resolves both requests and responses with pjsip_send_state
+ * as token, so the tx data is known when resolution starts and ends.
+ */
+static void timing_resolve_cb (pj_status_t status,
+                               void *token,
+                               const struct pjsip_server_addresses *addr)
+{
+  struct timing_resolve_ctx *ctx = token;
+
+  timing_dns_end (((pjsip_send_state *)ctx->token)->tdata);
+
+  (*ctx->cb)(status, ctx->token, addr);
+}
+
+static void timing_resolve (pjsip_resolver_t *resolver,
+                            pj_pool_t *pool,
+                            const pjsip_host_info *target,
+                            void *token,
+                            pjsip_resolver_callback *cb)
+{
+  struct timing_resolve_ctx *ctx = PJ_POOL_ALLOC_T(pool, struct timing_resolve_ctx);
+
+  PJ_UNUSED_ARG(resolver);
+
+  ctx->token = token;
+  ctx->cb = cb;
+
+  timing_dns_start (((pjsip_send_state *)token)->tdata);
+
+  pjsip_resolve (inner_resv, pool, target, ctx, &timing_resolve_cb);
+}
+
+/*
+ * Move endpoint DNS resolver to own pjsip resolver and put timing
+ * wrapper in front of it. Endpoint resolver is detached first,
+ * otherwise setting external resolver destroys it.
+ */
+static pj_status_t timing_set_resolver (struct sippak_app *app)
+{
+  pj_status_t status;
+  pj_dns_resolver *dns_resv = pjsip_endpt_get_resolver(app->endpt);
+
+  status = pjsip_resolver_create(app->pool, &inner_resv);
+  SIPPAK_ASSERT_SUCC(status, "Failed to create timing resolver.");
+
+  if (dns_resv) {
+    pjsip_endpt_set_resolver(app->endpt, NULL);
+    pjsip_resolver_set_resolver(inner_resv, dns_resv);
+  }
+
+  return pjsip_endpt_set_ext_resolver(app->endpt, &timing_ext_resv);
+}
+
+PJ_DEF(void) sippak_timing_tx_request (pjsip_tx_data *tdata)
+{
+  struct timing_rec *rec;
+  pjsip_via_hdr *via;
+  char key[TIMING_MAX_KEY_LEN];
+  unsigned key_len;
+
+  if (!is_timed_request(tdata)) {
+    return;
+  }
+
+  via = pjsip_msg_find_hdr(tdata->msg, PJSIP_H_VIA, NULL);
+  if (via == NULL) {
+    return;
+  }
+  key_len = make_key(key, &tdata->msg->line.req.method.name, &via->branch_param);
+
+  rec = tdata->mod_data[mod_timing.id];
+  if (rec && (rec->flags & TS_FIRST_TX)) {
+    if (rec->key_len == key_len && pj_memcmp(rec->key, key, key_len) == 0) {
+      if (rec->retrans < SIPPAK_TIMING_MAX_RETRANS) {
+        pj_get_timestamp(&rec->retrans_ts[rec->retrans]);
+      }
+      rec->retrans++;
+      rec->dest->retrans++;
+      sippak_timeseries_retrans();
+      return;
+    }
+    rec = NULL; // new branch, new transaction
+  }
+  if (rec == NULL) {
+    rec = timing_rec_new(tdata);
+  }
+
+  pj_get_timestamp(&rec->first_tx);
+  rec->flags |= TS_FIRST_TX;
+  rec->tp = tdata->tp_info.transport;
+  rec->dest = timing_dest_get(tdata);
+  rec->dest->requests++;
+  pj_memcpy(rec->key, key, key_len);
+  rec->key_len = key_len;
+  // older record with same key loses its entry, entry buffer is its own
+  pj_hash_set_np(timing_ht, rec->key, rec->key_len, 0, NULL, NULL);
+  pj_hash_set_np(timing_ht, rec->key, rec->key_len, 0, rec->hent, rec);
+
+  sippak_timeseries_sent();
+}
+
+static void sum_add (struct timing_sum *sum, const struct timing_rec *rec)
+{
+  sum->total++;
+  sum->retrans += rec->retrans;
+  if (!(rec->flags & TS_FINAL)) {
+    sum->timeouts++;
+  }
+  if (rec->flags & TS_DNS_END) {
+    aggr_add(&sum->dns, elapsed(&rec->dns_start, &rec->dns_end));
+  }
+  if ((rec->flags & TS_CONNECT) && (rec->flags & TS_DNS_END)) {
+    aggr_add(&sum->conn, elapsed(&rec->dns_end, &rec->connect));
+  }
+  aggr_add(&sum->tx, elapsed(rec_start(rec), &rec->first_tx));
+  if (rec->flags & TS_PROVIS) {
+    aggr_add(&sum->prov, elapsed(&rec->first_tx, &rec->provis));
+  }
+  if (rec->flags & TS_FINAL) {
+    aggr_add(&sum->fin, elapsed(&rec->first_tx, &rec->final));
+  }
+}
+
+static void aggr_merge (struct timing_aggr *dst, const struct timing_aggr *src)
+{
+  if (src->cnt == 0) {
+    return;
+  }
+  if (dst->cnt == 0 || src->min < dst->min) {
+    dst->min = src->min;
+  }
+  if (src->max > dst->max) {
+    dst->max = src->max;
+  }
+  dst->sum += src->sum;
+  dst->cnt += src->cnt;
+}
+
+/* Fold record into summary and loss counters and put it to free list. */
+static void timing_rec_recycle (struct timing_rec *rec)
+{
+  if (rec->flags & TS_FIRST_TX) {
+    if (!(rec->flags & TS_FINAL) && local_app->cfg.timing) {
+      print_rec(rec);
+    }
+    sum_add(&retired_sum, rec);
+    if (pj_hash_get(timing_ht, rec->key, rec->key_len, NULL) == rec) {
+      pj_hash_set_np(timing_ht, rec->key, rec->key_len, 0, NULL, NULL);
+    }
+  }
+  if (rec->dest) {
+    rtt_update(rec);
+    loss_add(&rec->dest->retired, rec);
+  }
+  if (expire_cursor == rec) {
+    expire_cursor = &timing_list;
+  }
+  pj_list_erase(rec);
+  pj_list_push_back(&free_list, rec);
+}
+
+static void on_expire_timer (pj_timer_heap_t *ht, pj_timer_entry *entry)
+{
+  pj_time_val delay = { TIMING_EXPIRE_SEC, 0 };
+
+  PJ_UNUSED_ARG(ht);
+
+  sippak_timing_expire();
+
+  pjsip_endpt_schedule_timer(local_app->endpt, entry, &delay);
+}
+
+/*
+ * Mark requests without final response after timer B/F (64*T1) as
+ * timed out. Records are in send order, so scan stops at first one
+ * that is still within timeout. Records older than twice the timeout
+ * are recycled from the head of the list.
+ */
+PJ_DEF(void) sippak_timing_expire (void)
+{
+  pj_timestamp now;
+  struct timing_rec *rec;
+  pj_uint32_t timeout = pjsip_cfg()->tsx.t1 * 64 * 1000; // usec
+
+  if (mod_timing.id == -1) {
+    return;
+  }
+
+  while (expire_cursor->next != &timing_list
+      && (expire_cursor->next->flags & (TS_FINAL | TS_TIMEOUT))) {
+    expire_cursor = expire_cursor->next;
+  }
+
+  pj_get_timestamp(&now);
+  for (rec = expire_cursor->next; rec != &timing_list; rec = rec->next) {
+    if (!(rec->flags & TS_FIRST_TX) || (rec->flags & (TS_FINAL | TS_TIMEOUT))) {
+      continue;
+    }
+    if (elapsed(&rec->first_tx, &now) < timeout) {
+      break;
+    }
+    rec->flags |= TS_TIMEOUT;
+    sippak_timeseries_timeout();
+  }
+
+  while (!pj_list_empty(&timing_list)) {
+    rec = timing_list.next;
+    if (elapsed(rec_start(rec), &now) < 2 * timeout ||
+        ((rec->flags & TS_FIRST_TX) && !(rec->flags & (TS_FINAL | TS_TIMEOUT)))) {
+      break;
+    }
+    timing_rec_recycle(rec);
+  }
+}
+
+PJ_DEF(void) sippak_timing_report (struct sippak_app *app)
+{
+  struct timing_rec *rec;
+  struct timing_dest *dest;
+  struct timing_sum sum;
+
+  if (mod_timing.id == -1 || !app->cfg.timing) {
+    return;
+  }
+
+  pj_bzero(&sum, sizeof(sum));
+  for (rec = timing_list.next; rec != &timing_list; rec = rec->next) {
+    if (!(rec->flags & TS_FIRST_TX)) {
+      continue; // never sent, DNS failure
+    }
+    if (!(rec->flags & TS_FINAL)) {
+      print_rec(rec);
+    }
+    sum_add(&sum, rec);
+  }
+
+  sum.total += retired_sum.total;
+  sum.timeouts += retired_sum.timeouts;
+  sum.retrans += retired_sum.retrans;
+  aggr_merge(&sum.dns, &retired_sum.dns);
+  aggr_merge(&sum.conn, &retired_sum.conn);
+  aggr_merge(&sum.tx, &retired_sum.tx);
+  aggr_merge(&sum.prov, &retired_sum.prov);
+  aggr_merge(&sum.fin, &retired_sum.fin);
+
+  PJ_LOG(3, (NAME, "Timing summary: %u requests, %u without final response, %u retransmissions",
+        sum.total, sum.timeouts, sum.retrans));
+  aggr_print("dns", &sum.dns);
+  aggr_print("connect", &sum.conn);
+  aggr_print("first tx", &sum.tx);
+  aggr_print("1xx", &sum.prov);
+  aggr_print("final", &sum.fin);
+
+  estimate_loss();
+  PJ_LOG(3, (NAME, "Retransmissions per destination:"));
+  for (dest = dest_list.next; dest != &dest_list; dest = dest->next) {
+    dest_print(dest);
+  }
+}
+
+PJ_DEF(pj_status_t) sippak_mod_timing_register (struct sippak_app *app)
+{
+  pj_status_t status;
+  pjsip_tpmgr *tpmgr = pjsip_endpt_get_tpmgr(app->endpt);
+  pj_time_val delay = { TIMING_EXPIRE_SEC, 0 };
+
+  local_app = app;
+  pj_list_init(&timing_list);
+  pj_list_init(&free_list);
+  expire_cursor = &timing_list;
+  timing_ht = pj_hash_create(app->pool, TIMING_HASH_SIZE);
+  pj_list_init(&dest_list);
+  dest_ht = pj_hash_create(app->pool, TIMING_HASH_SIZE);
+
+  prev_tp_state_cb = pjsip_tpmgr_get_state_cb(tpmgr);
+  pjsip_tpmgr_set_state_cb(tpmgr, &on_tp_state);
+
+  status = timing_set_resolver (app);
+  SIPPAK_ASSERT_SUCC(status, "Failed to set timing resolver.");
+
+  pj_timer_entry_init(&expire_timer, 0, NULL, &on_expire_timer);
+  status = pjsip_endpt_schedule_timer(app->endpt, &expire_timer, &delay);
+  SIPPAK_ASSERT_SUCC(status, "Failed to schedule timing expire timer.");
+
+  return pjsip_endpt_register_module(app->endpt, &mod_timing);
+}
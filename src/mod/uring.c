@@ -0,0 +1,409 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file uring.c
+ * @brief sippak UDP I/O with io_uring
+ *
+ * Works on socket of pjsip UDP transport, which is paused while engine
+ * owns it. Outgoing datagrams are queued as sendmsg entries and
+ * submitted together, buffers are recycled when completions arrive.
+ * Incoming datagrams come from one multishot recvmsg into ring of
+ * buffers registered with kernel, so no receive call is made per
+ * packet. Poll waits on completion queue instead of select in pjsip
+ * ioqueue. Payload is copied once from provided buffer into rx data:
+ * packet buffer is inside rx data and kernel writes recvmsg header in
+ * front of payload, so buffer can not be handed over as it is. When
+ * all send slots are busy, completions are reaped inside the send
+ * path, received datagrams are then kept in their buffers and
+ * delivered on next poll, so the stack is never entered while the
+ * caller sends.
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+#include "sippak.h"
+
+#define NAME "mod_uring"
+
+#ifdef HAVE_URING
+
+#include <errno.h>
+#include <string.h>
+#include <liburing.h>
+
+#define UR_DEPTH 512            // submission queue entries
+#define UR_TX_SLOTS 256         // datagrams in flight
+#define UR_RX_BUFS 256          // provided receive buffers, power of two
+#define UR_RX_BUF_LEN (PJSIP_MAX_PKT_LEN + 256) // recvmsg header, name and payload
+#define UR_BGID 0
+#define UR_RX_TAG 0xffffffffffffffffULL
+
+struct ur_tx {
+  struct msghdr msg;
+  struct iovec iov;
+  pj_sockaddr addr;
+  char *buf;
+};
+
+static struct {
+  pj_pool_t *pool;
+  pj_pool_t *rx_pool;
+  pjsip_transport *tp;
+  int sock;
+  struct io_uring ring;
+  pj_bool_t ring_ready;
+
+  struct ur_tx tx[UR_TX_SLOTS];
+  unsigned tx_free[UR_TX_SLOTS]; // stack of free slots
+  unsigned tx_free_cnt;
+  unsigned sq_pending;          // entries prepared, not submitted
+
+  struct io_uring_buf_ring *br;
+  char *rx_buf;
+  struct msghdr rx_msg;         // layout of multishot recvmsg buffers
+  pjsip_rx_data *rdata;
+  struct {
+    unsigned bid;
+    int len;
+  } rx_pend[UR_RX_BUFS];        // received while sending, not delivered
+  unsigned rx_pend_cnt;
+
+  pj_uint64_t tx_pkts;
+  pj_uint64_t tx_errors;
+  pj_uint64_t submits;
+  pj_uint64_t rx_pkts;
+  pj_uint64_t rx_nobufs;
+} ur;
+
+static void rx_arm (void)
+{
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&ur.ring);
+
+  if (sqe == NULL) {
+    io_uring_submit(&ur.ring);
+    sqe = io_uring_get_sqe(&ur.ring);
+  }
+  io_uring_prep_recvmsg_multishot(sqe, ur.sock, &ur.rx_msg, 0);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = UR_BGID;
+  io_uring_sqe_set_data64(sqe, UR_RX_TAG);
+  ur.sq_pending++;
+}
+
+static pj_status_t ur_init (pjsip_endpoint *endpt, pjsip_transport *tp, pj_size_t tx_max)
+{
+  int ret;
+  unsigned i;
+
+  pj_bzero(&ur, sizeof(ur));
+
+  ret = io_uring_queue_init(UR_DEPTH, &ur.ring, 0);
+  if (ret < 0) {
+    PJ_LOG(1, (NAME, "Failed to create io_uring: %s.", strerror(-ret)));
+    return PJ_RETURN_OS_ERROR(-ret);
+  }
+  ur.ring_ready = PJ_TRUE;
+
+  ur.br = io_uring_setup_buf_ring(&ur.ring, UR_RX_BUFS, UR_BGID, 0, &ret);
+  if (ur.br == NULL) {
+    PJ_LOG(1, (NAME, "Kernel does not support io_uring provided buffer ring."));
+    io_uring_queue_exit(&ur.ring);
+    ur.ring_ready = PJ_FALSE;
+    return PJ_ENOTSUP;
+  }
+
+  ur.pool = pjsip_endpt_create_pool(endpt, "uring", POOL_INIT, POOL_INCR);
+  ur.rx_pool = pjsip_endpt_create_pool(endpt, "uring_rx", PJSIP_POOL_RDATA_LEN, PJSIP_POOL_RDATA_INC);
+  ur.tp = tp;
+  ur.sock = (int)pjsip_udp_transport_get_socket(tp);
+
+  for (i = 0; i < UR_TX_SLOTS; i++) {
+    ur.tx[i].buf = pj_pool_alloc(ur.pool, tx_max);
+    ur.tx_free[i] = UR_TX_SLOTS - 1 - i;
+  }
+  ur.tx_free_cnt = UR_TX_SLOTS;
+
+  // receive buffers are handed to kernel once and returned after use
+  ur.rx_buf = pj_pool_alloc(ur.pool, UR_RX_BUFS * UR_RX_BUF_LEN);
+  for (i = 0; i < UR_RX_BUFS; i++) {
+    io_uring_buf_ring_add(ur.br, ur.rx_buf + i * UR_RX_BUF_LEN, UR_RX_BUF_LEN,
+        i, io_uring_buf_ring_mask(UR_RX_BUFS), i);
+  }
+  io_uring_buf_ring_advance(ur.br, UR_RX_BUFS);
+
+  ur.rx_msg.msg_namelen = sizeof(pj_sockaddr);
+  ur.rdata = PJ_POOL_ZALLOC_T(ur.pool, pjsip_rx_data);
+  ur.rdata->tp_info.pool = ur.rx_pool;
+  ur.rdata->tp_info.transport = tp;
+  ur.rdata->tp_info.op_key.rdata = ur.rdata;
+  pj_ioqueue_op_key_init(&ur.rdata->tp_info.op_key.op_key, sizeof(pj_ioqueue_op_key_t));
+
+  rx_arm();
+  io_uring_submit(&ur.ring);
+  ur.sq_pending = 0;
+
+  return PJ_SUCCESS;
+}
+
+static void rx_deliver (char *buf, int len)
+{
+  struct io_uring_recvmsg_out *out;
+  pjsip_rx_data *rdata = ur.rdata;
+  unsigned plen;
+
+  out = io_uring_recvmsg_validate(buf, len, &ur.rx_msg);
+  if (out == NULL || (out->flags & MSG_TRUNC)) {
+    return;
+  }
+  plen = io_uring_recvmsg_payload_length(out, len, &ur.rx_msg);
+  if (plen >= sizeof(rdata->pkt_info.packet)) {
+    return;
+  }
+
+  pj_bzero(&rdata->endpt_info, sizeof(rdata->endpt_info));
+  pj_memcpy(rdata->pkt_info.packet, io_uring_recvmsg_payload(out, &ur.rx_msg), plen);
+  rdata->pkt_info.len = plen;
+  rdata->pkt_info.zero = 0;
+  pj_memcpy(&rdata->pkt_info.src_addr, io_uring_recvmsg_name(out),
+      PJ_MIN(out->namelen, sizeof(rdata->pkt_info.src_addr)));
+  rdata->pkt_info.src_addr_len = out->namelen;
+  pj_gettimeofday(&rdata->pkt_info.timestamp);
+  pj_sockaddr_print(&rdata->pkt_info.src_addr, rdata->pkt_info.src_name,
+      sizeof(rdata->pkt_info.src_name), 0);
+  rdata->pkt_info.src_port = pj_sockaddr_get_port(&rdata->pkt_info.src_addr);
+
+  pjsip_tpmgr_receive_packet(ur.tp->tpmgr, rdata);
+  pj_pool_reset(ur.rx_pool);
+
+  ur.rx_pkts++;
+}
+
+/* Deliver datagram and give buffer back to kernel. */
+static void rx_complete (unsigned bid, int len)
+{
+  rx_deliver(ur.rx_buf + bid * UR_RX_BUF_LEN, len);
+  io_uring_buf_ring_add(ur.br, ur.rx_buf + bid * UR_RX_BUF_LEN, UR_RX_BUF_LEN,
+      bid, io_uring_buf_ring_mask(UR_RX_BUFS), 0);
+  io_uring_buf_ring_advance(ur.br, 1);
+}
+
+/* Deliver datagrams kept by send path. Delivery may add more. */
+static unsigned rx_drain (void)
+{
+  unsigned i;
+
+  for (i = 0; i < ur.rx_pend_cnt; i++) {
+    rx_complete(ur.rx_pend[i].bid, ur.rx_pend[i].len);
+  }
+  ur.rx_pend_cnt = 0;
+
+  return i;
+}
+
+/*
+ * Consume completions without waiting. Received datagrams are
+ * delivered to stack only when "deliver" is set, otherwise they stay
+ * in their buffers until next delivering call. Returns datagrams
+ * delivered.
+ */
+static unsigned reap (pj_bool_t deliver)
+{
+  struct io_uring_cqe *cqe;
+  pj_uint64_t data;
+  unsigned flags, bid, rx = 0;
+  int res;
+
+  if (deliver) {
+    rx += rx_drain();
+  }
+
+  while (io_uring_peek_cqe(&ur.ring, &cqe) == 0) {
+    data = io_uring_cqe_get_data64(cqe);
+    res = cqe->res;
+    flags = cqe->flags;
+    io_uring_cqe_seen(&ur.ring, cqe);
+
+    if (data != UR_RX_TAG) {
+      if (res < 0) {
+        ur.tx_errors++;
+      }
+      ur.tx_free[ur.tx_free_cnt++] = (unsigned)data;
+      continue;
+    }
+
+    if (res == -ENOBUFS) {
+      ur.rx_nobufs++;
+    }
+    if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+      bid = flags >> IORING_CQE_BUFFER_SHIFT;
+      if (deliver) {
+        rx_complete(bid, res);
+        rx++;
+      } else {
+        // at most UR_RX_BUFS buffers are held by completions
+        ur.rx_pend[ur.rx_pend_cnt].bid = bid;
+        ur.rx_pend[ur.rx_pend_cnt].len = res;
+        ur.rx_pend_cnt++;
+      }
+    }
+    // multishot ends on error or when buffers run out
+    if (!(flags & IORING_CQE_F_MORE)) {
+      rx_arm();
+    }
+  }
+
+  // kept by send path called from stack during delivery above
+  if (deliver) {
+    rx += rx_drain();
+  }
+
+  return rx;
+}
+
+static pj_status_t ur_flush (void)
+{
+  int ret;
+
+  if (ur.sq_pending == 0) {
+    return PJ_SUCCESS;
+  }
+  ret = io_uring_submit(&ur.ring);
+  if (ret < 0) {
+    return PJ_RETURN_OS_ERROR(-ret);
+  }
+  ur.submits++;
+  ur.sq_pending = 0;
+
+  return PJ_SUCCESS;
+}
+
+static char *ur_tx_buf (void)
+{
+  if (ur.tx_free_cnt == 0) {
+    // caller may be in the middle of its own lists, so no delivery here
+    ur_flush();
+    reap(PJ_FALSE);
+    if (ur.tx_free_cnt == 0) {
+      return NULL; // all slots in flight
+    }
+  }
+  return ur.tx[ur.tx_free[ur.tx_free_cnt - 1]].buf;
+}
+
+static void ur_tx_push (pj_size_t len, const pj_sockaddr *dst, int dst_len)
+{
+  unsigned i = ur.tx_free[--ur.tx_free_cnt];
+  struct ur_tx *tx = &ur.tx[i];
+  struct io_uring_sqe *sqe;
+
+  pj_memcpy(&tx->addr, dst, dst_len);
+  tx->iov.iov_base = tx->buf;
+  tx->iov.iov_len = len;
+  pj_bzero(&tx->msg, sizeof(tx->msg));
+  tx->msg.msg_name = &tx->addr;
+  tx->msg.msg_namelen = dst_len;
+  tx->msg.msg_iov = &tx->iov;
+  tx->msg.msg_iovlen = 1;
+
+  sqe = io_uring_get_sqe(&ur.ring);
+  if (sqe == NULL) {
+    ur_flush();
+    sqe = io_uring_get_sqe(&ur.ring);
+  }
+  io_uring_prep_sendmsg(sqe, ur.sock, &tx->msg, 0);
+  io_uring_sqe_set_data64(sqe, i);
+  ur.sq_pending++;
+  ur.tx_pkts++;
+}
+
+static unsigned ur_poll (pj_time_val *timeout)
+{
+  struct io_uring_cqe *cqe;
+  struct __kernel_timespec ts;
+  unsigned rx;
+
+  ur_flush();
+
+  rx = reap(PJ_TRUE);
+  if (rx == 0 && timeout && PJ_TIME_VAL_MSEC(*timeout) > 0) {
+    ts.tv_sec = timeout->sec;
+    ts.tv_nsec = timeout->msec * 1000000L;
+    io_uring_wait_cqe_timeout(&ur.ring, &cqe, &ts);
+    rx = reap(PJ_TRUE);
+  }
+
+  // readiness is handled here, endpoint only runs timers
+  if (timeout) {
+    timeout->sec = 0;
+    timeout->msec = 0;
+  }
+
+  return rx;
+}
+
+static void ur_report (void)
+{
+  PJ_LOG(3, (NAME, "io_uring: sent %llu datagrams in %llu submits, %llu send errors, "
+        "received %llu datagrams, %llu times out of buffers.",
+        ur.tx_pkts, ur.submits, ur.tx_errors, ur.rx_pkts, ur.rx_nobufs));
+}
+
+static void ur_destroy (void)
+{
+  if (!ur.ring_ready) {
+    return;
+  }
+  io_uring_free_buf_ring(&ur.ring, ur.br, UR_RX_BUFS, UR_BGID);
+  io_uring_queue_exit(&ur.ring);
+  pj_pool_release(ur.rx_pool);
+  pj_pool_release(ur.pool);
+  ur.ring_ready = PJ_FALSE;
+}
+
+#else /* HAVE_URING */
+
+static pj_status_t ur_init (pjsip_endpoint *endpt, pjsip_transport *tp, pj_size_t tx_max)
+{
+  PJ_UNUSED_ARG(endpt);
+  PJ_UNUSED_ARG(tp);
+  PJ_UNUSED_ARG(tx_max);
+  PJ_LOG(1, (NAME, "sippak is built without io_uring support."));
+  return PJ_ENOTSUP;
+}
+
+static char *ur_tx_buf (void) { return NULL; }
+static void ur_tx_push (pj_size_t len, const pj_sockaddr *dst, int dst_len) {}
+static pj_status_t ur_flush (void) { return PJ_ENOTSUP; }
+static unsigned ur_poll (pj_time_val *timeout) { return 0; }
+static void ur_report (void) {}
+static void ur_destroy (void) {}
+
+#endif /* HAVE_URING */
+
+const struct sippak_udp_io sippak_uring_io = {
+  "io_uring",
+  &ur_init,
+  &ur_tx_buf,
+  &ur_tx_push,
+  &ur_flush,
+  &ur_poll,
+  &ur_report,
+  &ur_destroy
+};
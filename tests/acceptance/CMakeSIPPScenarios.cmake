@@ -99,6 +99,10 @@ add_test ( MESSAGE_method_auth
   perl ${CMAKE_CURRENT_SOURCE_DIR}/test.message_auth.pl
   ${EXECMD} ${SIPP} ${SIPP_SCENARIO_PATH})
 
+add_test ( MESSAGE_scenario_auth
+  perl ${CMAKE_CURRENT_SOURCE_DIR}/test.scenario_auth.pl
+  ${EXECMD} ${SIPP} ${SIPP_SCENARIO_PATH})
+
 add_test ( INVITE_method_send
   perl ${CMAKE_CURRENT_SOURCE_DIR}/test.invite_basic.pl
   ${EXECMD} ${SIPP} ${SIPP_SCENARIO_PATH})
@@ -0,0 +1,49 @@
+#
+# Acceptence test:
+# Run sippak scenario with two authenticated MESSAGE steps
+#
+
+use strict;
+use warnings;
+use Socket;
+use Cwd qw(abs_path);
+use File::Basename;
+use Test::More;
+
+my $sippak = $ARGV[0];
+my $sipp   = $ARGV[1];
+my $scenario = $ARGV[2] . "/message.auth.xml";
+my $sippargs = "-timeout 10s -p 5060 -m 2 -bg";
+my $steps = "/tmp/sippak.scenario_auth.txt";
+my $output = "";
+my $regex  = "";
+my @found;
+
+# every step is challenged and answers challenge with own credentials
+open(my $fh, '>', $steps) or die "Failed to write $steps";
+print $fh "message --body=\"Hello\" sip:alice\@127.0.0.1:5060\n";
+print $fh "message --body=\"Hello again\" sip:alice\@127.0.0.1:5060\n";
+close($fh);
+
+# run sipp scenario in background mode
+system("$sipp $sippargs -sf $scenario");
+if ($? == -1) {
+  print "Failed execute sipp\n";
+  exit(1);
+}
+
+$output = `$sippak --scenario=$steps -u alice -p pa55w0rd`;
+unlink($steps);
+
+$regex = '^SIP/2.0 407 Message Proxy Authentication$';
+@found = ($output =~ m/$regex/mg);
+is (scalar @found, 2, "Both steps are challenged.");
+
+$regex = '^SIP\/2.0 200 OK Auth$';
+@found = ($output =~ m/$regex/mg);
+is (scalar @found, 2, "Both steps are authenticated.");
+
+$regex = 'Authentication failed';
+ok ($output !~ m/$regex/m, "Second step does not fail authentication.");
+
+done_testing();
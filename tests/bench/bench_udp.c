@@ -0,0 +1,290 @@
+/**
+ * sippak -- SIP command line utility.
+ * Copyright (C) 2018, Stas Kobzar <staskobzar@modulis.ca>
+ *
+ * This file is part of sippak.
+ *
+ * sippak is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * sippak is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with sippak.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file bench_udp.c
+ * @brief Packets per second of stock pjsip UDP transport vs I/O backends
+ *
+ * TX: requests are written to sink socket on loopback one sendto per
+ * packet, then through every UDP I/O backend available.
+ * RX: blaster thread floods transport with responses. They are read
+ * by ioqueue of pjsip_endpt_handle_events, then by every backend.
+ * All paths parse packets and deliver them to module that counts.
+ *
+ * Rate per core is packets divided by CPU time of measuring thread.
+ *
+ * Usage: bench_udp [seconds]
+ *
+ * @author Stas Kobzar <stas.kobzar@modulis.ca>
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "sippak.h"
+
+#define BENCH_PKT \
+  "OPTIONS sip:bench@127.0.0.1 SIP/2.0\r\n" \
+  "Via: SIP/2.0/UDP 127.0.0.1:5060;rport;branch=z9hG4bK0000000000000001\r\n" \
+  "Max-Forwards: 70\r\n" \
+  "From: <sip:sippak@127.0.0.1>;tag=0000000000000001\r\n" \
+  "To: <sip:bench@127.0.0.1>\r\n" \
+  "Call-ID: 00000000000000000000000000000001\r\n" \
+  "CSeq: 1 OPTIONS\r\n" \
+  "Content-Length:     0\r\n\r\n"
+
+static pj_caching_pool cp;
+static pjsip_endpoint *endpt;
+static pjsip_transport *tp;
+static char resp[PJSIP_MAX_PKT_LEN];
+static int resp_len;
+static volatile pj_uint64_t rx_cnt;
+static volatile int blasting;
+
+static pj_bool_t on_rx_response (pjsip_rx_data *rdata)
+{
+  PJ_UNUSED_ARG(rdata);
+  rx_cnt++;
+  return PJ_TRUE;
+}
+
+static pjsip_module mod_bench =
+{
+  NULL, NULL,                 /* prev, next.    */
+  { "mod-bench", 9 },         /* Name.    */
+  -1,                         /* Id      */
+  PJSIP_MOD_PRIORITY_TRANSPORT_LAYER, /* Priority          */
+  NULL,                       /* load()    */
+  NULL,                       /* start()    */
+  NULL,                       /* stop()    */
+  NULL,                       /* unload()    */
+  NULL,                       /* on_rx_request()  */
+  &on_rx_response,            /* on_rx_response()  */
+  NULL,                       /* on_tx_request.  */
+  NULL,                       /* on_tx_response()  */
+  NULL,                       /* on_tsx_state()  */
+};
+
+static double now_sec (clockid_t clk)
+{
+  struct timespec ts;
+  clock_gettime(clk, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report (const char *name, pj_uint64_t pkts, double wall, double cpu)
+{
+  printf("%-12s %12llu %14.0f %14.0f\n", name, (unsigned long long)pkts,
+      pkts / wall, cpu > 0 ? pkts / cpu : 0.0);
+}
+
+static int sink_open (pj_sockaddr *addr)
+{
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  socklen_t len = sizeof(*addr);
+  pj_str_t host = pj_str("127.0.0.1");
+
+  pj_sockaddr_init(pj_AF_INET(), addr, &host, 0);
+  bind(sock, (struct sockaddr *)addr, pj_sockaddr_get_len(addr));
+  getsockname(sock, (struct sockaddr *)addr, &len);
+
+  return sock;
+}
+
+/* "io" is NULL for stock transport */
+static void bench_tx (double seconds, const struct sippak_udp_io *io)
+{
+  pj_sockaddr dst;
+  int sink = sink_open(&dst);
+  int dst_len = pj_sockaddr_get_len(&dst);
+  pj_sock_t sock = pjsip_udp_transport_get_socket(tp);
+  pj_ssize_t len;
+  pj_uint64_t pkts = 0;
+  double wall, cpu, end;
+  char *buf, name[32];
+  unsigned i;
+
+  wall = now_sec(CLOCK_MONOTONIC);
+  cpu = now_sec(CLOCK_THREAD_CPUTIME_ID);
+  end = wall + seconds;
+
+  while (now_sec(CLOCK_MONOTONIC) < end) {
+    for (i = 0; i < SIPPAK_MMSG_BATCH; i++) {
+      if (io) {
+        buf = io->tx_buf();
+        if (buf == NULL) {
+          break;
+        }
+        pj_memcpy(buf, BENCH_PKT, sizeof(BENCH_PKT) - 1);
+        io->tx_push(sizeof(BENCH_PKT) - 1, &dst, dst_len);
+        pkts++;
+      } else {
+        len = sizeof(BENCH_PKT) - 1;
+        if (pj_sock_sendto(sock, BENCH_PKT, &len, 0, &dst, dst_len) == PJ_SUCCESS) {
+          pkts++;
+        }
+      }
+    }
+    if (io) {
+      io->flush();
+      io->poll(NULL);
+    }
+  }
+
+  wall = now_sec(CLOCK_MONOTONIC) - wall;
+  cpu = now_sec(CLOCK_THREAD_CPUTIME_ID) - cpu;
+  pj_ansi_snprintf(name, sizeof(name), "tx %s", io ? io->name : "sendto");
+  report(name, pkts, wall, cpu);
+  close(sink);
+}
+
+/* Floods transport with responses until "blasting" is cleared. */
+static int blaster (void *arg)
+{
+  pj_sockaddr *dst = arg;
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+#ifdef HAVE_MMSG
+  struct mmsghdr hdr[SIPPAK_MMSG_BATCH];
+  struct iovec iov;
+  unsigned i;
+
+  iov.iov_base = resp;
+  iov.iov_len = resp_len;
+  pj_bzero(hdr, sizeof(hdr));
+  for (i = 0; i < SIPPAK_MMSG_BATCH; i++) {
+    hdr[i].msg_hdr.msg_name = dst;
+    hdr[i].msg_hdr.msg_namelen = pj_sockaddr_get_len(dst);
+    hdr[i].msg_hdr.msg_iov = &iov;
+    hdr[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  while (blasting) {
+    sendmmsg(sock, hdr, SIPPAK_MMSG_BATCH, 0);
+  }
+#else
+  while (blasting) {
+    sendto(sock, resp, resp_len, 0, (struct sockaddr *)dst, pj_sockaddr_get_len(dst));
+  }
+#endif
+  close(sock);
+
+  return 0;
+}
+
+static void bench_rx (pj_pool_t *pool, double seconds, const struct sippak_udp_io *io)
+{
+  pj_thread_t *thread;
+  pj_sockaddr dst;
+  pj_time_val zero = {0, 0};
+  double wall, cpu, end;
+  char name[32];
+
+  pj_sockaddr_cp(&dst, &tp->local_addr);
+
+  blasting = 1;
+  pj_thread_create(pool, "blaster", &blaster, &dst, 0, 0, &thread);
+
+  rx_cnt = 0;
+  wall = now_sec(CLOCK_MONOTONIC);
+  cpu = now_sec(CLOCK_THREAD_CPUTIME_ID);
+  end = wall + seconds;
+
+  while (now_sec(CLOCK_MONOTONIC) < end) {
+    if (io) {
+      io->poll(&zero);
+    } else {
+      pjsip_endpt_handle_events(endpt, &zero);
+    }
+  }
+
+  wall = now_sec(CLOCK_MONOTONIC) - wall;
+  cpu = now_sec(CLOCK_THREAD_CPUTIME_ID) - cpu;
+  pj_ansi_snprintf(name, sizeof(name), "rx %s", io ? io->name : "ioqueue");
+  report(name, rx_cnt, wall, cpu);
+
+  blasting = 0;
+  pj_thread_join(thread);
+  pj_thread_destroy(thread);
+
+  // drain leftovers so next run starts clean
+  if (io) {
+    while (io->poll(&zero) > 0);
+  } else {
+    pjsip_endpt_handle_events(endpt, &zero);
+  }
+}
+
+int main (int argc, char *argv[])
+{
+  pj_status_t status;
+  pj_pool_t *pool;
+  pj_sockaddr addr;
+  const struct sippak_udp_io *io[] = { &sippak_mmsg_io, &sippak_uring_io };
+  unsigned i;
+  pj_str_t host = pj_str("127.0.0.1");
+  double seconds = argc > 1 ? atof(argv[1]) : 3;
+
+  pj_log_set_level(1);
+  pj_init();
+  pj_caching_pool_init(&cp, &pj_pool_factory_default_policy, 0);
+
+  status = pjsip_endpt_create(&cp.factory, "bench_udp", &endpt);
+  PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+  pool = pjsip_endpt_create_pool(endpt, "bench", POOL_INIT, POOL_INCR);
+
+  pj_sockaddr_init(pj_AF_INET(), &addr, &host, 0);
+  status = pjsip_udp_transport_start(endpt, &addr.ipv4, NULL, 1, &tp);
+  PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+
+  status = pjsip_endpt_register_module(endpt, &mod_bench);
+  PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+
+  // sent-by must match transport or endpoint drops response
+  resp_len = pj_ansi_snprintf(resp, sizeof(resp),
+      "SIP/2.0 200 OK\r\n"
+      "Via: SIP/2.0/UDP %.*s:%d;branch=z9hG4bK0000000000000001\r\n"
+      "From: <sip:sippak@127.0.0.1>;tag=0000000000000001\r\n"
+      "To: <sip:bench@127.0.0.1>;tag=1\r\n"
+      "Call-ID: 00000000000000000000000000000001\r\n"
+      "CSeq: 1 OPTIONS\r\n"
+      "Content-Length: 0\r\n\r\n",
+      (int)tp->local_name.host.slen, tp->local_name.host.ptr, tp->local_name.port);
+
+  printf("%-12s %12s %14s %14s\n", "mode", "packets", "pkt/s", "pkt/s/core");
+  bench_tx(seconds, NULL);
+  bench_rx(pool, seconds, NULL);
+
+  for (i = 0; i < PJ_ARRAY_SIZE(io); i++) {
+    if (io[i]->init(endpt, tp, PJSIP_MAX_PKT_LEN) != PJ_SUCCESS) {
+      printf("%-12s not available\n", io[i]->name);
+      continue;
+    }
+    bench_tx(seconds, io[i]);
+    bench_rx(pool, seconds, io[i]);
+    io[i]->destroy();
+  }
+  pj_pool_release(pool);
+  pjsip_endpt_destroy(endpt);
+  pj_caching_pool_destroy(&cp);
+
+  return 0;
+}
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "sippak.h"
+
+#define CACHE_FILE "test_auth_cache.txt"
+#define FILE_ENTRY "127.0.0.1:5061\tfile\tfnonce\tfopaque\t5\t1\t0\n"
+
+#define CHALLENGE(code, reason, hdr) \
+  "SIP/2.0 " code " " reason "\r\n" \
+  "Via: SIP/2.0/UDP 127.0.0.1;branch=z9hG4bKauthcache\r\n" \
+  "From: <sip:alice@127.0.0.1>;tag=1\r\n" \
+  "To: <sip:bob@127.0.0.1>;tag=2\r\n" \
+  "Call-ID: authcache\r\n" \
+  "CSeq: 1 OPTIONS\r\n" \
+  hdr "\r\n" \
+  "Content-Length: 0\r\n\r\n"
+
+pjsip_endpoint *endpt;
+pj_pool_t *pool;
+static struct sippak_app app;
+
+/* Response from src:port passed to modules as if received from network. */
+static void rx_response (int port, const char *msg)
+{
+  pjsip_rx_data *rdata = PJ_POOL_ZALLOC_T(pool, pjsip_rx_data);
+  pjsip_process_rdata_param param;
+  pj_size_t len = pj_ansi_strlen(msg);
+
+  rdata->tp_info.pool = pool;
+  pj_memcpy(rdata->pkt_info.packet, msg, len);
+  rdata->pkt_info.len = len;
+  pj_ansi_strcpy(rdata->pkt_info.src_name, "127.0.0.1");
+  rdata->pkt_info.src_port = port;
+  assert_non_null (pjsip_parse_rdata(rdata->pkt_info.packet, len, rdata));
+
+  pjsip_process_rdata_param_default(&param);
+  param.silent = PJ_TRUE;
+  pjsip_endpt_process_rx_data(endpt, rdata, &param, NULL);
+}
+
+/* Send OPTIONS from user over loop transport, return Authorization added by cache. */
+static pjsip_authorization_hdr *tx_request_from (int port, const char *user, pj_bool_t skip)
+{
+  pjsip_method method = { PJSIP_OPTIONS_METHOD, { "OPTIONS", 7 } };
+  pjsip_authorization_hdr *hdr;
+  pjsip_tx_data *tdata;
+  char target[64], from_uri[64];
+  pj_str_t uri, from;
+
+  from.ptr = from_uri;
+  from.slen = pj_ansi_snprintf(from_uri, sizeof(from_uri), "<sip:%s@127.0.0.1>", user);
+
+  uri.ptr = target;
+  uri.slen = pj_ansi_snprintf(target, sizeof(target),
+      "sip:bob@127.0.0.1:%d;transport=loop-dgram", port);
+
+  assert_int_equal (PJ_SUCCESS, pjsip_endpt_create_request(endpt, &method,
+        &uri, &from, &uri, NULL, NULL, -1, NULL, &tdata));
+  if (skip) {
+    sippak_auth_cache_skip(tdata);
+  }
+  pjsip_tx_data_add_ref(tdata);
+  assert_int_equal (PJ_SUCCESS, pjsip_endpt_send_request_stateless(endpt, tdata, NULL, NULL));
+
+  hdr = pjsip_msg_find_hdr(tdata->msg, PJSIP_H_AUTHORIZATION, NULL);
+  pjsip_tx_data_dec_ref(tdata);
+
+  return hdr;
+}
+
+static pjsip_authorization_hdr *tx_request (int port)
+{
+  return tx_request_from(port, "alice", PJ_FALSE);
+}
+
+static void assert_pj_str (const char *expect, const pj_str_t *val)
+{
+  assert_int_equal (pj_ansi_strlen(expect), val->slen);
+  assert_memory_equal (expect, val->ptr, val->slen);
+}
+
+static void loaded_entry_increments_nc (void **state)
+{
+  pjsip_authorization_hdr *hdr;
+  (void) state;
+
+  hdr = tx_request(5061);
+  assert_non_null (hdr);
+  assert_pj_str ("file", &hdr->credential.digest.realm);
+  assert_pj_str ("fnonce", &hdr->credential.digest.nonce);
+  assert_pj_str ("fopaque", &hdr->credential.digest.opaque);
+  assert_pj_str ("auth", &hdr->credential.digest.qop);
+  assert_pj_str ("00000006", &hdr->credential.digest.nc);
+
+  hdr = tx_request(5061);
+  assert_non_null (hdr);
+  assert_pj_str ("00000007", &hdr->credential.digest.nc);
+}
+
+static void unknown_server_not_authorized (void **state)
+{
+  (void) state;
+  assert_null (tx_request(5060));
+}
+
+static void other_user_not_authorized (void **state)
+{
+  (void) state;
+  assert_null (tx_request_from(5061, "bob", PJ_FALSE));
+  // request with own auth session
+  assert_null (tx_request_from(5061, "alice", PJ_TRUE));
+}
+
+static void challenge_qop_auth_int_only (void **state)
+{
+  (void) state;
+
+  rx_response(5062, CHALLENGE("401", "Unauthorized",
+        "WWW-Authenticate: Digest realm=\"test\", nonce=\"n1\", qop=\"auth-int\""));
+  assert_null (tx_request(5062));
+}
+
+static void challenge_qop_auth_in_list (void **state)
+{
+  pjsip_authorization_hdr *hdr;
+  (void) state;
+
+  rx_response(5062, CHALLENGE("401", "Unauthorized",
+        "WWW-Authenticate: Digest realm=\"test\", nonce=\"n1\", qop=\"auth-int,auth\""));
+
+  // command answered challenge with nc 1
+  hdr = tx_request(5062);
+  assert_non_null (hdr);
+  assert_pj_str ("test", &hdr->credential.digest.realm);
+  assert_pj_str ("n1", &hdr->credential.digest.nonce);
+  assert_pj_str ("00000002", &hdr->credential.digest.nc);
+}
+
+static void challenge_without_qop (void **state)
+{
+  pjsip_authorization_hdr *hdr;
+  (void) state;
+
+  rx_response(5063, CHALLENGE("401", "Unauthorized",
+        "WWW-Authenticate: Digest realm=\"plain\", nonce=\"p1\""));
+
+  hdr = tx_request(5063);
+  assert_non_null (hdr);
+  assert_pj_str ("p1", &hdr->credential.digest.nonce);
+  assert_int_equal (0, hdr->credential.digest.qop.slen);
+  assert_int_equal (0, hdr->credential.digest.nc.slen);
+}
+
+static void nextnonce_resets_nc (void **state)
+{
+  pjsip_authorization_hdr *hdr;
+  (void) state;
+
+  rx_response(5062, CHALLENGE("200", "OK",
+        "Authentication-Info: qop=auth, nextnonce=\"n2\", nc=00000003"));
+
+  hdr = tx_request(5062);
+  assert_non_null (hdr);
+  assert_pj_str ("n2", &hdr->credential.digest.nonce);
+  assert_pj_str ("00000001", &hdr->credential.digest.nc);
+}
+
+static void save_round_trip (void **state)
+{
+  char buf[1024];
+  size_t len;
+  FILE *f;
+  (void) state;
+
+  sippak_auth_cache_save(&app);
+
+  f = fopen(CACHE_FILE, "r");
+  assert_non_null (f);
+  len = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+  buf[len] = '\0';
+
+  assert_non_null (strstr(buf, "127.0.0.1:5061\tfile\tfnonce\tfopaque\t7\t1\t0\n"));
+  assert_non_null (strstr(buf, "127.0.0.1:5062\ttest\tn2\t\t1\t1\t0\n"));
+  assert_non_null (strstr(buf, "127.0.0.1:5063\tplain\tp1\t\t1\t0\t0\n"));
+}
+
+int main(int argc, const char *argv[])
+{
+  pj_status_t status;
+  pj_caching_pool cp;
+  FILE *f;
+
+  pj_log_set_level(0); // do not print pj debug on init
+
+  pj_init();
+
+  pj_caching_pool_init(&cp, &pj_pool_factory_default_policy, 0);
+
+  status = pjsip_endpt_create(&cp.factory, "TEST_AUTH_CACHE", &endpt);
+  PJ_ASSERT_RETURN(status == PJ_SUCCESS, status);
+
+  pool = pjsip_endpt_create_pool(endpt, PROJECT_NAME, POOL_INIT, POOL_INCR);
+
+  status = pjsip_loop_start(endpt, NULL);
+  PJ_ASSERT_RETURN(status == PJ_SUCCESS, status);
+
+  f = fopen(CACHE_FILE, "w");
+  PJ_ASSERT_RETURN(f != NULL, PJ_EINVAL);
+  fputs(FILE_ENTRY, f);
+  fclose(f);
+
+  sippak_init(&app);
+  app.pool = pool;
+  app.endpt = endpt;
+  app.cfg.username = pj_str("alice");
+  app.cfg.password = pj_str("secret");
+  app.cfg.auth_cache = CACHE_FILE;
+
+  status = sippak_mod_auth_cache_register(&app);
+  PJ_ASSERT_RETURN(status == PJ_SUCCESS, status);
+
+  /* Tests share module cache and run in order. */
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(loaded_entry_increments_nc),
+    cmocka_unit_test(unknown_server_not_authorized),
+    cmocka_unit_test(other_user_not_authorized),
+    cmocka_unit_test(challenge_qop_auth_int_only),
+    cmocka_unit_test(challenge_qop_auth_in_list),
+    cmocka_unit_test(challenge_without_qop),
+    cmocka_unit_test(nextnonce_resets_nc),
+    cmocka_unit_test(save_round_trip),
+  };
+  status = cmocka_run_group_tests_name("Auth cache", tests, NULL, NULL);
+
+  remove(CACHE_FILE);
+  pjsip_endpt_release_pool (endpt, pool);
+  pjsip_endpt_destroy(endpt);
+
+  return status;
+}
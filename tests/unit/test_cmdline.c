@@ -0,0 +1,209 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include "sippak.h"
+
+pjsip_endpoint *endpt;
+pj_pool_t *pool;
+
+static int setup_app(void **state)
+{
+  struct sippak_app *app = malloc(sizeof(struct sippak_app));
+
+  sippak_init(app);
+  app->pool = pool;
+  app->endpt = endpt;
+
+  *state = app;
+  return 0;
+}
+
+static int teardown_app(void **state)
+{
+  free(*state);
+  return 0;
+}
+
+static void cmdline_ping (void **state)
+{
+  struct sippak_app *app = *state;
+  struct sippak_probe probe;
+  const char *cmd;
+  char line[] = "  ping -u alice -p secret  sip:bob@example.com";
+
+  assert_int_equal (PJ_SUCCESS, sippak_cmdline_probe (app, pool, line, &probe, &cmd));
+  assert_string_equal ("ping", cmd);
+  assert_string_equal ("OPTIONS", probe.method);
+  assert_string_equal ("sip:bob@example.com", probe.uri);
+  assert_string_equal ("alice", probe.username);
+  assert_string_equal ("secret", probe.password);
+  assert_null (probe.body);
+  assert_null (probe.cb);
+}
+
+static void cmdline_message_quoted (void **state)
+{
+  struct sippak_app *app = *state;
+  struct sippak_probe probe;
+  const char *cmd;
+  char line[] = "message --body=\"hello there\" sip:bob@example.com";
+  char quoted[] = "message \"--body=hi\"\" all\" sip:bob@example.com";
+
+  assert_int_equal (PJ_SUCCESS, sippak_cmdline_probe (app, pool, line, &probe, &cmd));
+  assert_string_equal ("message", cmd);
+  assert_string_equal ("MESSAGE", probe.method);
+  assert_string_equal ("hello there", probe.body);
+
+  assert_int_equal (PJ_SUCCESS, sippak_cmdline_probe (app, pool, quoted, &probe, &cmd));
+  assert_string_equal ("hi all", probe.body);
+  // username defaults to destination user
+  assert_string_equal ("bob", probe.username);
+  assert_null (probe.password);
+}
+
+static void cmdline_register_contact (void **state)
+{
+  struct sippak_app *app = *state;
+  struct sippak_probe probe;
+  const char *cmd;
+  pj_str_t host = pj_str("10.0.0.1");
+  char line[] = "register -X 60 sip:alice@example.com";
+  char clist[] = "register --clist sip:alice@example.com";
+
+  app->tp_pool.cnt = 1;
+  app->tp_pool.ent = pj_pool_zalloc(pool, sizeof(*app->tp_pool.ent));
+  app->tp_pool.ent[0].host = &host;
+  app->tp_pool.ent[0].port = 5070;
+
+  assert_int_equal (PJ_SUCCESS, sippak_cmdline_probe (app, pool, line, &probe, &cmd));
+  assert_string_equal ("register", cmd);
+  assert_string_equal ("sip:alice@10.0.0.1:5070", probe.contact);
+  assert_int_equal (60, probe.expires);
+
+  assert_int_equal (PJ_SUCCESS, sippak_cmdline_probe (app, pool, clist, &probe, &cmd));
+  assert_null (probe.contact);
+}
+
+static void cmdline_cred_store (void **state)
+{
+  struct sippak_app *app = *state;
+  struct sippak_probe probe;
+  const char *cmd;
+  const char *path = "/tmp/sippak_test_cmdline.htdigest";
+  char alice[] = "ping -u alice sip:bob@example.com";
+  char carol[] = "ping -u carol sip:bob@example.com";
+  char plain[] = "ping -u alice -p secret sip:bob@example.com";
+  FILE *f = fopen(path, "w");
+
+  fputs("alice:example.com:b1726872c344b6dc8365b774f8fd6412\n", f);
+  fclose(f);
+  assert_int_equal (PJ_SUCCESS, sippak_cred_store_load(app, path));
+  remove(path);
+
+  assert_int_equal (PJ_SUCCESS, sippak_cmdline_probe (app, pool, alice, &probe, &cmd));
+  assert_non_null (probe.cred);
+  assert_int_equal (PJSIP_CRED_DATA_DIGEST, probe.cred->data_type);
+  assert_int_equal (0, pj_strcmp2(&probe.cred->username, "alice"));
+
+  assert_int_equal (PJ_SUCCESS, sippak_cmdline_probe (app, pool, carol, &probe, &cmd));
+  assert_null (probe.cred);
+
+  // password of line wins
+  assert_int_equal (PJ_SUCCESS, sippak_cmdline_probe (app, pool, plain, &probe, &cmd));
+  assert_null (probe.cred);
+  assert_string_equal ("secret", probe.password);
+}
+
+static void cmdline_invalid (void **state)
+{
+  struct sippak_app *app = *state;
+  struct sippak_probe probe;
+  const char *cmd;
+  char invite[] = "invite sip:alice@example.com";
+  char no_dest[] = "ping";
+  char bad_opt[] = "ping --local-port=0 sip:alice@example.com";
+  int level = pj_log_get_level();
+  char quiet[] = "ping -vvvv sip:alice@example.com";
+  char *ignored[] = {
+    "ping --proxy=sip:10.0.0.1 sip:alice@example.com",
+    "ping -H \"X-Foo: bar\" sip:alice@example.com",
+    "ping --proto=tcp sip:alice@example.com",
+    "message -F Alice sip:alice@example.com",
+    "ping --local-host=127.0.0.1 sip:alice@example.com",
+    "register -A test sip:alice@example.com",
+  };
+  char buf[128];
+  unsigned i;
+
+  assert_int_equal (PJ_ENOTSUP, sippak_cmdline_probe (app, pool, invite, &probe, &cmd));
+  assert_int_equal (PJ_CLI_EINVARG, sippak_cmdline_probe (app, pool, no_dest, &probe, &cmd));
+  assert_string_equal ("unknown", cmd);
+  assert_int_equal (PJ_CLI_EINVARG, sippak_cmdline_probe (app, pool, bad_opt, &probe, &cmd));
+
+  // options of shared transports and headers are refused, not dropped
+  for (i = 0; i < PJ_ARRAY_SIZE(ignored); i++) {
+    pj_ansi_strcpy(buf, ignored[i]);
+    assert_int_equal (PJ_ENOTSUP, sippak_cmdline_probe (app, pool, buf, &probe, &cmd));
+  }
+
+  // line options do not change process log level
+  assert_int_equal (PJ_SUCCESS, sippak_cmdline_probe (app, pool, quiet, &probe, &cmd));
+  assert_int_equal (level, pj_log_get_level());
+}
+
+static void cmdline_json (void **state)
+{
+  char buf[SIPPAK_CMDLINE_JSON_LEN];
+  pj_str_t reason = pj_str("Bad \"Request\"");
+  int len;
+
+  (void) state;
+
+  len = sippak_cmdline_json (buf, sizeof(buf), 3, "ping", PJ_SUCCESS, 400, &reason, 1500);
+  assert_string_equal ("{\"id\":3,\"cmd\":\"ping\",\"status\":\"ok\",\"code\":400,"
+      "\"reason\":\"Bad \\\"Request\\\"\",\"latency_us\":1500}\n", buf);
+  assert_int_equal (strlen(buf), len);
+
+  len = sippak_cmdline_json (buf, sizeof(buf), 4, "unknown", PJ_ENOTSUP, 0, NULL, 0);
+  assert_non_null (strstr(buf, "{\"id\":4,\"cmd\":\"unknown\",\"status\":\"error\",\"error\":\""));
+  assert_null (strstr(buf, "\"code\""));
+  assert_int_equal ('\n', buf[len - 1]);
+}
+
+int main(int argc, const char *argv[])
+{
+  pj_status_t status;
+  pj_caching_pool cp;
+
+  pj_log_set_level(0); // do not print pj debug on init
+
+  pj_init();
+
+  pj_caching_pool_init(&cp, &pj_pool_factory_default_policy, 0);
+
+  status = pjsip_endpt_create(&cp.factory, "TEST_CMDLINE", &endpt);
+  PJ_ASSERT_RETURN(status == PJ_SUCCESS, status);
+
+  pool = pjsip_endpt_create_pool(endpt, PROJECT_NAME, POOL_INIT, POOL_INCR);
+
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(cmdline_ping, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(cmdline_message_quoted, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(cmdline_register_contact, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(cmdline_cred_store, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(cmdline_invalid, setup_app, teardown_app),
+    cmocka_unit_test(cmdline_json),
+  };
+
+  status = cmocka_run_group_tests_name("Daemon and batch command lines", tests, NULL, NULL);
+
+  pjsip_endpt_release_pool (endpt, pool);
+  pjsip_endpt_destroy(endpt);
+  pj_caching_pool_destroy(&cp);
+
+  return status;
+}
@@ -290,6 +290,367 @@ static void log_has_sender (void **state)
   assert_int_equal (PJ_LOG_HAS_SENDER, app->cfg.log_decor & PJ_LOG_HAS_SENDER);
 }
 
+static void set_log_method_filter (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--log-method=invite, BYE" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_int_equal (2, app->cfg.log_filter.method_cnt);
+  assert_int_equal (PJSIP_INVITE_METHOD, app->cfg.log_filter.method[0].id);
+  assert_int_equal (PJSIP_BYE_METHOD, app->cfg.log_filter.method[1].id);
+}
+
+static void set_log_status_filter (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--log-status=4xx,5XX" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_int_equal ((1 << 4) | (1 << 5), app->cfg.log_filter.status_mask);
+}
+
+static void set_log_status_exclude (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--log-status=!1xx" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_int_equal (SIPPAK_LOG_STATUS_ALL & ~(1 << 1), app->cfg.log_filter.status_mask);
+}
+
+static void set_log_status_invalid (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--log-status=4xx,200" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_CLI_EINVARG);
+}
+
+static void set_log_sample (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--log-sample=100", "--log-compact" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  assert_int_equal (1, app->cfg.log_filter.sample);
+  assert_false (app->cfg.log_filter.compact);
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_int_equal (100, app->cfg.log_filter.sample);
+  assert_true (app->cfg.log_filter.compact);
+}
+
+static void set_log_sample_invalid (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--log-sample=0" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_CLI_EINVARG);
+}
+
+static void set_timing (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--timing" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  assert_false (app->cfg.timing);
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_true (app->cfg.timing);
+}
+
+static void set_timeseries (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--timeseries=/tmp/run.csv" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  assert_null (app->cfg.timeseries);
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_string_equal ("/tmp/run.csv", app->cfg.timeseries);
+}
+
+static void set_auth_cache (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "-p", "secret", "--auth-cache=/tmp/sippak.auth" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  assert_null (app->cfg.auth_cache);
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_string_equal ("/tmp/sippak.auth", app->cfg.auth_cache);
+}
+
+static void set_cred_file (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--cred-file=/tmp/users.htdigest" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  assert_null (app->cfg.cred_file);
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_string_equal ("/tmp/users.htdigest", app->cfg.cred_file);
+}
+
+static void set_daemon_socket (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--daemon", "--socket=/run/sippak.sock" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  assert_false (app->cfg.daemon);
+  assert_string_equal (SIPPAK_DAEMON_SOCKET, app->cfg.socket);
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_true (app->cfg.daemon);
+  assert_string_equal ("/run/sippak.sock", app->cfg.socket);
+}
+
+static void set_batch (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--batch=probes.txt", "--concurrency=100", "--ordered" };
+  char *argv_stdin[] = { "./sippak", "--batch" };
+  char *argv_inv[] = { "./sippak", "--batch", "--concurrency=0" };
+
+  assert_false (app->cfg.batch.enabled);
+  assert_int_equal (SIPPAK_BATCH_CONCURRENCY, app->cfg.batch.concurrency);
+  status = sippak_getopts (4, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_true (app->cfg.batch.enabled);
+  assert_string_equal ("probes.txt", app->cfg.batch.file);
+  assert_int_equal (100, app->cfg.batch.concurrency);
+  assert_true (app->cfg.batch.ordered);
+
+  sippak_init (app);
+  status = sippak_getopts (2, argv_stdin, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_true (app->cfg.batch.enabled);
+  assert_null (app->cfg.batch.file);
+  assert_false (app->cfg.batch.ordered);
+
+  status = sippak_getopts (3, argv_inv, app);
+  assert_int_equal (status, PJ_CLI_EINVARG);
+}
+
+static void set_scenario (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--scenario=flow.txt" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  assert_null (app->cfg.scenario);
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_string_equal ("flow.txt", app->cfg.scenario);
+}
+
+static void set_serve (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--delay=250", "--fail-ratio=10", "serve" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  assert_int_equal (0, app->cfg.serve.delay);
+  assert_int_equal (0, app->cfg.serve.fail_ratio);
+  assert_int_equal (SIPPAK_SERVE_FAIL_CODE, app->cfg.serve.fail_code);
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_int_equal (CMD_SERVE, app->cfg.cmd);
+  assert_null (app->cfg.dest.ptr);
+  assert_int_equal (250, app->cfg.serve.delay);
+  assert_int_equal (10, app->cfg.serve.fail_ratio);
+}
+
+static void set_bench (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "-q", "--count=50", "bench" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_int_equal (CMD_BENCH, app->cfg.cmd);
+  assert_null (app->cfg.dest.ptr);
+  assert_int_equal (50, app->cfg.count);
+}
+
+static void set_serve_invalid (void **state)
+{
+  struct sippak_app *app = *state;
+  char *ratio[] = { "./sippak", "--fail-ratio=101", "serve" };
+  char *code[] = { "./sippak", "--fail-code=200", "serve" };
+
+  assert_int_equal (PJ_CLI_EINVARG, sippak_getopts (3, ratio, app));
+  assert_int_equal (PJ_CLI_EINVARG, sippak_getopts (3, code, app));
+}
+
+static void set_stats_interval (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--stats-interval=5", "--stats-file=/tmp/foo.stats" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  assert_int_equal (0, app->cfg.stats.interval);
+  assert_string_equal (SIPPAK_STATS_FILE, app->cfg.stats.file);
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_int_equal (5, app->cfg.stats.interval);
+  assert_string_equal ("/tmp/foo.stats", app->cfg.stats.file);
+}
+
+static void set_stats_interval_invalid (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--stats-interval=foo" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_CLI_EINVARG);
+}
+
+static void set_stateless_count_rate (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--stateless", "--retrans", "--count=1000", "--rate=500", "sip:alice@example.com" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  assert_false (app->cfg.stateless);
+  assert_false (app->cfg.retrans);
+  assert_int_equal (1, app->cfg.count);
+  assert_int_equal (0, app->cfg.rate);
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_true (app->cfg.stateless);
+  assert_true (app->cfg.retrans);
+  assert_int_equal (1000, app->cfg.count);
+  assert_int_equal (500, app->cfg.rate);
+}
+
+static void set_stateless_mmsg (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--stateless", "--mmsg", "sip:alice@example.com" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  assert_int_equal (SIPPAK_UDP_IO_SOCK, app->cfg.udp_io);
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_int_equal (SIPPAK_UDP_IO_MMSG, app->cfg.udp_io);
+}
+
+static void set_stateless_uring (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--stateless", "--uring", "sip:alice@example.com" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_int_equal (SIPPAK_UDP_IO_URING, app->cfg.udp_io);
+}
+
+static void set_stateless_threads (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--stateless", "--threads=8", "sip:alice@example.com" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  assert_int_equal (1, app->cfg.threads);
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_int_equal (8, app->cfg.threads);
+}
+
+static void set_stateless_spin (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--stateless", "--rate=20000", "--spin=50", "sip:alice@example.com" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  assert_int_equal (0, app->cfg.spin);
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_int_equal (50, app->cfg.spin);
+  assert_int_equal (20000, app->cfg.rate);
+}
+
+static void set_threads_invalid (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--stateless", "--threads=65", "sip:alice@example.com" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_CLI_EINVARG);
+}
+
+static void set_count_invalid (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--count=0" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_CLI_EINVARG);
+}
+
+static void set_raw_files (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "raw", "--file=invite.sip", "--file=bye.sip", "--count=10", "sip:alice@example.com" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  assert_int_equal (0, app->cfg.raw.cnt);
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_int_equal (app->cfg.cmd, CMD_RAW);
+  assert_int_equal (2, app->cfg.raw.cnt);
+  assert_string_equal ("invite.sip", app->cfg.raw.file[0]);
+  assert_string_equal ("bye.sip", app->cfg.raw.file[1]);
+  assert_int_equal (10, app->cfg.count);
+}
+
 static void set_local_port_long (void **state)
 {
   pj_status_t status;
@@ -314,6 +675,42 @@ static void set_local_port_short (void **state)
   assert_int_equal (9988, app->cfg.local_port);
 }
 
+static void set_local_port_range (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--local-port=5060-5099" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_int_equal (5060, app->cfg.local_port);
+  assert_int_equal (5099, app->cfg.local_port_max);
+}
+
+static void set_local_port_range_invalid (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--local-port=5099-5060" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_CLI_EINVARG);
+}
+
+static void set_local_port_invalid (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--local-port=70000" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  // daemon parses client lines, invalid value must not exit
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_CLI_EINVARG);
+}
+
 static void set_username_long (void **state)
 {
   pj_status_t status;
@@ -663,9 +1060,38 @@ int main(int argc, const char *argv[])
     cmocka_unit_test_setup_teardown(log_has_time, setup_app, teardown_app),
     cmocka_unit_test_setup_teardown(log_has_level, setup_app, teardown_app),
     cmocka_unit_test_setup_teardown(log_has_sender, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_log_method_filter, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_log_status_filter, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_log_status_exclude, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_log_status_invalid, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_log_sample, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_log_sample_invalid, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_timing, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_timeseries, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_auth_cache, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_cred_file, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_daemon_socket, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_batch, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_scenario, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_serve, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_serve_invalid, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_bench, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_stats_interval, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_stats_interval_invalid, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_stateless_count_rate, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_stateless_mmsg, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_stateless_uring, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_stateless_threads, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_threads_invalid, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_stateless_spin, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_count_invalid, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_raw_files, setup_app, teardown_app),
 
     cmocka_unit_test_setup_teardown(set_local_port_long, setup_app, teardown_app),
     cmocka_unit_test_setup_teardown(set_local_port_short, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_local_port_range, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_local_port_range_invalid, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(set_local_port_invalid, setup_app, teardown_app),
     cmocka_unit_test_setup_teardown(set_username_long, setup_app, teardown_app),
     cmocka_unit_test_setup_teardown(set_username_short, setup_app, teardown_app),
     cmocka_unit_test_setup_teardown(set_local_host_short, setup_app, teardown_app),
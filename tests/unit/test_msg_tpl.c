@@ -0,0 +1,273 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <string.h>
+#include <cmocka.h>
+
+#include "sippak.h"
+
+pjsip_endpoint *endpt;
+pj_pool_t *pool;
+
+static int setup_app(void **state)
+{
+  struct sippak_app *app = malloc(sizeof(struct sippak_app));
+
+  sippak_init(app);
+
+  app->pool = pool;
+  app->endpt = endpt;
+
+  *state = app;
+  return 0;
+}
+
+static int teardown_app(void **state)
+{
+  free(*state);
+  return 0;
+}
+
+static pjsip_tx_data *create_request (struct sippak_app *app, const pjsip_method *method)
+{
+  pj_status_t status;
+  pjsip_tx_data *tdata;
+  pj_str_t local = pj_str("10.0.0.1");
+  pj_str_t cnt = sippak_create_contact_hdr(app, &local, 5060);
+  pj_str_t from = sippak_create_from_hdr(app);
+  pj_str_t ruri = sippak_create_ruri(app);
+
+  status = pjsip_endpt_create_request(endpt, method, &ruri, &from,
+      &app->cfg.dest, &cnt, NULL, -1, NULL, &tdata);
+  assert_int_equal (status, PJ_SUCCESS);
+
+  return tdata;
+}
+
+static pjsip_msg *parse_rendered (char *buf, pj_size_t len)
+{
+  pjsip_msg *msg;
+
+  buf[len] = '\0';
+  msg = pjsip_parse_msg(pool, buf, len, NULL);
+  assert_non_null (msg);
+
+  return msg;
+}
+
+static void tpl_render_patches_fields (void **state)
+{
+  pj_status_t status;
+  pjsip_tx_data *tdata;
+  struct sippak_msg_tpl *tpl;
+  char buf1[PJSIP_MAX_PKT_LEN], buf2[PJSIP_MAX_PKT_LEN];
+  pj_size_t len1, len2;
+  pjsip_msg *msg1, *msg2;
+  pjsip_via_hdr *via1, *via2;
+  pj_str_t local = pj_str("10.0.0.1");
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "--user-agent=sippak test", "sip:alice@example.com" };
+  int argc = sizeof(argv) / sizeof(char*);
+  pj_str_t ua = pj_str("User-Agent");
+
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+
+  tdata = create_request(app, &pjsip_options_method);
+  status = sippak_msg_tpl_create(app, tdata, &local, 5060, &tpl);
+  assert_int_equal (status, PJ_SUCCESS);
+  pjsip_tx_data_dec_ref(tdata);
+
+  len1 = sippak_msg_tpl_render(tpl, 1, 1, buf1);
+  len2 = sippak_msg_tpl_render(tpl, 2, 1234567, buf2);
+  assert_int_equal (len1, tpl->len);
+  assert_int_equal (len2, tpl->len);
+
+  msg1 = parse_rendered(buf1, len1);
+  msg2 = parse_rendered(buf2, len2);
+
+  via1 = pjsip_msg_find_hdr(msg1, PJSIP_H_VIA, NULL);
+  via2 = pjsip_msg_find_hdr(msg2, PJSIP_H_VIA, NULL);
+  assert_int_equal (0, pj_strncmp2(&via1->branch_param, "z9hG4bK", 7));
+  assert_int_equal (23, via1->branch_param.slen);
+  assert_true (pj_strcmp(&via1->branch_param, &via2->branch_param) != 0);
+  assert_int_equal (5060, via1->sent_by.port);
+  assert_int_equal (0, pj_strcmp2(&via1->sent_by.host, "10.0.0.1"));
+
+  assert_true (pj_strcmp(&PJSIP_MSG_CID_HDR(msg1)->id, &PJSIP_MSG_CID_HDR(msg2)->id) != 0);
+  assert_true (pj_strcmp(&PJSIP_MSG_FROM_HDR(msg1)->tag, &PJSIP_MSG_FROM_HDR(msg2)->tag) != 0);
+
+  assert_int_equal (1, PJSIP_MSG_CSEQ_HDR(msg1)->cseq);
+  assert_int_equal (1234567, PJSIP_MSG_CSEQ_HDR(msg2)->cseq);
+  assert_int_equal (PJSIP_OPTIONS_METHOD, PJSIP_MSG_CSEQ_HDR(msg2)->method.id);
+
+  assert_non_null (pjsip_msg_find_hdr_by_name(msg1, &ua, NULL));
+}
+
+static void tpl_match_branch (void **state)
+{
+  pj_status_t status;
+  pjsip_tx_data *tdata;
+  struct sippak_msg_tpl *tpl;
+  char buf[PJSIP_MAX_PKT_LEN];
+  pj_size_t len;
+  pj_uint64_t seq = 0;
+  pjsip_via_hdr *via;
+  pj_str_t local = pj_str("10.0.0.1");
+  pj_str_t foreign = pj_str("z9hG4bKPj6f2a1c0e-8d3b-4f6a-9e21");
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "sip:alice@example.com" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+
+  tdata = create_request(app, &pjsip_options_method);
+  status = sippak_msg_tpl_create(app, tdata, &local, 5060, &tpl);
+  assert_int_equal (status, PJ_SUCCESS);
+  pjsip_tx_data_dec_ref(tdata);
+
+  len = sippak_msg_tpl_render(tpl, 987654321, 1, buf);
+  via = pjsip_msg_find_hdr(parse_rendered(buf, len), PJSIP_H_VIA, NULL);
+
+  assert_true (sippak_msg_tpl_match(tpl, &via->branch_param, &seq));
+  assert_int_equal (987654321, seq);
+  assert_false (sippak_msg_tpl_match(tpl, &foreign, &seq));
+}
+
+static void tpl_content_length (void **state)
+{
+  pj_status_t status;
+  pjsip_tx_data *tdata;
+  struct sippak_msg_tpl *tpl;
+  char buf[PJSIP_MAX_PKT_LEN];
+  pj_size_t len;
+  pjsip_msg *msg;
+  pjsip_clen_hdr *clen;
+  pj_str_t local = pj_str("10.0.0.1");
+  pj_str_t type = pj_str("text");
+  pj_str_t subtype = pj_str("plain");
+  pj_str_t text = pj_str("Hello world");
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "sip:alice@example.com" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+
+  tdata = create_request(app, &pjsip_options_method);
+  tdata->msg->body = pjsip_msg_body_create(tdata->pool, &type, &subtype, &text);
+  status = sippak_msg_tpl_create(app, tdata, &local, 5060, &tpl);
+  assert_int_equal (status, PJ_SUCCESS);
+  pjsip_tx_data_dec_ref(tdata);
+
+  assert_int_equal (text.slen, tpl->body_len);
+
+  len = sippak_msg_tpl_render(tpl, 1, 1, buf);
+  msg = parse_rendered(buf, len);
+
+  clen = pjsip_msg_find_hdr(msg, PJSIP_H_CONTENT_LENGTH, NULL);
+  assert_non_null (clen);
+  assert_int_equal (text.slen, clen->len);
+  assert_int_equal (0, pj_memcmp("Hello world", buf + len - text.slen, text.slen));
+}
+
+static void tpl_load_raw_tokens (void **state)
+{
+  pj_status_t status;
+  struct sippak_msg_tpl *tpl;
+  char buf[PJSIP_MAX_PKT_LEN];
+  pj_size_t len;
+  pj_uint64_t seq = 0;
+  pjsip_msg *msg;
+  pjsip_via_hdr *via;
+  pj_str_t local = pj_str("10.0.0.1");
+  pj_str_t text = pj_str(
+      "\n"
+      "MESSAGE sip:alice@example.com SIP/2.0\n"
+      "Via: SIP/2.0/[transport] [local_ip]:[local_port];branch=[branch]\n"
+      "From: <sip:bob@[local_ip]>;tag=[from_tag]\n"
+      "To: <sip:alice@[remote_ip]:[remote_port]>\n"
+      "Call-ID: [call_id]\n"
+      "CSeq: [cseq] MESSAGE\n"
+      "X-Array: [0]\n"
+      "Content-Type: text/plain\n"
+      "Content-Length: [len]\n"
+      "\n"
+      "Hello");
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "raw", "sip:alice@example.com" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+
+  status = sippak_msg_tpl_load(app, &text, &local, 5070, &tpl);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_true (tpl->has_branch);
+  assert_int_equal (5, tpl->body_len);
+
+  len = sippak_msg_tpl_render(tpl, 7, 3, buf);
+  buf[len] = '\0';
+  assert_non_null (strstr(buf, "Via: SIP/2.0/UDP 10.0.0.1:5070;branch=z9hG4bK"));
+  assert_non_null (strstr(buf, "To: <sip:alice@example.com:5060>\r\n"));
+  assert_non_null (strstr(buf, "X-Array: [0]\r\n"));
+  assert_non_null (strstr(buf, "Content-Length: 5\r\n\r\nHello"));
+
+  msg = parse_rendered(buf, len);
+  assert_int_equal (3, PJSIP_MSG_CSEQ_HDR(msg)->cseq);
+  via = pjsip_msg_find_hdr(msg, PJSIP_H_VIA, NULL);
+  assert_true (sippak_msg_tpl_match(tpl, &via->branch_param, &seq));
+  assert_int_equal (7, seq);
+}
+
+static void tpl_load_raw_no_body (void **state)
+{
+  pj_status_t status;
+  struct sippak_msg_tpl *tpl;
+  pj_str_t local = pj_str("10.0.0.1");
+  pj_str_t text = pj_str("OPTIONS sip:alice@example.com SIP/2.0\nCSeq: 1 OPTIONS\n");
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak", "raw", "sip:alice@example.com" };
+  int argc = sizeof(argv) / sizeof(char*);
+
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+
+  status = sippak_msg_tpl_load(app, &text, &local, 5070, &tpl);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_false (tpl->has_branch);
+  assert_int_equal (0, tpl->body_len);
+  assert_int_equal (0, pj_memcmp(tpl->buf + tpl->len - 4, "\r\n\r\n", 4));
+}
+
+int main(int argc, const char *argv[])
+{
+  pj_status_t status;
+  pj_caching_pool cp;
+
+  pj_log_set_level(0); // do not print pj debug on init
+
+  pj_init();
+
+  pj_caching_pool_init(&cp, &pj_pool_factory_default_policy, 0);
+
+  status = pjsip_endpt_create(&cp.factory, "TEST_MSG_TPL", &endpt);
+  PJ_ASSERT_RETURN(status == PJ_SUCCESS, status);
+
+  pool = pjsip_endpt_create_pool(endpt, PROJECT_NAME, POOL_INIT, POOL_INCR);
+
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(tpl_render_patches_fields, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(tpl_content_length, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(tpl_match_branch, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(tpl_load_raw_tokens, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(tpl_load_raw_no_body, setup_app, teardown_app),
+  };
+  status = cmocka_run_group_tests_name("Request template", tests, NULL, NULL);
+
+  pjsip_endpt_release_pool (endpt, pool);
+  pjsip_endpt_destroy(endpt);
+
+  return status;
+}
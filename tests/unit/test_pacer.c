@@ -0,0 +1,124 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <unistd.h>
+
+#include "sippak.h"
+
+#define MS 1000000ULL
+
+static void pacer_slots (void **state)
+{
+  struct sippak_pacer p;
+
+  assert_int_equal (PJ_SUCCESS, sippak_pacer_init(&p, 1000 * MS, 3, 0));
+
+  // no rounding drift, slot 3 is exactly one second later
+  assert_true (sippak_pacer_slot(&p, 0) == 1000 * MS);
+  assert_true (sippak_pacer_slot(&p, 1) == 1000 * MS + 333333333);
+  assert_true (sippak_pacer_slot(&p, 2) == 1000 * MS + 666666666);
+  assert_true (sippak_pacer_slot(&p, 3) == 2000 * MS);
+  assert_true (sippak_pacer_slot(&p, 3000000) == 1000 * MS + 1000000 * 1000 * MS);
+
+  sippak_pacer_destroy(&p);
+}
+
+static void pacer_jitter (void **state)
+{
+  struct sippak_pacer p;
+
+  assert_int_equal (PJ_SUCCESS, sippak_pacer_init(&p, 0, 1000, 0));
+
+  // slots every ms, second send 20 usec late, third on time
+  sippak_pacer_sent(&p, 0, 0);
+  sippak_pacer_sent(&p, MS, MS + 20000);
+  sippak_pacer_sent(&p, 2 * MS, 2 * MS);
+
+  assert_true (p.sent == 3);
+  assert_true (p.intervals == 2);
+  assert_true (p.jitter_sum == 40000);
+  assert_true (p.jitter_max == 20000);
+  assert_true (p.late_max == 20000);
+  assert_true (sippak_pacer_rate(&p) == 1000);
+
+  sippak_pacer_destroy(&p);
+}
+
+static void pacer_merge (void **state)
+{
+  struct sippak_pacer a, b, sum;
+
+  // two stripes of one schedule at 2000 per second
+  assert_int_equal (PJ_SUCCESS, sippak_pacer_init(&a, 0, 2000, 0));
+  assert_int_equal (PJ_SUCCESS, sippak_pacer_init(&b, 0, 2000, 0));
+  sippak_pacer_sent(&a, 0, 0);
+  sippak_pacer_sent(&a, MS, MS + 10000);
+  sippak_pacer_sent(&b, MS / 2, MS / 2);
+  sippak_pacer_sent(&b, 3 * MS / 2, 3 * MS / 2);
+
+  pj_bzero(&sum, sizeof(sum));
+  sippak_pacer_merge(&sum, &a);
+  sippak_pacer_merge(&sum, &b);
+
+  assert_true (sum.sent == 4);
+  assert_true (sum.intervals == 2);
+  assert_true (sum.jitter_max == 10000);
+  assert_true (sum.first == 0);
+  assert_true (sum.last == 3 * MS / 2);
+  assert_true (sippak_pacer_rate(&sum) == 2000);
+
+  sippak_pacer_destroy(&a);
+  sippak_pacer_destroy(&b);
+}
+
+static void pacer_wait_slot (void **state)
+{
+  struct sippak_pacer p;
+  pj_uint64_t slot;
+
+  assert_int_equal (PJ_SUCCESS, sippak_pacer_init(&p, sippak_pacer_now(), 1000, 100));
+
+  slot = sippak_pacer_slot(&p, 2);
+  assert_int_equal (PJ_SUCCESS, sippak_pacer_wait(&p, slot, PJ_INVALID_SOCKET));
+  assert_true (sippak_pacer_now() >= slot);
+
+  // slot in the past returns at once
+  assert_int_equal (PJ_SUCCESS, sippak_pacer_wait(&p, sippak_pacer_slot(&p, 0), PJ_INVALID_SOCKET));
+
+  sippak_pacer_destroy(&p);
+}
+
+static void pacer_wait_readable (void **state)
+{
+  struct sippak_pacer p;
+  int fds[2];
+
+  assert_int_equal (0, pipe(fds));
+  assert_int_equal (1, write(fds[1], "x", 1));
+  assert_int_equal (PJ_SUCCESS, sippak_pacer_init(&p, sippak_pacer_now(), 1, 0));
+
+  // readable socket cuts one second wait short
+  assert_int_equal (PJ_EPENDING, sippak_pacer_wait(&p, sippak_pacer_slot(&p, 1), fds[0]));
+  assert_int_equal (1, p.wakeups);
+
+  sippak_pacer_destroy(&p);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+int main(int argc, const char *argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(pacer_slots),
+    cmocka_unit_test(pacer_jitter),
+    cmocka_unit_test(pacer_merge),
+    cmocka_unit_test(pacer_wait_slot),
+    cmocka_unit_test(pacer_wait_readable),
+  };
+
+  pj_log_set_level(0);
+  pj_init();
+
+  return cmocka_run_group_tests_name("Send pacer", tests, NULL, NULL);
+}
@@ -0,0 +1,182 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <cmocka.h>
+
+#include "sippak.h"
+
+#define PROBES 8
+
+static pj_sock_t uas_sock = PJ_INVALID_SOCKET;
+static int uas_port;
+static volatile int uas_quit;
+
+// callbacks run on worker threads of session
+static pj_atomic_t *results;
+static int codes[PROBES];
+
+/* Answer every request with 200, copying transaction headers. */
+static int uas_thread (void *arg)
+{
+  char req[PJSIP_MAX_PKT_LEN], resp[PJSIP_MAX_PKT_LEN];
+  pj_sockaddr src;
+  int src_len, len;
+  pj_ssize_t size;
+  char *line, *end;
+
+  PJ_UNUSED_ARG(arg);
+
+  while (!uas_quit) {
+    size = sizeof(req) - 1;
+    src_len = sizeof(src);
+    if (pj_sock_recvfrom(uas_sock, req, &size, 0, &src, &src_len) != PJ_SUCCESS || size <= 0) {
+      continue;
+    }
+    req[size] = '\0';
+
+    len = pj_ansi_snprintf(resp, sizeof(resp), "SIP/2.0 200 OK\r\n");
+    for (line = strstr(req, "\r\n") + 2; (end = strstr(line, "\r\n")) && end != line; line = end + 2) {
+      if (strncmp(line, "Via:", 4) == 0 || strncmp(line, "From:", 5) == 0 ||
+          strncmp(line, "Call-ID:", 8) == 0 || strncmp(line, "CSeq:", 5) == 0) {
+        len += pj_ansi_snprintf(resp + len, sizeof(resp) - len, "%.*s\r\n", (int)(end - line), line);
+      } else if (strncmp(line, "To:", 3) == 0) {
+        len += pj_ansi_snprintf(resp + len, sizeof(resp) - len, "%.*s;tag=uas\r\n", (int)(end - line), line);
+      }
+    }
+    len += pj_ansi_snprintf(resp + len, sizeof(resp) - len, "Content-Length: 0\r\n\r\n");
+
+    size = len;
+    pj_sock_sendto(uas_sock, resp, &size, 0, &src, src_len);
+  }
+  return 0;
+}
+
+static void on_result (const struct sippak_result *res)
+{
+  int i = (int)(pj_ssize_t)res->user_data;
+
+  codes[i] = res->status == PJ_SUCCESS ? res->code : -res->code;
+  pj_atomic_inc(results);
+}
+
+static void wait_results (int n)
+{
+  int i;
+
+  for (i = 0; i < 500 && pj_atomic_get(results) < n; i++) {
+    pj_thread_sleep(10);
+  }
+  assert_int_equal (n, pj_atomic_get(results));
+}
+
+static void session_ping_concurrent (void **state)
+{
+  sippak_session *sess;
+  struct sippak_probe probe;
+  char uri[64];
+  int i;
+
+  assert_int_equal (PJ_SUCCESS, sippak_session_create(2, &sess));
+
+  // one transaction layer per process
+  sippak_session *other = NULL;
+  assert_int_equal (PJ_EINVALIDOP, sippak_session_create(1, &other));
+
+  pj_ansi_snprintf(uri, sizeof(uri), "sip:alice@127.0.0.1:%d", uas_port);
+  pj_bzero(&probe, sizeof(probe));
+  probe.uri = uri;
+  probe.timeout_ms = 2000;
+  probe.cb = &on_result;
+
+  pj_atomic_set(results, 0);
+  for (i = 0; i < PROBES; i++) {
+    probe.user_data = (void *)(pj_ssize_t)i;
+    assert_int_equal (PJ_SUCCESS, sippak_session_ping(sess, &probe));
+  }
+  wait_results(PROBES);
+
+  for (i = 0; i < PROBES; i++) {
+    assert_int_equal (200, codes[i]);
+  }
+
+  sippak_session_destroy(sess);
+}
+
+static void session_ping_timeout (void **state)
+{
+  sippak_session *sess;
+  struct sippak_probe probe;
+
+  assert_int_equal (PJ_SUCCESS, sippak_session_create(1, &sess));
+
+  // nobody listens on discard port
+  pj_bzero(&probe, sizeof(probe));
+  probe.uri = "sip:127.0.0.1:9";
+  probe.timeout_ms = 200;
+  probe.cb = &on_result;
+
+  pj_atomic_set(results, 0);
+  assert_int_equal (PJ_SUCCESS, sippak_session_ping(sess, &probe));
+  wait_results(1);
+  assert_true (codes[0] < 0);
+
+  probe.uri = "not a uri";
+  assert_int_not_equal (PJ_SUCCESS, sippak_session_ping(sess, &probe));
+
+  // resolve failure inside send is reported once, by return or callback
+  probe.uri = "sip:alice@sippak.invalid";
+  pj_atomic_set(results, 0);
+  if (sippak_session_ping(sess, &probe) == PJ_SUCCESS) {
+    wait_results(1);
+  } else {
+    pj_thread_sleep(100);
+    assert_int_equal (0, pj_atomic_get(results));
+  }
+
+  sippak_session_destroy(sess);
+}
+
+int main(int argc, const char *argv[])
+{
+  pj_caching_pool cp;
+  pj_pool_t *pool;
+  pj_thread_t *thread;
+  pj_sockaddr addr;
+  int addr_len = sizeof(addr);
+  pj_str_t host = pj_str("127.0.0.1");
+  struct timeval tv = {0, 100000};
+  int status;
+
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(session_ping_concurrent),
+    cmocka_unit_test(session_ping_timeout),
+  };
+
+  pj_log_set_level(0);
+  pj_init();
+  pj_caching_pool_init(&cp, &pj_pool_factory_default_policy, 0);
+  pool = pj_pool_create(&cp.factory, "test", POOL_INIT, POOL_INCR, NULL);
+  pj_atomic_create(pool, 0, &results);
+
+  pj_sockaddr_init(pj_AF_INET(), &addr, &host, 0);
+  pj_sock_socket(pj_AF_INET(), pj_SOCK_DGRAM(), 0, &uas_sock);
+  pj_sock_bind(uas_sock, &addr, pj_sockaddr_get_len(&addr));
+  pj_sock_getsockname(uas_sock, &addr, &addr_len);
+  pj_sock_setsockopt(uas_sock, pj_SOL_SOCKET(), SO_RCVTIMEO, &tv, sizeof(tv));
+  uas_port = pj_sockaddr_get_port(&addr);
+  pj_thread_create(pool, "uas", &uas_thread, NULL, 0, 0, &thread);
+
+  status = cmocka_run_group_tests_name("Embedded session", tests, NULL, NULL);
+
+  uas_quit = 1;
+  pj_thread_join(thread);
+  pj_sock_close(uas_sock);
+  pj_atomic_destroy(results);
+  pj_pool_release(pool);
+  pj_caching_pool_destroy(&cp);
+
+  return status;
+}
@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <setjmp.h>
@@ -103,6 +104,87 @@ static void create_ruri_tcp (void **state)
   assert_string_equal("sip:jane@sip.com;transport=tcp", ruri.ptr);
 }
 
+static void dest_descriptor_reused (void **state)
+{
+  struct sippak_app *app = *state;
+
+  app->cfg.dest = pj_str("sip:alice@sipproxy.com");
+  app->cfg.username = pj_str("bob");
+
+  pj_str_t ruri = sippak_create_ruri(app);
+  pj_size_t used = pj_pool_get_used_size(app->pool);
+
+  pj_str_t ruri2 = sippak_create_ruri(app);
+  pj_str_t reg_ruri = sippak_create_reg_ruri(app);
+  pj_str_t from = sippak_create_from_hdr(app);
+
+  assert_true (app->dest.ready);
+  assert_ptr_equal (ruri.ptr, ruri2.ptr);
+  assert_string_equal ("sip:sipproxy.com", reg_ruri.ptr);
+  assert_string_equal ("sip:bob@sipproxy.com", from.ptr);
+  assert_string_equal ("sip:alice@sipproxy.com", app->dest.to.ptr);
+  assert_int_equal (used, pj_pool_get_used_size(app->pool));
+}
+
+static void dest_descriptor_invalid_uri (void **state)
+{
+  struct sippak_app *app = *state;
+
+  app->cfg.dest = pj_str("alice@sipproxy.com");
+
+  assert_int_not_equal (PJ_SUCCESS, sippak_dest_init(app));
+  assert_false (app->dest.ready);
+}
+
+static void add_sip_headers_from_template (void **state)
+{
+  pj_status_t status;
+  pjsip_tx_data *tdata;
+  pjsip_hdr *hdr;
+  struct sippak_app *app = *state;
+  char *argv[] = { "./sippak",
+    "--user-agent=sippak test",
+    "-H X-Foo: bar",
+    "-H Subject: Ping Pong",
+    "-H x-foo: baz",
+    "sip:alice@example.com" };
+  int argc = sizeof(argv) / sizeof(char*);
+  pj_str_t xfoo = pj_str("X-Foo");
+  pj_str_t subj = pj_str("Subject");
+  pj_str_t subj_val = pj_str("Original");
+  pj_str_t ua = pj_str("User-Agent");
+
+  status = sippak_getopts (argc, argv, app);
+  assert_int_equal (status, PJ_SUCCESS);
+  // duplicate name is compiled once
+  assert_int_equal (3, app->hdr_tpl.cnt);
+
+  pj_str_t ruri = sippak_create_ruri(app);
+  pj_str_t from = sippak_create_from_hdr(app);
+  status = pjsip_endpt_create_request(endpt, &pjsip_options_method,
+      &ruri, &from, &app->cfg.dest, NULL, NULL, -1, NULL, &tdata);
+  assert_int_equal (status, PJ_SUCCESS);
+
+  pjsip_msg_add_hdr(tdata->msg, (pjsip_hdr*)
+      pjsip_generic_string_hdr_create(tdata->pool, &subj, &subj_val));
+
+  sippak_add_sip_headers (tdata, app);
+
+  hdr = pjsip_msg_find_hdr_by_name(tdata->msg, &xfoo, NULL);
+  assert_non_null (hdr);
+  // cloned, template header is not linked into message
+  assert_true (hdr != (pjsip_hdr*)app->cfg.hdrs.h[0]);
+  assert_null (pjsip_msg_find_hdr_by_name(tdata->msg, &xfoo, hdr->next));
+
+  hdr = pjsip_msg_find_hdr_by_name(tdata->msg, &subj, NULL);
+  assert_true (pj_strcmp2(&((pjsip_generic_string_hdr*)hdr)->hvalue, "Original") == 0);
+  assert_null (pjsip_msg_find_hdr_by_name(tdata->msg, &subj, hdr->next));
+
+  assert_non_null (pjsip_msg_find_hdr_by_name(tdata->msg, &ua, NULL));
+
+  pjsip_tx_data_dec_ref(tdata);
+}
+
 static void create_contact_hdr (void **state)
 {
   pj_status_t status;
@@ -142,6 +224,293 @@ static void create_contact_hdr_cli_arg (void **state)
   assert_string_equal("sip:foo@10.123.123.22:14511", cnt.ptr);
 }
 
+static void local_hosts_list (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  pj_str_t hosts[8];
+  unsigned cnt;
+
+  app->cfg.local_host = pj_str("10.0.0.1, 10.0.0.7,host.example.com");
+  status = sippak_local_hosts(app, hosts, 8, &cnt);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_int_equal (3, cnt);
+  assert_int_equal (0, pj_strcmp2(&hosts[0], "10.0.0.1"));
+  assert_int_equal (0, pj_strcmp2(&hosts[1], "10.0.0.7"));
+  assert_int_equal (0, pj_strcmp2(&hosts[2], "host.example.com"));
+
+  app->cfg.local_host = pj_str("");
+  status = sippak_local_hosts(app, hosts, 8, &cnt);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_int_equal (1, cnt);
+  assert_int_equal (0, hosts[0].slen);
+}
+
+static void local_hosts_cidr (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  pj_str_t hosts[8];
+  unsigned cnt;
+
+  // network and broadcast addresses are skipped
+  app->cfg.local_host = pj_str("192.168.1.5/29,10.1.1.1");
+  status = sippak_local_hosts(app, hosts, 8, &cnt);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_int_equal (7, cnt);
+  assert_int_equal (0, pj_strcmp2(&hosts[0], "192.168.1.1"));
+  assert_int_equal (0, pj_strcmp2(&hosts[5], "192.168.1.6"));
+  assert_int_equal (0, pj_strcmp2(&hosts[6], "10.1.1.1"));
+
+  app->cfg.local_host = pj_str("10.0.0.9/32");
+  status = sippak_local_hosts(app, hosts, 8, &cnt);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_int_equal (1, cnt);
+  assert_int_equal (0, pj_strcmp2(&hosts[0], "10.0.0.9"));
+}
+
+static void local_hosts_invalid (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  pj_str_t hosts[8];
+  unsigned cnt;
+
+  app->cfg.local_host = pj_str("10.0.0.0/33");
+  status = sippak_local_hosts(app, hosts, 8, &cnt);
+  assert_int_equal (status, PJ_EINVAL);
+
+  // block bigger than array
+  app->cfg.local_host = pj_str("10.0.0.0/24");
+  status = sippak_local_hosts(app, hosts, 8, &cnt);
+  assert_int_equal (status, PJ_EINVAL);
+}
+
+static const char *write_cred_file (const char *text)
+{
+  static const char *path = "/tmp/sippak_test.htdigest";
+  FILE *f = fopen(path, "w");
+
+  fputs(text, f);
+  fclose(f);
+
+  return path;
+}
+
+static void cred_store_lookup (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  const pjsip_cred_info *cred;
+  pj_str_t user;
+  const char *path = write_cred_file(
+      "# users\n"
+      "alice:example.com:B1726872C344B6DC8365B774F8FD6412\r\n"
+      "\n"
+      "bob:example.com:00000000000000000000000000000000\n"
+      "bob:example.com:de896765c22a53d79e4b312203a553a1");
+
+  status = sippak_cred_store_load(app, path);
+  assert_int_equal (status, PJ_SUCCESS);
+  assert_int_equal (2, app->creds.cnt);
+
+  user = pj_str("alice");
+  cred = sippak_cred_store_find(app, &user);
+  assert_non_null (cred);
+  assert_int_equal (PJSIP_CRED_DATA_DIGEST, cred->data_type);
+  assert_int_equal (0, pj_strcmp2(&cred->realm, "example.com"));
+  assert_int_equal (0, pj_strcmp2(&cred->data, "b1726872c344b6dc8365b774f8fd6412"));
+
+  // later line of same user wins
+  user = pj_str("bob");
+  cred = sippak_cred_store_find(app, &user);
+  assert_non_null (cred);
+  assert_int_equal (0, pj_strcmp2(&cred->data, "de896765c22a53d79e4b312203a553a1"));
+
+  user = pj_str("carol");
+  assert_null (sippak_cred_store_find(app, &user));
+  remove(path);
+}
+
+static void cred_store_set_cred (void **state)
+{
+  pj_status_t status;
+  struct sippak_app *app = *state;
+  pjsip_cred_info cred;
+  const char *path = write_cred_file("alice:example.com:b1726872c344b6dc8365b774f8fd6412\n");
+
+  status = sippak_cred_store_load(app, path);
+  assert_int_equal (status, PJ_SUCCESS);
+  remove(path);
+
+  app->cfg.username = pj_str("alice");
+  app->cfg.password = pj_str("secret");
+  sippak_set_cred(app, &cred);
+  assert_int_equal (PJSIP_CRED_DATA_DIGEST, cred.data_type);
+
+  // user not in store falls back to password
+  app->cfg.username = pj_str("bob");
+  sippak_set_cred(app, &cred);
+  assert_int_equal (PJSIP_CRED_DATA_PLAIN_PASSWD, cred.data_type);
+  assert_int_equal (0, pj_strcmp2(&cred.realm, "*"));
+  assert_int_equal (0, pj_strcmp2(&cred.data, "secret"));
+}
+
+static void cred_store_invalid (void **state)
+{
+  struct sippak_app *app = *state;
+  const char *path;
+
+  path = write_cred_file("alice:example.com:b1726872c344\n");
+  assert_int_equal (PJ_EINVAL, sippak_cred_store_load(app, path));
+
+  path = write_cred_file("alice:b1726872c344b6dc8365b774f8fd6412\n");
+  assert_int_equal (PJ_EINVAL, sippak_cred_store_load(app, path));
+
+  path = write_cred_file("");
+  assert_int_equal (PJ_EINVAL, sippak_cred_store_load(app, path));
+  remove(path);
+
+  assert_int_equal (PJ_ENOTFOUND, sippak_cred_store_load(app, "/nonexistent/sippak.htdigest"));
+}
+
+static pjsip_tx_data *create_options (const char *uri)
+{
+  pjsip_tx_data *tdata;
+  pj_str_t ruri = pj_str((char*)uri);
+  pj_str_t from = pj_str("sip:alice@example.com");
+
+  assert_int_equal (PJ_SUCCESS, pjsip_endpt_create_request(endpt, &pjsip_options_method,
+        &ruri, &from, &ruri, NULL, NULL, -1, NULL, &tdata));
+  return tdata;
+}
+
+static void auth_sess_per_target (void **state)
+{
+  struct sippak_app *app = *state;
+  pjsip_auth_clt_sess *sess1, *sess2, *sess3;
+  pjsip_tx_data *tdata1, *tdata2, *tdata3;
+
+  app->endpt = endpt;
+  app->cfg.username = pj_str("alice");
+  app->cfg.password = pj_str("secret");
+
+  tdata1 = create_options("sip:alice@example.com:5070");
+  tdata2 = create_options("sip:bob@example.com:5070");
+  tdata3 = create_options("sip:alice@example.com");
+
+  assert_int_equal (PJ_SUCCESS, sippak_auth_sess(app, tdata1, &sess1));
+  assert_int_equal (1, sess1->cred_cnt);
+
+  // same host and port share session
+  assert_int_equal (PJ_SUCCESS, sippak_auth_sess(app, tdata2, &sess2));
+  assert_true (sess1 == sess2);
+
+  assert_int_equal (PJ_SUCCESS, sippak_auth_sess(app, tdata3, &sess3));
+  assert_true (sess1 != sess3);
+  assert_int_equal (2, pj_hash_count(app->auth_sess));
+
+  pjsip_tx_data_dec_ref(tdata1);
+  pjsip_tx_data_dec_ref(tdata2);
+  pjsip_tx_data_dec_ref(tdata3);
+}
+
+/* 401 challenge of realm "test" */
+static pjsip_rx_data *rx_challenge (const char *nonce, pj_bool_t stale)
+{
+  pjsip_rx_data *rdata = PJ_POOL_ZALLOC_T(pool, pjsip_rx_data);
+
+  rdata->tp_info.pool = pool;
+  rdata->pkt_info.len = pj_ansi_snprintf(rdata->pkt_info.packet,
+      sizeof(rdata->pkt_info.packet),
+      "SIP/2.0 401 Unauthorized\r\n"
+      "Via: SIP/2.0/UDP 127.0.0.1;branch=z9hG4bKstale\r\n"
+      "From: <sip:alice@example.com>;tag=1\r\n"
+      "To: <sip:alice@example.com>;tag=2\r\n"
+      "Call-ID: stale\r\n"
+      "CSeq: 1 OPTIONS\r\n"
+      "WWW-Authenticate: Digest realm=\"test\", nonce=\"%s\"%s\r\n"
+      "Content-Length: 0\r\n\r\n",
+      nonce, stale ? ", stale=true" : "");
+  assert_non_null (pjsip_parse_rdata(rdata->pkt_info.packet, rdata->pkt_info.len, rdata));
+
+  return rdata;
+}
+
+static void auth_stale_count_per_request (void **state)
+{
+  struct sippak_app *app = *state;
+  pjsip_tx_data *tdata, *retry;
+  pj_status_t status = PJ_SUCCESS;
+  unsigned i;
+
+  app->endpt = endpt;
+  app->cfg.username = pj_str("alice");
+  app->cfg.password = pj_str("secret");
+
+  // server rotates nonce, every request of long run answers own challenge
+  for (i = 0; i < 2 * PJSIP_MAX_STALE_COUNT; i++) {
+    tdata = create_options("sip:alice@example.com:5080");
+    assert_int_equal (PJ_SUCCESS,
+        sippak_auth_reinit_req(app, rx_challenge("fresh", i > 0), tdata, &retry));
+    assert_non_null (pjsip_msg_find_hdr(retry->msg, PJSIP_H_AUTHORIZATION, NULL));
+    pjsip_tx_data_dec_ref(retry);
+    pjsip_tx_data_dec_ref(tdata);
+  }
+
+  // stale nonce answered over and over within one request still fails
+  tdata = create_options("sip:alice@example.com:5080");
+  for (i = 0; status == PJ_SUCCESS && i <= PJSIP_MAX_STALE_COUNT + 1; i++) {
+    status = sippak_auth_reinit_req(app, rx_challenge("stale", i > 0), tdata, &retry);
+    if (status == PJ_SUCCESS) {
+      pjsip_tx_data_dec_ref(retry);
+    }
+  }
+  assert_int_equal (PJSIP_EAUTHSTALECOUNT, status);
+  pjsip_tx_data_dec_ref(tdata);
+}
+
+static void transport_bound_once (void **state)
+{
+  struct sippak_app *app = *state;
+  pj_str_t *addr1, *addr2;
+  int port1, port2;
+
+  app->endpt = endpt;
+  app->cfg.local_host = pj_str("127.0.0.1");
+
+  assert_int_equal (PJ_SUCCESS, sippak_transport_init(app, &addr1, &port1));
+  assert_int_equal (1, app->tp_pool.cnt);
+
+  // next step of scenario keeps contact
+  app->cfg.local_port = port1 + 1;
+  assert_int_equal (PJ_SUCCESS, sippak_transport_init(app, &addr2, &port2));
+  assert_true (addr1 == addr2);
+  assert_int_equal (port1, port2);
+  assert_int_equal (1, app->tp_pool.cnt);
+}
+
+static void cmd_module_once (void **state)
+{
+  struct sippak_app *app = *state;
+  static pjsip_module mod = {
+    NULL, NULL, { "mod-test", 8 }, -1, PJSIP_MOD_PRIORITY_APPLICATION,
+  };
+
+  app->endpt = endpt;
+
+  assert_int_equal (PJ_SUCCESS, sippak_tsx_layer_init(app));
+  assert_int_equal (PJ_SUCCESS, sippak_tsx_layer_init(app));
+  assert_int_not_equal (-1, pjsip_tsx_layer_instance()->id);
+
+  assert_int_equal (PJ_SUCCESS, sippak_cmd_module_register(app, &mod));
+  assert_true (app->cmd_mod == &mod);
+  assert_int_equal (PJ_SUCCESS, sippak_cmd_module_register(app, &mod));
+
+  assert_int_equal (PJ_SUCCESS, pjsip_endpt_unregister_module(endpt, &mod));
+  assert_int_equal (-1, mod.id);
+}
+
 int main(int argc, const char *argv[])
 {
   pj_status_t status;
@@ -167,10 +536,25 @@ int main(int argc, const char *argv[])
     cmocka_unit_test_setup_teardown(create_ruri_tcp, setup_app, teardown_app),
     cmocka_unit_test_setup_teardown(create_reg_ruri, setup_app, teardown_app),
     cmocka_unit_test_setup_teardown(create_reg_ruri_tcp, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(dest_descriptor_reused, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(dest_descriptor_invalid_uri, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(add_sip_headers_from_template, setup_app, teardown_app),
 
     cmocka_unit_test_setup_teardown(create_contact_hdr, setup_app, teardown_app),
     cmocka_unit_test_setup_teardown(create_contact_hdr_user, setup_app, teardown_app),
     cmocka_unit_test_setup_teardown(create_contact_hdr_cli_arg, setup_app, teardown_app),
+
+    cmocka_unit_test_setup_teardown(local_hosts_list, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(local_hosts_cidr, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(local_hosts_invalid, setup_app, teardown_app),
+
+    cmocka_unit_test_setup_teardown(cred_store_lookup, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(cred_store_set_cred, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(cred_store_invalid, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(auth_sess_per_target, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(auth_stale_count_per_request, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(transport_bound_once, setup_app, teardown_app),
+    cmocka_unit_test_setup_teardown(cmd_module_once, setup_app, teardown_app),
   };
   status = cmocka_run_group_tests_name("SIP packet helper", tests, NULL, NULL);
 
@@ -0,0 +1,236 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "vclock.h"
+
+pjsip_endpoint *endpt;
+pj_pool_t *pool;
+static sippak_session *sess;
+static struct sippak_app app;
+
+static int results;
+static struct sippak_result last;
+static int cancels;
+
+/* Commands end main loop here, tests have no loop. */
+PJ_DEF(void) sippak_loop_cancel ()
+{
+  cancels++;
+}
+
+/* Linked by ping.c, stateless mode is not tested. */
+PJ_DEF(pj_status_t) sippak_stateless_start (struct sippak_app *app,
+                                            struct sippak_msg_tpl **tpl,
+                                            unsigned tpl_cnt)
+{
+  PJ_UNUSED_ARG(app);
+  PJ_UNUSED_ARG(tpl);
+  PJ_UNUSED_ARG(tpl_cnt);
+  return PJ_ENOTSUP;
+}
+
+static void on_result (const struct sippak_result *res)
+{
+  last = *res;
+  results++;
+}
+
+static int setup_sess (void **state)
+{
+  (void) state;
+  results = 0;
+  return sippak_session_attach(endpt, &sess) == PJ_SUCCESS ? 0 : -1;
+}
+
+static int teardown_sess (void **state)
+{
+  (void) state;
+  sippak_session_destroy(sess);
+  // completed transactions are gone before next test
+  vclock_advance(endpt, 60000);
+  return 0;
+}
+
+/* Command sends from loop transport, like bound by previous scenario step. */
+static int setup_cmd (void **state)
+{
+  (void) state;
+  cancels = 0;
+  sippak_init(&app);
+  app.pool = pool;
+  app.endpt = endpt;
+  app.cfg.dest = pj_str(LOOPBACK_URI);
+  app.tp_pool.cnt = 1;
+  app.tp_pool.ent = pj_pool_calloc(pool, 1, sizeof(*app.tp_pool.ent));
+  app.tp_pool.ent[0].host = &loopback_transport()->local_name.host;
+  app.tp_pool.ent[0].port = loopback_transport()->local_name.port;
+  return 0;
+}
+
+static int teardown_cmd (void **state)
+{
+  (void) state;
+  if (app.cmd_mod) {
+    pjsip_endpt_unregister_module(endpt, app.cmd_mod);
+    app.cmd_mod = NULL;
+  }
+  vclock_advance(endpt, 60000);
+  return 0;
+}
+
+static void ping (unsigned timeout_ms)
+{
+  struct sippak_probe probe;
+
+  pj_bzero(&probe, sizeof(probe));
+  probe.uri = LOOPBACK_URI;
+  probe.timeout_ms = timeout_ms;
+  probe.cb = &on_result;
+  assert_int_equal (PJ_SUCCESS, sippak_session_ping(sess, &probe));
+}
+
+/* Timer E doubles from T1 up to T2, timer F is 64*T1. */
+static void timer_e_f_timeout (void **state)
+{
+  static const unsigned sent_ms[] = {
+    0, 500, 1500, 3500, 7500, 11500, 15500, 19500, 23500, 27500, 31500
+  };
+  unsigned i;
+
+  loopback_answer(0, 0);
+  ping(0);
+
+  vclock_advance(endpt, 31999);
+  assert_int_equal (0, results);
+  assert_int_equal (PJ_ARRAY_SIZE(sent_ms), loopback_rx_count());
+  for (i = 0; i < PJ_ARRAY_SIZE(sent_ms); i++) {
+    assert_int_equal (sent_ms[i], loopback_rx_ms(i));
+  }
+
+  vclock_advance(endpt, 1);
+  assert_int_equal (1, results);
+  assert_int_equal (PJ_ETIMEDOUT, last.status);
+}
+
+static void retrans_answered (void **state)
+{
+  loopback_answer(200, 2);
+  ping(0);
+  assert_int_equal (0, results);
+
+  vclock_advance(endpt, 1499);
+  assert_int_equal (0, results);
+  assert_int_equal (2, loopback_rx_count());
+
+  vclock_advance(endpt, 1);
+  assert_int_equal (1, results);
+  assert_int_equal (PJ_SUCCESS, last.status);
+  assert_int_equal (200, last.code);
+  assert_int_equal (1500000, last.latency_us);
+}
+
+/* Probe timeout ends transaction before first retransmission. */
+static void probe_timeout (void **state)
+{
+  loopback_answer(0, 0);
+  ping(200);
+
+  vclock_advance(endpt, 199);
+  assert_int_equal (0, results);
+
+  vclock_advance(endpt, 1);
+  assert_int_equal (1, results);
+  assert_int_equal (PJ_ETIMEDOUT, last.status);
+  assert_int_equal (1, loopback_rx_count());
+  assert_int_equal (200000, last.latency_us);
+}
+
+/* Ping of test.ping_retrans.pl, options.408 UAS never answers:
+ * send_cb ends command on timeout after 10 retransmissions. */
+static void cmd_ping_timeout (void **state)
+{
+  (void) state;
+  loopback_answer(0, 0);
+  assert_int_equal (PJ_SUCCESS, sippak_cmd_ping(&app));
+
+  vclock_advance(endpt, 31999);
+  assert_int_equal (0, cancels);
+  assert_int_equal (11, loopback_rx_count());
+
+  vclock_advance(endpt, 1);
+  assert_int_equal (1, cancels);
+}
+
+/* Response to retransmission ends command. */
+static void cmd_ping_retrans_answered (void **state)
+{
+  (void) state;
+  loopback_answer(200, 1);
+  assert_int_equal (PJ_SUCCESS, sippak_cmd_ping(&app));
+
+  vclock_advance(endpt, 499);
+  assert_int_equal (0, cancels);
+
+  vclock_advance(endpt, 1);
+  assert_int_equal (1, cancels);
+  assert_int_equal (2, loopback_rx_count());
+}
+
+/* Unanswered SUBSCRIBE ends command with transaction timeout. Refresh
+ * is not tested: command ends when subscription is active and refresh
+ * is evsub timer of pjsip, run only by scenario pause. */
+static void cmd_subscribe_timeout (void **state)
+{
+  (void) state;
+  loopback_answer(0, 0);
+  assert_int_equal (PJ_SUCCESS, sippak_cmd_subscribe(&app));
+
+  vclock_advance(endpt, 31999);
+  assert_int_equal (0, cancels);
+
+  vclock_advance(endpt, 1);
+  assert_true (cancels > 0);
+}
+
+int main(int argc, const char *argv[])
+{
+  pj_status_t status;
+  pj_caching_pool cp;
+
+  pj_log_set_level(0); // do not print pj debug on init
+
+  pj_init();
+
+  status = vclock_init();
+  PJ_ASSERT_RETURN(status == PJ_SUCCESS, status);
+
+  pj_caching_pool_init(&cp, &pj_pool_factory_default_policy, 0);
+
+  status = pjsip_endpt_create(&cp.factory, "TEST_TIMERS", &endpt);
+  PJ_ASSERT_RETURN(status == PJ_SUCCESS, status);
+
+  pool = pjsip_endpt_create_pool(endpt, PROJECT_NAME, POOL_INIT, POOL_INCR);
+
+  status = loopback_start(endpt);
+  PJ_ASSERT_RETURN(status == PJ_SUCCESS, status);
+
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(timer_e_f_timeout, setup_sess, teardown_sess),
+    cmocka_unit_test_setup_teardown(retrans_answered, setup_sess, teardown_sess),
+    cmocka_unit_test_setup_teardown(probe_timeout, setup_sess, teardown_sess),
+    cmocka_unit_test_setup_teardown(cmd_ping_timeout, setup_cmd, teardown_cmd),
+    cmocka_unit_test_setup_teardown(cmd_ping_retrans_answered, setup_cmd, teardown_cmd),
+    cmocka_unit_test_setup_teardown(cmd_subscribe_timeout, setup_cmd, teardown_cmd),
+  };
+
+  status = cmocka_run_group_tests_name("Transaction timers on virtual clock", tests, NULL, NULL);
+
+  loopback_stop(endpt);
+  pjsip_endpt_release_pool(endpt, pool);
+  pjsip_endpt_destroy(endpt);
+  pj_caching_pool_destroy(&cp);
+
+  return status;
+}
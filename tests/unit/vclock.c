@@ -0,0 +1,163 @@
+#define _GNU_SOURCE
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "vclock.h"
+
+static int frozen;
+static struct timespec mono;    // virtual CLOCK_MONOTONIC
+
+static struct {
+  pjsip_endpoint *endpt;
+  pjsip_transport *tp;
+  int code;
+  unsigned drop;
+  pj_time_val start;
+  unsigned cnt;
+  unsigned ms[LOOPBACK_MAX_RX];
+} lb;
+
+/* Interposes libc for pjlib timestamp, other clocks stay real. */
+int clock_gettime (clockid_t clk, struct timespec *ts)
+{
+  if (frozen && clk == CLOCK_MONOTONIC) {
+    *ts = mono;
+    return 0;
+  }
+  return syscall(SYS_clock_gettime, clk, ts);
+}
+
+static void forward (pj_uint64_t msec)
+{
+  pj_uint64_t nsec = mono.tv_nsec + (msec % 1000) * 1000000;
+
+  mono.tv_sec += msec / 1000 + nsec / 1000000000;
+  mono.tv_nsec = nsec % 1000000000;
+}
+
+pj_status_t vclock_init (void)
+{
+  pj_time_val before, after;
+
+  syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &mono);
+  frozen = 1;
+
+  pj_gettickcount(&before);
+  forward(1000);
+  pj_gettickcount(&after);
+  PJ_TIME_VAL_SUB(after, before);
+
+  return PJ_TIME_VAL_MSEC(after) == 1000 ? PJ_SUCCESS : PJ_ENOTSUP;
+}
+
+void vclock_advance (pjsip_endpoint *endpt, unsigned ms)
+{
+  pj_timer_heap_t *ht = pjsip_endpt_get_timer_heap(endpt);
+  pj_time_val zero = {0, 0};
+  pj_time_val now, next, end;
+
+  pj_gettickcount(&end);
+  end.msec += ms;
+  pj_time_val_normalize(&end);
+
+  pjsip_endpt_handle_events(endpt, &zero);
+  while (pj_timer_heap_earliest_time(ht, &next) == PJ_SUCCESS &&
+      PJ_TIME_VAL_LTE(next, end)) {
+    pj_gettickcount(&now);
+    if (PJ_TIME_VAL_GT(next, now)) {
+      PJ_TIME_VAL_SUB(next, now);
+      forward(PJ_TIME_VAL_MSEC(next));
+    }
+    pjsip_endpt_handle_events(endpt, &zero);
+  }
+
+  pj_gettickcount(&now);
+  if (PJ_TIME_VAL_GT(end, now)) {
+    PJ_TIME_VAL_SUB(end, now);
+    forward(PJ_TIME_VAL_MSEC(end));
+  }
+  pjsip_endpt_handle_events(endpt, &zero);
+}
+
+static pj_bool_t on_rx_request (pjsip_rx_data *rdata)
+{
+  pj_time_val now;
+
+  if (rdata->msg_info.msg->line.req.method.id == PJSIP_ACK_METHOD) {
+    return PJ_TRUE;
+  }
+
+  pj_gettickcount(&now);
+  PJ_TIME_VAL_SUB(now, lb.start);
+  if (lb.cnt < LOOPBACK_MAX_RX) {
+    lb.ms[lb.cnt] = PJ_TIME_VAL_MSEC(now);
+  }
+  lb.cnt++;
+
+  if (lb.drop > 0) {
+    lb.drop--;
+    return PJ_TRUE;
+  }
+  if (lb.code) {
+    pjsip_endpt_respond_stateless(lb.endpt, rdata, lb.code, NULL, NULL, NULL);
+  }
+  return PJ_TRUE;
+}
+
+static pjsip_module mod_loopback =
+{
+  NULL, NULL,                 /* prev, next.    */
+  { "mod-loopback", 12 },     /* Name.    */
+  -1,                         /* Id      */
+  PJSIP_MOD_PRIORITY_APPLICATION, /* Priority          */
+  NULL,                       /* load()    */
+  NULL,                       /* start()    */
+  NULL,                       /* stop()    */
+  NULL,                       /* unload()    */
+  &on_rx_request,             /* on_rx_request()  */
+  NULL,                       /* on_rx_response()  */
+  NULL,                       /* on_tx_request.  */
+  NULL,                       /* on_tx_response()  */
+  NULL,                       /* on_tsx_state()  */
+};
+
+pj_status_t loopback_start (pjsip_endpoint *endpt)
+{
+  pj_status_t status;
+
+  lb.endpt = endpt;
+  status = pjsip_loop_start(endpt, &lb.tp);
+  if (status != PJ_SUCCESS) {
+    return status;
+  }
+  return pjsip_endpt_register_module(endpt, &mod_loopback);
+}
+
+void loopback_stop (pjsip_endpoint *endpt)
+{
+  pjsip_endpt_unregister_module(endpt, &mod_loopback);
+}
+
+pjsip_transport *loopback_transport (void)
+{
+  return lb.tp;
+}
+
+void loopback_answer (int code, unsigned drop)
+{
+  lb.code = code;
+  lb.drop = drop;
+  lb.cnt = 0;
+  pj_gettickcount(&lb.start);
+}
+
+unsigned loopback_rx_count (void)
+{
+  return lb.cnt;
+}
+
+unsigned loopback_rx_ms (unsigned idx)
+{
+  return idx < LOOPBACK_MAX_RX ? lb.ms[idx] : 0;
+}
@@ -0,0 +1,41 @@
+/**
+ * Virtual clock and loopback UAS for timer tests.
+ *
+ * Clock of pjlib is frozen when vclock_init is called and moves only
+ * with vclock_advance, that fires every endpoint timer due on the way
+ * in order. Transaction timers of 32 seconds take milliseconds.
+ *
+ * Loopback starts pjsip loop transport and module answering requests
+ * to LOOPBACK_URI statelessly, inside send call of the request.
+ */
+#ifndef __SIPPAK_TESTS_VCLOCK_H
+#define __SIPPAK_TESTS_VCLOCK_H
+
+#include "sippak.h"
+
+#define LOOPBACK_URI "sip:alice@127.0.0.1;transport=loop-dgram"
+#define LOOPBACK_MAX_RX 64
+
+/* Freeze clock. Fails if pjlib does not read CLOCK_MONOTONIC. */
+pj_status_t vclock_init (void);
+
+/* Move clock by ms, handling events of endpoint at every timer due. */
+void vclock_advance (pjsip_endpoint *endpt, unsigned ms);
+
+pj_status_t loopback_start (pjsip_endpoint *endpt);
+
+void loopback_stop (pjsip_endpoint *endpt);
+
+/* Loop transport, commands bind it as their local tuple. */
+pjsip_transport *loopback_transport (void);
+
+/* Drop first "drop" requests, then answer with code. Code 0 never answers. */
+void loopback_answer (int code, unsigned drop);
+
+/* Requests received since loopback_answer. */
+unsigned loopback_rx_count (void);
+
+/* Virtual ms since loopback_answer when request "idx" was received. */
+unsigned loopback_rx_ms (unsigned idx);
+
+#endif